@@ -3,7 +3,57 @@
 #include <string.h>
 #include <stdio.h>
 #include "devices/ide.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+
+/* Request queues.
+
+   Every block device with a driver of its own has a queue of
+   pending requests and an I/O thread that hands them to the
+   driver.  block_submit() only queues a request, so a thread can
+   have many requests outstanding; the synchronous block_read()
+   and friends submit one and wait for it.
+
+   The queue is kept in sector order and served by the C-LOOK
+   elevator: the I/O thread takes the first request at or after
+   the sector where the previous one ended, and once none is
+   left, starts over from the lowest.  Requests queued after it
+   that continue it on disk in the same direction are merged
+   into one driver call, up to BLOCK_MAX_SECTORS sectors.
+
+   block_plug() holds off dispatching, so that a batch of
+   requests can collect, be sorted, and merge, until the matching
+   block_unplug().  Synchronous requests are dispatched even
+   while the queue is plugged, together with whatever they merge
+   with, so that a thread waiting on one cannot stall.
+
+   A driver with a `start' operation gets up to BLOCK_INFLIGHT_MAX
+   transfers at once, and reports each one's end with
+   block_transfer_done(); other drivers get one at a time.  Either
+   way, requests are completed in the I/O thread.
+
+   Buffers must be in kernel memory: the I/O thread has no user
+   address space.  Requests that overlap may be carried out in
+   either order. */
+
+/* Most transfers in flight on a device whose driver has a
+   `start' operation. */
+#define BLOCK_INFLIGHT_MAX 8
+
+/* A transfer handed to the driver: one or more requests merged
+   into a run of consecutive sectors. */
+struct block_batch
+  {
+    struct list_elem elem;              /* In a free or done list. */
+    struct block *block;                /* Device. */
+    struct list requests;               /* Requests, in sector order. */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    bool write;                         /* Write, rather than read? */
+    void *buffers[BLOCK_MAX_SECTORS];   /* The requests' buffers. */
+  };
 
 /* A block device. */
 struct block
@@ -19,6 +69,27 @@ struct block
 
     unsigned long long read_cnt;        /* Number of sectors read. */
     unsigned long long write_cnt;       /* Number of sectors written. */
+
+    /* Request queue, unused if the driver remaps requests. */
+    struct lock queue_lock;             /* Protects the following. */
+    struct list queue;                  /* Pending requests, by sector. */
+    size_t queue_depth;                 /* Requests in `queue'. */
+    int sync_cnt;                       /* Synchronous requests in `queue'. */
+    int plug_cnt;                       /* Held off while nonzero. */
+    block_sector_t head;                /* Sector after the last dispatch. */
+    struct list free_batches;           /* Batches not in flight. */
+
+    struct semaphore wakeup;            /* Up'd when there may be work. */
+    struct list done_batches;           /* Transfers finished but not yet
+                                           completed, protected by
+                                           disabling interrupts. */
+
+    /* Queue statistics. */
+    unsigned long long request_cnt;     /* Requests submitted. */
+    unsigned long long merge_cnt;       /* Merged into another's dispatch. */
+    unsigned long long dispatch_cnt;    /* Calls to the driver. */
+    unsigned long long depth_total;     /* Sum of depth at each submit. */
+    size_t max_depth;                   /* Deepest the queue has been. */
   };
 
 /* List of all block devices. */
@@ -28,6 +99,13 @@ static struct list all_blocks = LIST_INITIALIZER (all_blocks);
 static struct block *block_by_role[BLOCK_ROLE_CNT];
 
 static struct block *list_elem_to_block (struct list_elem *);
+static struct block *queue_of (struct block *);
+static void submit_and_wait (struct block *, block_sector_t, size_t cnt,
+                             void **buffers, bool write);
+static thread_func io_thread;
+static void complete_batches (struct block *);
+static void dispatch_batches (struct block *);
+static list_less_func request_less;
 
 /* Returns a human-readable name for the given block device
    TYPE. */
@@ -120,9 +198,7 @@ check_sector (struct block *block, block_sector_t sector)
 void
 block_read (struct block *block, block_sector_t sector, void *buffer)
 {
-  check_sector (block, sector);
-  block->ops->read (block->aux, sector, buffer);
-  block->read_cnt++;
+  submit_and_wait (block, sector, 1, &buffer, false);
 }
 
 /* Write sector SECTOR to BLOCK from BUFFER, which must contain
@@ -133,10 +209,134 @@ block_read (struct block *block, block_sector_t sector, void *buffer)
 void
 block_write (struct block *block, block_sector_t sector, const void *buffer)
 {
-  check_sector (block, sector);
-  ASSERT (block->type != BLOCK_FOREIGN);
-  block->ops->write (block->aux, sector, buffer);
-  block->write_cnt++;
+  submit_and_wait (block, sector, 1, (void **) &buffer, true);
+}
+
+/* Reads the CNT sectors starting at SECTOR from BLOCK, the Ith
+   into BUFFERS[I], which must have room for BLOCK_SECTOR_SIZE
+   bytes.  The buffers need not be contiguous.  Drivers that
+   support it transfer all the sectors as one request, which is
+   much cheaper than CNT calls to block_read().
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_read_multiple (struct block *block, block_sector_t sector, size_t cnt,
+                     void *buffers[])
+{
+  if (cnt > 0)
+    submit_and_wait (block, sector, cnt, buffers, false);
+}
+
+/* Writes the CNT sectors starting at SECTOR to BLOCK, the Ith
+   from BUFFERS[I], which must contain BLOCK_SECTOR_SIZE bytes.
+   The buffers need not be contiguous, and the same buffer may
+   appear more than once.  Returns after the block device has
+   acknowledged receiving all the data.
+   Internally synchronizes accesses to block devices, so external
+   per-block device locking is unneeded. */
+void
+block_write_multiple (struct block *block, block_sector_t sector,
+                      size_t cnt, const void *buffers[])
+{
+  if (cnt > 0)
+    submit_and_wait (block, sector, cnt, (void **) buffers, true);
+}
+
+/* Initializes REQ to read the CNT sectors starting at SECTOR
+   into BUFFERS, or to write them from BUFFERS if WRITE is true,
+   and then to call DONE, which may use AUX. */
+void
+block_request_init (struct block_request *req, block_sector_t sector,
+                    size_t cnt, void **buffers, bool write,
+                    block_request_func *done, void *aux)
+{
+  req->sector = sector;
+  req->cnt = cnt;
+  req->buffers = buffers;
+  req->write = write;
+  req->sync = false;
+  req->done = done;
+  req->aux = aux;
+}
+
+/* Queues REQ on BLOCK and returns without waiting for it.  REQ
+   and its buffers must stay put until its `done' function is
+   called, in the device's I/O thread; that function should not
+   block for long, since it holds up the device's next request. */
+void
+block_submit (struct block *block, struct block_request *req)
+{
+  ASSERT (req->cnt > 0 && req->cnt <= BLOCK_MAX_SECTORS);
+
+  /* Check the request against each device it passes through. */
+  for (;;)
+    {
+      check_sector (block, req->sector);
+      check_sector (block, req->sector + req->cnt - 1);
+      if (req->write)
+        {
+          ASSERT (block->type != BLOCK_FOREIGN);
+          block->write_cnt += req->cnt;
+        }
+      else
+        block->read_cnt += req->cnt;
+
+      if (block->ops->remap == NULL)
+        break;
+      block = block->ops->remap (block->aux, &req->sector);
+    }
+
+  lock_acquire (&block->queue_lock);
+  list_insert_ordered (&block->queue, &req->elem, request_less, NULL);
+  if (++block->queue_depth > block->max_depth)
+    block->max_depth = block->queue_depth;
+  block->request_cnt++;
+  block->depth_total += block->queue_depth;
+  if (req->sync)
+    block->sync_cnt++;
+  if (block->plug_cnt == 0 || req->sync)
+    sema_up (&block->wakeup);
+  lock_release (&block->queue_lock);
+}
+
+/* Holds off dispatching requests queued on BLOCK, other than
+   synchronous ones, until a matching call to block_unplug(). */
+void
+block_plug (struct block *block)
+{
+  block = queue_of (block);
+  lock_acquire (&block->queue_lock);
+  block->plug_cnt++;
+  lock_release (&block->queue_lock);
+}
+
+/* Undoes one call to block_plug(), letting the requests queued
+   meanwhile be dispatched once no plugs remain. */
+void
+block_unplug (struct block *block)
+{
+  block = queue_of (block);
+  lock_acquire (&block->queue_lock);
+  ASSERT (block->plug_cnt > 0);
+  if (--block->plug_cnt == 0)
+    sema_up (&block->wakeup);
+  lock_release (&block->queue_lock);
+}
+
+/* Called by a driver with a `start' operation when the transfer
+   it was given as TOKEN is done.  May be called from an
+   interrupt handler. */
+void
+block_transfer_done (void *token)
+{
+  struct block_batch *batch = token;
+  struct block *block = batch->block;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  list_push_back (&block->done_batches, &batch->elem);
+  sema_up (&block->wakeup);
+  intr_set_level (old_level);
 }
 
 /* Returns the number of sectors in BLOCK. */
@@ -164,11 +364,12 @@ block_type (struct block *block)
 void
 block_print_stats (void)
 {
+  struct block *block;
   int i;
 
   for (i = 0; i < BLOCK_ROLE_CNT; i++)
     {
-      struct block *block = block_by_role[i];
+      block = block_by_role[i];
       if (block != NULL)
         {
           printf ("%s (%s): %llu reads, %llu writes\n",
@@ -176,6 +377,18 @@ block_print_stats (void)
                   block->read_cnt, block->write_cnt);
         }
     }
+
+  for (block = block_first (); block != NULL; block = block_next (block))
+    if (block->request_cnt > 0)
+      {
+        unsigned long long depth_x10
+          = block->depth_total * 10 / block->request_cnt;
+        printf ("%s queue: %llu requests, %llu merged, %llu dispatches, "
+                "depth %llu.%llu avg, %zu max\n",
+                block->name, block->request_cnt, block->merge_cnt,
+                block->dispatch_cnt, depth_x10 / 10, depth_x10 % 10,
+                block->max_depth);
+      }
 }
 
 /* Registers a new block device with the given NAME.  If
@@ -200,6 +413,36 @@ block_register (const char *name, enum block_type type,
   block->aux = aux;
   block->read_cnt = 0;
   block->write_cnt = 0;
+  block->request_cnt = block->merge_cnt = block->dispatch_cnt = 0;
+  block->depth_total = 0;
+  block->max_depth = 0;
+
+  /* Start the I/O thread, unless requests will be remapped to
+     another device's queue. */
+  if (ops->remap == NULL)
+    {
+      int batch_cnt = ops->start != NULL ? BLOCK_INFLIGHT_MAX : 1;
+
+      lock_init (&block->queue_lock);
+      list_init (&block->queue);
+      block->queue_depth = 0;
+      block->sync_cnt = 0;
+      block->plug_cnt = 0;
+      block->head = 0;
+      list_init (&block->free_batches);
+      while (batch_cnt-- > 0)
+        {
+          struct block_batch *batch = malloc (sizeof *batch);
+          if (batch == NULL)
+            PANIC ("%s: out of memory for I/O batches", block->name);
+          batch->block = block;
+          list_push_back (&block->free_batches, &batch->elem);
+        }
+      sema_init (&block->wakeup, 0);
+      list_init (&block->done_batches);
+      if (thread_create (block->name, PRI_MIN, io_thread, block) == TID_ERROR)
+        PANIC ("%s: could not start I/O thread", block->name);
+    }
 
   printf ("%s: %'"PRDSNu" sectors (", block->name, block->size);
   print_human_readable_size ((uint64_t) block->size * BLOCK_SECTOR_SIZE);
@@ -221,3 +464,220 @@ list_elem_to_block (struct list_elem *list_elem)
           : NULL);
 }
 
+
+/* Returns the device whose queue takes BLOCK's requests. */
+static struct block *
+queue_of (struct block *block)
+{
+  while (block->ops->remap != NULL)
+    {
+      block_sector_t sector = 0;
+      block = block->ops->remap (block->aux, &sector);
+    }
+  return block;
+}
+
+/* Wakes up the thread waiting on the semaphore REQ->aux. */
+static void
+wake_submitter (struct block_request *req)
+{
+  sema_up (req->aux);
+}
+
+/* Reads or writes, as WRITE says, the CNT sectors starting at
+   SECTOR on BLOCK, to or from BUFFERS, and waits until done. */
+static void
+submit_and_wait (struct block *block, block_sector_t sector, size_t cnt,
+                 void **buffers, bool write)
+{
+  struct block_request req;
+  struct semaphore done;
+
+  sema_init (&done, 0);
+  while (cnt > 0)
+    {
+      size_t n = cnt < BLOCK_MAX_SECTORS ? cnt : BLOCK_MAX_SECTORS;
+
+      block_request_init (&req, sector, n, buffers, write,
+                          wake_submitter, &done);
+      req.sync = true;
+      block_submit (block, &req);
+      sema_down (&done);
+
+      sector += n;
+      buffers += n;
+      cnt -= n;
+    }
+}
+
+/* Removes the request that the C-LOOK elevator serves next from
+   BLOCK's queue, which must not be empty, together with the
+   requests that merge with it, and puts them in BATCH. */
+static void
+take_batch (struct block *block, struct block_batch *batch)
+{
+  struct block_request *first, *req;
+  struct list_elem *e;
+  size_t cnt;
+
+  ASSERT (!list_empty (&block->queue));
+
+  /* First request at or past the head, or else the lowest. */
+  for (e = list_begin (&block->queue); e != list_end (&block->queue);
+       e = list_next (e))
+    if (list_entry (e, struct block_request, elem)->sector >= block->head)
+      break;
+  if (e == list_end (&block->queue))
+    e = list_begin (&block->queue);
+  first = list_entry (e, struct block_request, elem);
+
+  /* Take it, and the requests that continue it, gathering their
+     buffers into one vector. */
+  list_init (&batch->requests);
+  cnt = 0;
+  for (;;)
+    {
+      struct list_elem *next = list_remove (e);
+
+      req = list_entry (e, struct block_request, elem);
+      list_push_back (&batch->requests, e);
+      memcpy (batch->buffers + cnt, req->buffers,
+              req->cnt * sizeof *batch->buffers);
+      cnt += req->cnt;
+      block->queue_depth--;
+      if (req->sync)
+        block->sync_cnt--;
+
+      if (next == list_end (&block->queue))
+        break;
+      req = list_entry (next, struct block_request, elem);
+      if (req->write != first->write
+          || req->sector != first->sector + cnt
+          || cnt + req->cnt > BLOCK_MAX_SECTORS)
+        break;
+      block->merge_cnt++;
+      e = next;
+    }
+
+  batch->sector = first->sector;
+  batch->cnt = cnt;
+  batch->write = first->write;
+  block->head = first->sector + cnt;
+  block->dispatch_cnt++;
+}
+
+/* Hands BATCH to BLOCK's driver.  If the driver cannot start a
+   transfer and return, carries it out here and now. */
+static void
+start_batch (struct block *block, struct block_batch *batch)
+{
+  const struct block_operations *ops = block->ops;
+  size_t i;
+
+  if (ops->start != NULL)
+    {
+      ops->start (block->aux, batch->sector, batch->cnt, batch->buffers,
+                  batch->write, batch);
+      return;
+    }
+
+  if (batch->write)
+    {
+      if (ops->write_multiple != NULL)
+        ops->write_multiple (block->aux, batch->sector, batch->cnt,
+                             (const void **) batch->buffers);
+      else
+        for (i = 0; i < batch->cnt; i++)
+          ops->write (block->aux, batch->sector + i, batch->buffers[i]);
+    }
+  else
+    {
+      if (ops->read_multiple != NULL)
+        ops->read_multiple (block->aux, batch->sector, batch->cnt,
+                            batch->buffers);
+      else
+        for (i = 0; i < batch->cnt; i++)
+          ops->read (block->aux, batch->sector + i, batch->buffers[i]);
+    }
+  block_transfer_done (batch);
+}
+
+/* I/O thread for device BLOCK_: completes finished transfers and
+   starts new ones, whenever there may be either to do. */
+static void
+io_thread (void *block_)
+{
+  struct block *block = block_;
+
+  for (;;)
+    {
+      sema_down (&block->wakeup);
+      complete_batches (block);
+      dispatch_batches (block);
+    }
+}
+
+/* Calls the `done' function of each request in each of BLOCK's
+   finished transfers, and frees their batches. */
+static void
+complete_batches (struct block *block)
+{
+  for (;;)
+    {
+      struct block_batch *batch;
+      enum intr_level old_level;
+
+      old_level = intr_disable ();
+      batch = (!list_empty (&block->done_batches)
+               ? list_entry (list_pop_front (&block->done_batches),
+                             struct block_batch, elem)
+               : NULL);
+      intr_set_level (old_level);
+      if (batch == NULL)
+        break;
+
+      while (!list_empty (&batch->requests))
+        {
+          struct block_request *req
+            = list_entry (list_pop_front (&batch->requests),
+                          struct block_request, elem);
+          req->done (req);
+        }
+
+      lock_acquire (&block->queue_lock);
+      list_push_back (&block->free_batches, &batch->elem);
+      lock_release (&block->queue_lock);
+    }
+}
+
+/* Starts as many of BLOCK's queued requests as a free batch is
+   available for, unless the queue is plugged. */
+static void
+dispatch_batches (struct block *block)
+{
+  lock_acquire (&block->queue_lock);
+  while (!list_empty (&block->queue)
+         && (block->plug_cnt == 0 || block->sync_cnt > 0)
+         && !list_empty (&block->free_batches))
+    {
+      struct block_batch *batch
+        = list_entry (list_pop_front (&block->free_batches),
+                      struct block_batch, elem);
+
+      take_batch (block, batch);
+      lock_release (&block->queue_lock);
+      start_batch (block, batch);
+      lock_acquire (&block->queue_lock);
+    }
+  lock_release (&block->queue_lock);
+}
+
+/* Returns true if the request containing A starts at a lower
+   sector than the one containing B. */
+static bool
+request_less (const struct list_elem *a, const struct list_elem *b,
+              void *aux UNUSED)
+{
+  return (list_entry (a, struct block_request, elem)->sector
+          < list_entry (b, struct block_request, elem)->sector);
+}
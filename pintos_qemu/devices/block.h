@@ -1,8 +1,10 @@
 #ifndef DEVICES_BLOCK_H
 #define DEVICES_BLOCK_H
 
+#include <stdbool.h>
 #include <stddef.h>
 #include <inttypes.h>
+#include <list.h>
 
 /* Size of a block device sector in bytes.
    All IDE disks use this sector size, as do most USB and SCSI
@@ -53,9 +55,46 @@ struct block *block_next (struct block *);
 block_sector_t block_size (struct block *);
 void block_read (struct block *, block_sector_t, void *);
 void block_write (struct block *, block_sector_t, const void *);
+void block_read_multiple (struct block *, block_sector_t, size_t cnt,
+                          void *buffers[]);
+void block_write_multiple (struct block *, block_sector_t, size_t cnt,
+                           const void *buffers[]);
 const char *block_name (struct block *);
 enum block_type block_type (struct block *);
 
+/* Asynchronous requests. */
+
+/* Most sectors in one request, or in one transfer by a driver. */
+#define BLOCK_MAX_SECTORS 128
+
+struct block_request;
+typedef void block_request_func (struct block_request *);
+
+/* A request to read or write CNT consecutive sectors, the Ith
+   to or from BUFFERS[I].  block_submit() queues it on the device
+   and returns at once; DONE is called once all the sectors have
+   moved.  CNT may be at most BLOCK_MAX_SECTORS. */
+struct block_request
+  {
+    struct list_elem elem;              /* Element in device queue. */
+    block_sector_t sector;              /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+    void **buffers;                     /* CNT sector buffers, only read
+                                           by a write. */
+    bool write;                         /* Write, rather than read? */
+    bool sync;                          /* Dispatch even while plugged,
+                                           for a waiting submitter. */
+    block_request_func *done;           /* Called on completion. */
+    void *aux;                          /* For DONE's use. */
+  };
+
+void block_request_init (struct block_request *, block_sector_t, size_t cnt,
+                         void **buffers, bool write,
+                         block_request_func *done, void *aux);
+void block_submit (struct block *, struct block_request *);
+void block_plug (struct block *);
+void block_unplug (struct block *);
+
 /* Statistics. */
 void block_print_stats (void);
 
@@ -65,10 +104,35 @@ struct block_operations
   {
     void (*read) (void *aux, block_sector_t, void *buffer);
     void (*write) (void *aux, block_sector_t, const void *buffer);
+
+    /* Optional.  Transfer CNT consecutive sectors, the Ith to or
+       from BUFFERS[I], as a single request to the device.  If
+       null, each sector is transferred by itself. */
+    void (*read_multiple) (void *aux, block_sector_t, size_t cnt,
+                           void *buffers[]);
+    void (*write_multiple) (void *aux, block_sector_t, size_t cnt,
+                            const void *buffers[]);
+
+    /* Optional.  For a device that is a range of another, such as
+       a partition, returns the other device and converts *SECTOR
+       to its numbering.  Requests then go straight to the other
+       device's queue, and the operations above are not used. */
+    struct block *(*remap) (void *aux, block_sector_t *sector);
+
+    /* Optional.  Starts reading the CNT sectors starting at SECTOR
+       into BUFFERS, or writing them from BUFFERS if WRITE, and
+       returns without waiting for the transfer, though it may wait
+       for room to start it.  When the transfer is done, the driver
+       calls block_transfer_done(TOKEN).  Lets the device have
+       several transfers in flight; read and write operations are
+       then not used. */
+    void (*start) (void *aux, block_sector_t, size_t cnt, void *buffers[],
+                   bool write, void *token);
   };
 
 struct block *block_register (const char *name, enum block_type,
                               const char *extra_info, block_sector_t size,
                               const struct block_operations *, void *aux);
+void block_transfer_done (void *token);
 
 #endif /* devices/block.h */
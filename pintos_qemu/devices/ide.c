@@ -4,14 +4,24 @@
 #include <stdbool.h>
 #include <stdio.h>
 #include "devices/block.h"
+#include <string.h>
 #include "devices/partition.h"
+#include "devices/pci.h"
 #include "devices/timer.h"
 #include "threads/io.h"
 #include "threads/interrupt.h"
+#include "threads/palloc.h"
 #include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* The code in this file is an interface to an ATA (IDE)
-   controller.  It attempts to comply to [ATA-3]. */
+   controller.  It attempts to comply to [ATA-3].
+
+   Data moves by bus-master DMA when the controller found on the
+   PCI bus supports it, as the PIIX that QEMU emulates does, and
+   by PIO otherwise.  During a DMA transfer the CPU only waits for
+   the completion interrupt, so other threads run meanwhile.  See
+   [BMIDE] for the bus-master registers. */
 
 /* ATA command block port addresses. */
 #define reg_data(CHANNEL) ((CHANNEL)->reg_base + 0)     /* Data. */
@@ -34,6 +44,7 @@
 #define STA_BSY 0x80            /* Busy. */
 #define STA_DRDY 0x40           /* Device Ready. */
 #define STA_DRQ 0x08            /* Data Request. */
+#define STA_ERR 0x01            /* Error. */
 
 /* Control Register bits. */
 #define CTL_SRST 0x04           /* Software Reset. */
@@ -43,12 +54,53 @@
 #define DEV_LBA 0x40            /* Linear based addressing. */
 #define DEV_DEV 0x10            /* Select device: 0=master, 1=slave. */
 
+/* Bus master IDE registers, as offsets from a channel's
+   `bm_base'. */
+#define BM_COMMAND 0            /* Command. */
+#define BM_STATUS 2             /* Status. */
+#define BM_PRDT 4               /* Physical address of PRD table. */
+
+/* Bus master command register bits. */
+#define BMC_START 0x01          /* Start transfer. */
+#define BMC_READ 0x08           /* Transfer from disk to memory. */
+
+/* Bus master status register bits, cleared by writing 1s. */
+#define BMS_ERROR 0x02          /* Transfer failed. */
+#define BMS_INTR 0x04           /* Device interrupted. */
+
 /* Commands.
    Many more are defined but this is the small subset that we
    use. */
 #define CMD_IDENTIFY_DEVICE 0xec        /* IDENTIFY DEVICE. */
 #define CMD_READ_SECTOR_RETRY 0x20      /* READ SECTOR with retries. */
 #define CMD_WRITE_SECTOR_RETRY 0x30     /* WRITE SECTOR with retries. */
+#define CMD_READ_MULTIPLE 0xc4          /* READ MULTIPLE. */
+#define CMD_WRITE_MULTIPLE 0xc5         /* WRITE MULTIPLE. */
+#define CMD_SET_MULTIPLE_MODE 0xc6      /* SET MULTIPLE MODE. */
+#define CMD_READ_DMA 0xc8               /* READ DMA. */
+#define CMD_WRITE_DMA 0xca              /* WRITE DMA. */
+
+/* Most sectors one command can transfer.  The Sector Count
+   register holds 0 for this many. */
+#define MAX_SECTORS_PER_COMMAND 256
+
+/* Physical Region Descriptor: one physically contiguous piece of
+   memory for a DMA transfer, which must not cross a 64 kB
+   boundary.  A table of them describes a whole transfer. */
+struct prd
+  {
+    uint32_t addr;              /* Physical address. */
+    uint16_t size;              /* Size in bytes; 0 means 64 kB. */
+    uint16_t flags;             /* PRD_EOT on the last entry. */
+  };
+#define PRD_EOT 0x8000          /* End of table. */
+
+/* Pages of each channel's DMA bounce buffer, for buffers that
+   the controller cannot address, such as user memory. */
+#define DMA_BOUNCE_PAGES 4
+#define DMA_BOUNCE_SECTORS (DMA_BOUNCE_PAGES * PGSIZE / BLOCK_SECTOR_SIZE)
+
+bool ide_dma = true;
 
 /* An ATA device. */
 struct ata_disk
@@ -57,6 +109,9 @@ struct ata_disk
     struct channel *channel;    /* Channel that disk is attached to. */
     int dev_no;                 /* Device 0 or 1 for master or slave. */
     bool is_ata;                /* Is device an ATA disk? */
+    int multiple;               /* Sectors per interrupt for READ/WRITE
+                                   MULTIPLE, or 0 if not enabled. */
+    bool dma;                   /* Supports DMA, and it has worked? */
   };
 
 /* An ATA channel (aka controller).
@@ -72,6 +127,10 @@ struct channel
                                    any interrupt would be spurious. */
     struct semaphore completion_wait;   /* Up'd by interrupt handler. */
 
+    uint16_t bm_base;           /* Bus master I/O base, or 0 for no DMA. */
+    struct prd *prdt;           /* PRD table, one page. */
+    uint8_t *bounce;            /* DMA_BOUNCE_PAGES pages. */
+
     struct ata_disk devices[2];     /* The devices on this channel. */
   };
 
@@ -85,7 +144,13 @@ static void reset_channel (struct channel *);
 static bool check_device_type (struct ata_disk *);
 static void identify_ata_device (struct ata_disk *);
 
-static void select_sector (struct ata_disk *, block_sector_t);
+static bool set_multiple_mode (struct ata_disk *, int sectors);
+
+static void select_sectors (struct ata_disk *, block_sector_t, size_t cnt);
+static void ide_read_multiple (void *, block_sector_t, size_t cnt,
+                               void *buffers[]);
+static void ide_write_multiple (void *, block_sector_t, size_t cnt,
+                                const void *buffers[]);
 static void issue_pio_command (struct channel *, uint8_t command);
 static void input_sector (struct channel *, void *);
 static void output_sector (struct channel *, const void *);
@@ -95,14 +160,32 @@ static bool wait_while_busy (const struct ata_disk *);
 static void select_device (const struct ata_disk *);
 static void select_device_wait (const struct ata_disk *);
 
+static size_t pio_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                            const void *buffers[], bool write);
+static size_t dma_transfer (struct ata_disk *, block_sector_t, size_t cnt,
+                            const void *buffers[], bool write);
+
 static void interrupt_handler (struct intr_frame *);
 
 /* Initialize the disk subsystem and detect disks. */
 void
 ide_init (void) 
 {
+  struct pci_device pci;
+  uint16_t bm_base = 0;
   size_t chan_no;
 
+  /* Look for a PCI IDE controller that can be a bus master
+     (programming interface bit 7).  Its fifth base address
+     register holds the bus master registers of both channels. */
+  if (pci_find_class (PCI_CLASS_STORAGE, PCI_SUBCLASS_IDE, &pci)
+      && (pci.prog_if & 0x80) != 0)
+    {
+      bm_base = pci_io_base (&pci, 4);
+      if (bm_base != 0)
+        pci_enable_master (&pci);
+    }
+
   for (chan_no = 0; chan_no < CHANNEL_CNT; chan_no++)
     {
       struct channel *c = &channels[chan_no];
@@ -123,9 +206,16 @@ ide_init (void)
         default:
           NOT_REACHED ();
         }
-      lock_init (&c->lock);
+      lock_init_named (&c->lock, c->name);
       c->expecting_interrupt = false;
       sema_init (&c->completion_wait, 0);
+      c->bm_base = 0;
+      if (bm_base != 0)
+        {
+          c->bm_base = bm_base + chan_no * 8;
+          c->prdt = palloc_get_page (PAL_ASSERT);
+          c->bounce = palloc_get_multiple (PAL_ASSERT, DMA_BOUNCE_PAGES);
+        }
  
       /* Initialize devices. */
       for (dev_no = 0; dev_no < 2; dev_no++)
@@ -136,6 +226,8 @@ ide_init (void)
           d->channel = c;
           d->dev_no = dev_no;
           d->is_ata = false;
+          d->multiple = 0;
+          d->dma = false;
         }
 
       /* Register interrupt handler. */
@@ -286,8 +378,25 @@ identify_ata_device (struct ata_disk *d)
   capacity = *(uint32_t *) &id[60 * 2];
   model = descramble_ata_string (&id[10 * 2], 20);
   serial = descramble_ata_string (&id[27 * 2], 40);
-  snprintf (extra_info, sizeof extra_info,
-            "model \"%s\", serial \"%s\"", model, serial);
+
+  /* Let READ/WRITE MULTIPLE move as many sectors per interrupt
+     as the disk allows (word 47, bits 7:0), instead of one. */
+  if ((uint8_t) id[47 * 2] > 1
+      && set_multiple_mode (d, (uint8_t) id[47 * 2]))
+    d->multiple = (uint8_t) id[47 * 2];
+
+  /* Use DMA if the disk supports it (word 49, bit 8) and the
+     channel has a bus master. */
+  d->dma = (id[49 * 2 + 1] & 0x01) != 0 && c->bm_base != 0;
+
+  if (d->multiple > 0)
+    snprintf (extra_info, sizeof extra_info,
+              "model \"%s\", serial \"%s\", %s, %d sectors/interrupt",
+              model, serial, d->dma ? "DMA" : "PIO", d->multiple);
+  else
+    snprintf (extra_info, sizeof extra_info,
+              "model \"%s\", serial \"%s\", %s",
+              model, serial, d->dma ? "DMA" : "PIO");
 
   /* Disable access to IDE disks over 1 GB, which are likely
      physical IDE disks rather than virtual ones.  If we don't
@@ -309,6 +418,22 @@ identify_ata_device (struct ata_disk *d)
   partition_scan (block);
 }
 
+/* Sends SET MULTIPLE MODE to disk D, so that READ MULTIPLE and
+   WRITE MULTIPLE transfer SECTORS sectors per interrupt.  Returns
+   true if the disk accepted it. */
+static bool
+set_multiple_mode (struct ata_disk *d, int sectors)
+{
+  struct channel *c = d->channel;
+
+  select_device_wait (d);
+  outb (reg_nsect (c), sectors);
+  issue_pio_command (c, CMD_SET_MULTIPLE_MODE);
+  sema_down (&c->completion_wait);
+  wait_while_busy (d);
+  return (inb (reg_alt_status (c)) & STA_ERR) == 0;
+}
+
 /* Translates STRING, which consists of SIZE bytes in a funky
    format, into a null-terminated string in-place.  Drops
    trailing whitespace and null bytes.  Returns STRING.  */
@@ -344,16 +469,7 @@ descramble_ata_string (char *string, int size)
 static void
 ide_read (void *d_, block_sector_t sec_no, void *buffer)
 {
-  struct ata_disk *d = d_;
-  struct channel *c = d->channel;
-  lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_READ_SECTOR_RETRY);
-  sema_down (&c->completion_wait);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk read failed, sector=%"PRDSNu, d->name, sec_no);
-  input_sector (c, buffer);
-  lock_release (&c->lock);
+  ide_read_multiple (d_, sec_no, 1, &buffer);
 }
 
 /* Write sector SEC_NO to disk D from BUFFER, which must contain
@@ -363,37 +479,257 @@ ide_read (void *d_, block_sector_t sec_no, void *buffer)
    per-disk locking is unneeded. */
 static void
 ide_write (void *d_, block_sector_t sec_no, const void *buffer)
+{
+  ide_write_multiple (d_, sec_no, 1, &buffer);
+}
+
+/* Returns the number of sectors that disk D moves per data
+   request when transferring CNT sectors, of which DONE have
+   been moved already. */
+static size_t
+sectors_per_drq (const struct ata_disk *d, size_t cnt, size_t done)
+{
+  size_t left = cnt - done;
+
+  if (d->multiple == 0)
+    return 1;
+  return left < (size_t) d->multiple ? left : (size_t) d->multiple;
+}
+
+/* Reads the CNT sectors starting at SEC_NO from disk D, the Ith
+   into BUFFERS[I].  Each command covers up to
+   MAX_SECTORS_PER_COMMAND sectors.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_read_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                   void *buffers[])
 {
   struct ata_disk *d = d_;
   struct channel *c = d->channel;
+
   lock_acquire (&c->lock);
-  select_sector (d, sec_no);
-  issue_pio_command (c, CMD_WRITE_SECTOR_RETRY);
-  if (!wait_while_busy (d))
-    PANIC ("%s: disk write failed, sector=%"PRDSNu, d->name, sec_no);
-  output_sector (c, buffer);
-  sema_down (&c->completion_wait);
+  while (cnt > 0)
+    {
+      size_t n = dma_transfer (d, sec_no, cnt, (const void **) buffers, false);
+      if (n == 0)
+        n = pio_transfer (d, sec_no, cnt, (const void **) buffers, false);
+      sec_no += n;
+      buffers += n;
+      cnt -= n;
+    }
   lock_release (&c->lock);
 }
 
+/* Writes the CNT sectors starting at SEC_NO to disk D, the Ith
+   from BUFFERS[I], as ide_read_multiple() reads them.  Returns
+   after the disk has acknowledged receiving all the data.
+   Internally synchronizes accesses to disks, so external
+   per-disk locking is unneeded. */
+static void
+ide_write_multiple (void *d_, block_sector_t sec_no, size_t cnt,
+                    const void *buffers[])
+{
+  struct ata_disk *d = d_;
+  struct channel *c = d->channel;
+
+  lock_acquire (&c->lock);
+  while (cnt > 0)
+    {
+      size_t n = dma_transfer (d, sec_no, cnt, buffers, true);
+      if (n == 0)
+        n = pio_transfer (d, sec_no, cnt, buffers, true);
+      sec_no += n;
+      buffers += n;
+      cnt -= n;
+    }
+  lock_release (&c->lock);
+}
+
+/* Moves sectors starting at SEC_NO between disk D and BUFFERS by
+   PIO: reads into them, or writes from them if WRITE is true.
+   Moves CNT sectors, or MAX_SECTORS_PER_COMMAND if that is fewer,
+   and returns the number moved.  D's channel lock must be
+   held.  (Reads store into BUFFERS despite the `const'.) */
+static size_t
+pio_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              const void *buffers[], bool write)
+{
+  struct channel *c = d->channel;
+  size_t n = cnt < MAX_SECTORS_PER_COMMAND ? cnt : MAX_SECTORS_PER_COMMAND;
+  size_t i = 0;
+
+  select_sectors (d, sec_no, n);
+  if (write)
+    issue_pio_command (c, d->multiple > 0 ? CMD_WRITE_MULTIPLE
+                                          : CMD_WRITE_SECTOR_RETRY);
+  else
+    issue_pio_command (c, d->multiple > 0 ? CMD_READ_MULTIPLE
+                                          : CMD_READ_SECTOR_RETRY);
+  while (i < n)
+    {
+      size_t block = sectors_per_drq (d, n, i);
+
+      if (write)
+        {
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk write failed, sector=%"PRDSNu,
+                   d->name, sec_no + i);
+          while (block-- > 0)
+            output_sector (c, buffers[i++]);
+          sema_down (&c->completion_wait);
+        }
+      else
+        {
+          sema_down (&c->completion_wait);
+          if (!wait_while_busy (d))
+            PANIC ("%s: disk read failed, sector=%"PRDSNu,
+                   d->name, sec_no + i);
+          while (block-- > 0)
+            input_sector (c, (void *) buffers[i++]);
+        }
+    }
+  return n;
+}
+
+/* Returns true if the controller can transfer directly to and
+   from each of the CNT sectors in BUFFERS: they must be in
+   kernel memory, which is mapped one-to-one onto physical
+   memory, at even addresses. */
+static bool
+dma_addressable (const void *buffers[], size_t cnt)
+{
+  size_t i;
+
+  for (i = 0; i < cnt; i++)
+    if (!is_kernel_vaddr (buffers[i]) || (uintptr_t) buffers[i] % 2 != 0)
+      return false;
+  return true;
+}
+
+/* Appends the SIZE bytes at kernel address BUFFER to the PRD
+   table of channel C, which has *PRD_CNT entries, extending the
+   last entry if BUFFER follows on from it. */
+static void
+prd_add (struct channel *c, size_t *prd_cnt, const void *buffer, size_t size)
+{
+  uint32_t addr = vtop (buffer);
+
+  while (size > 0)
+    {
+      /* Bytes up to the next 64 kB boundary. */
+      size_t chunk = 0x10000 - (addr & 0xffff);
+      struct prd *last = *prd_cnt > 0 ? &c->prdt[*prd_cnt - 1] : NULL;
+
+      if (chunk > size)
+        chunk = size;
+      if (last != NULL && last->size != 0
+          && last->addr + last->size == addr && (addr & 0xffff) != 0)
+        last->size += chunk;
+      else
+        {
+          ASSERT (*prd_cnt < PGSIZE / sizeof *c->prdt);
+          last = &c->prdt[(*prd_cnt)++];
+          last->addr = addr;
+          last->size = chunk;
+          last->flags = 0;
+        }
+      addr += chunk;
+      size -= chunk;
+    }
+}
+
+/* Moves sectors starting at SEC_NO between disk D and BUFFERS by
+   bus-master DMA, as pio_transfer() does by PIO.  Buffers the
+   controller cannot address go through the channel's bounce
+   buffer, which limits the transfer to DMA_BOUNCE_SECTORS.
+   Returns the number of sectors moved, or 0 if DMA is not
+   available or failed, in which case the caller should use PIO.
+   D's channel lock must be held. */
+static size_t
+dma_transfer (struct ata_disk *d, block_sector_t sec_no, size_t cnt,
+              const void *buffers[], bool write)
+{
+  struct channel *c = d->channel;
+  size_t n = cnt < MAX_SECTORS_PER_COMMAND ? cnt : MAX_SECTORS_PER_COMMAND;
+  uint8_t direction = write ? 0 : BMC_READ;
+  size_t prd_cnt = 0;
+  uint8_t bm_status, status;
+  bool bounce;
+  size_t i;
+
+  if (!ide_dma || !d->dma)
+    return 0;
+
+  /* Build the PRD table. */
+  bounce = !dma_addressable (buffers, n);
+  if (bounce)
+    {
+      if (n > DMA_BOUNCE_SECTORS)
+        n = DMA_BOUNCE_SECTORS;
+      if (write)
+        for (i = 0; i < n; i++)
+          memcpy (c->bounce + i * BLOCK_SECTOR_SIZE, buffers[i],
+                  BLOCK_SECTOR_SIZE);
+      prd_add (c, &prd_cnt, c->bounce, n * BLOCK_SECTOR_SIZE);
+    }
+  else
+    for (i = 0; i < n; i++)
+      prd_add (c, &prd_cnt, buffers[i], BLOCK_SECTOR_SIZE);
+  c->prdt[prd_cnt - 1].flags = PRD_EOT;
+
+  /* Program the bus master, issue the command, start the
+     transfer, and wait for the disk's interrupt at its end. */
+  outl (c->bm_base + BM_PRDT, vtop (c->prdt));
+  outb (c->bm_base + BM_COMMAND, direction);
+  outb (c->bm_base + BM_STATUS, BMS_ERROR | BMS_INTR);
+  select_sectors (d, sec_no, n);
+  issue_pio_command (c, write ? CMD_WRITE_DMA : CMD_READ_DMA);
+  outb (c->bm_base + BM_COMMAND, direction | BMC_START);
+  sema_down (&c->completion_wait);
+
+  outb (c->bm_base + BM_COMMAND, direction);
+  bm_status = inb (c->bm_base + BM_STATUS);
+  outb (c->bm_base + BM_STATUS, BMS_ERROR | BMS_INTR);
+  status = inb (reg_alt_status (c));
+  if ((bm_status & BMS_ERROR) != 0 || (status & STA_ERR) != 0)
+    {
+      printf ("%s: DMA failed at sector %"PRDSNu", using PIO\n",
+              d->name, sec_no);
+      d->dma = false;
+      return 0;
+    }
+
+  if (bounce && !write)
+    for (i = 0; i < n; i++)
+      memcpy ((void *) buffers[i], c->bounce + i * BLOCK_SECTOR_SIZE,
+              BLOCK_SECTOR_SIZE);
+  return n;
+}
+
 static struct block_operations ide_operations =
   {
     ide_read,
-    ide_write
+    ide_write,
+    ide_read_multiple,
+    ide_write_multiple,
+    NULL,
+    NULL
   };
 
 /* Selects device D, waiting for it to become ready, and then
-   writes SEC_NO to the disk's sector selection registers.  (We
-   use LBA mode.) */
+   writes SEC_NO and CNT to the disk's sector selection and count
+   registers.  (We use LBA mode.) */
 static void
-select_sector (struct ata_disk *d, block_sector_t sec_no)
+select_sectors (struct ata_disk *d, block_sector_t sec_no, size_t cnt)
 {
   struct channel *c = d->channel;
 
-  ASSERT (sec_no < (1UL << 28));
+  ASSERT (cnt > 0 && cnt <= MAX_SECTORS_PER_COMMAND);
+  ASSERT (sec_no + cnt <= (1UL << 28));
   
   select_device_wait (d);
-  outb (reg_nsect (c), 1);
+  outb (reg_nsect (c), cnt % MAX_SECTORS_PER_COMMAND);
   outb (reg_lbal (c), sec_no);
   outb (reg_lbam (c), sec_no >> 8);
   outb (reg_lbah (c), (sec_no >> 16));
@@ -1,6 +1,11 @@
 #ifndef DEVICES_IDE_H
 #define DEVICES_IDE_H
 
+#include <stdbool.h>
+
+/* Use DMA for disks and controllers that support it? */
+extern bool ide_dma;
+
 void ide_init (void);
 
 #endif /* devices/ide.h */
@@ -0,0 +1,253 @@
+#include "devices/lapic.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/palloc.h"
+#include "threads/pte.h"
+#include "threads/vaddr.h"
+
+/* Local Advanced Programmable Interrupt Controller (APIC).
+
+   Every CPU has a local APIC, which delivers its interrupts,
+   sends and receives inter-processor interrupts (IPIs), and has
+   a timer of its own.  The 8259A PICs stay in charge of device
+   interrupts, which reach the bootstrap processor through its
+   local APIC's LINT0 pin in "virtual wire" mode, as the BIOS
+   left it.  We use the local APICs only to start the other
+   processors, to interrupt them, and to give each of them a
+   timer tick.
+
+   Refer to [IA32-v3a] chapter 8 "Multiple-Processor Management"
+   and chapter 10 "Advanced Programmable Interrupt Controller
+   (APIC)". */
+
+/* Register offsets. */
+#define LAPIC_ID          0x020 /* ID. */
+#define LAPIC_TPR         0x080 /* Task priority. */
+#define LAPIC_EOI         0x0b0 /* End of interrupt. */
+#define LAPIC_SVR         0x0f0 /* Spurious interrupt vector. */
+#define LAPIC_ESR         0x280 /* Error status. */
+#define LAPIC_ICR_LO      0x300 /* Interrupt command, low half. */
+#define LAPIC_ICR_HI      0x310 /* Interrupt command, high half. */
+#define LAPIC_LVT_TIMER   0x320 /* Local vector table: timer. */
+#define LAPIC_LVT_LINT0   0x350 /* Local vector table: LINT0 pin. */
+#define LAPIC_LVT_LINT1   0x360 /* Local vector table: LINT1 pin. */
+#define LAPIC_LVT_ERROR   0x370 /* Local vector table: error. */
+#define LAPIC_TIMER_INIT  0x380 /* Timer initial count. */
+#define LAPIC_TIMER_CUR   0x390 /* Timer current count. */
+#define LAPIC_TIMER_DIV   0x3e0 /* Timer divide configuration. */
+
+/* Register bits. */
+#define SVR_ENABLE        0x00000100    /* APIC software enable. */
+#define LVT_MASKED        0x00010000    /* Interrupt masked. */
+#define LVT_PERIODIC      0x00020000    /* Timer: periodic mode. */
+#define ICR_INIT          0x00000500    /* Delivery mode: INIT. */
+#define ICR_STARTUP       0x00000600    /* Delivery mode: start-up. */
+#define ICR_PENDING       0x00001000    /* Delivery status: send pending. */
+#define ICR_ASSERT        0x00004000    /* Level: assert. */
+#define ICR_LEVEL         0x00008000    /* Trigger mode: level. */
+#define TIMER_DIV_16      0x3           /* Timer counts at bus clock / 16. */
+
+/* APIC base model-specific register. */
+#define MSR_APIC_BASE     0x1b
+#define APIC_BASE_ENABLE  0x800         /* APIC global enable. */
+#define APIC_BASE_ADDR    0xfffff000    /* Physical base address. */
+
+/* CPUID leaf 1, EDX: on-chip APIC present. */
+#define CPUID_APIC        0x200
+
+/* Page table bits for memory-mapped I/O: write-through and
+   cache disable. */
+#define PTE_PWT 0x8
+#define PTE_PCD 0x10
+
+/* Local APIC registers, mapped at the same virtual address as
+   their physical address, or null if there is no local APIC. */
+static volatile uint32_t *lapic;
+
+/* Local APIC timer count per timer tick, at TIMER_DIV_16. */
+static uint32_t timer_count;
+
+static inline uint32_t
+lapic_read (int reg)
+{
+  return lapic[reg / 4];
+}
+
+static inline void
+lapic_write (int reg, uint32_t value)
+{
+  lapic[reg / 4] = value;
+
+  /* Read back, to wait for the write to complete. */
+  (void) lapic[LAPIC_ID / 4];
+}
+
+/* Waits for the previous IPI to be sent. */
+static void
+wait_icr (void)
+{
+  while (lapic_read (LAPIC_ICR_LO) & ICR_PENDING)
+    asm volatile ("pause");
+}
+
+/* Detects the bootstrap processor's local APIC and maps its
+   registers into the kernel's page directory.  Returns false if
+   there is no usable local APIC.  Must be called after
+   paging_init(), before any process page directory is made. */
+bool
+lapic_init (void)
+{
+  uint32_t eax, ebx, ecx, edx;
+  uint64_t base_msr;
+  uintptr_t base;
+  uint32_t *pd = init_page_dir, *pt;
+  void *vaddr;
+
+  asm volatile ("cpuid"
+                : "=a" (eax), "=b" (ebx), "=c" (ecx), "=d" (edx)
+                : "a" (1));
+  if (!(edx & CPUID_APIC))
+    return false;
+  asm volatile ("rdmsr" : "=A" (base_msr) : "c" (MSR_APIC_BASE));
+  if (!(base_msr & APIC_BASE_ENABLE))
+    return false;
+  base = base_msr & APIC_BASE_ADDR;
+
+  /* Map the registers, uncached, at the virtual address equal to
+     their physical address, which is far above the end of RAM
+     in the kernel's part of the address space. */
+  vaddr = (void *) base;
+  ASSERT (is_kernel_vaddr (vaddr));
+  if (pd[pd_no (vaddr)] == 0)
+    {
+      pt = palloc_get_page (PAL_ASSERT | PAL_ZERO);
+      pd[pd_no (vaddr)] = pde_create (pt);
+    }
+  else
+    pt = pde_get_pt (pd[pd_no (vaddr)]);
+  pt[pt_no (vaddr)] = base | PTE_PCD | PTE_PWT | PTE_W | PTE_P;
+  asm volatile ("invlpg (%0)" : : "r" (vaddr) : "memory");
+
+  lapic = vaddr;
+  return true;
+}
+
+/* Enables the running CPU's local APIC.  On the bootstrap
+   processor, BSP, the LINT pins are left alone so that PIC
+   interrupts keep coming in; on the others they are masked. */
+void
+lapic_init_cpu (bool bsp)
+{
+  ASSERT (lapic != NULL);
+
+  lapic_write (LAPIC_SVR, SVR_ENABLE | LAPIC_SPURIOUS_VEC);
+  lapic_write (LAPIC_TPR, 0);
+  lapic_write (LAPIC_LVT_TIMER, LVT_MASKED);
+  lapic_write (LAPIC_LVT_ERROR, LVT_MASKED);
+  if (!bsp)
+    {
+      lapic_write (LAPIC_LVT_LINT0, LVT_MASKED);
+      lapic_write (LAPIC_LVT_LINT1, LVT_MASKED);
+    }
+
+  /* Clear error status, which takes back-to-back writes. */
+  lapic_write (LAPIC_ESR, 0);
+  lapic_write (LAPIC_ESR, 0);
+  lapic_eoi ();
+}
+
+/* Returns the running CPU's local APIC ID. */
+uint8_t
+lapic_id (void)
+{
+  return lapic_read (LAPIC_ID) >> 24;
+}
+
+/* Acknowledges the interrupt being handled, so that the local
+   APIC can deliver the next one.  Not for spurious
+   interrupts. */
+void
+lapic_eoi (void)
+{
+  lapic_write (LAPIC_EOI, 0);
+}
+
+/* Sends interrupt VEC to the CPU with local APIC ID APIC_ID. */
+void
+lapic_send_ipi (uint8_t apic_id, uint8_t vec)
+{
+  wait_icr ();
+  lapic_write (LAPIC_ICR_HI, (uint32_t) apic_id << 24);
+  lapic_write (LAPIC_ICR_LO, vec);
+}
+
+/* Starts the processor with local APIC ID APIC_ID with the
+   INIT, start-up, start-up IPI sequence of [IA32-v3a] 8.4.4.1.
+   It begins executing in real mode at START_PADDR, which must be
+   page-aligned and below 1 MB.  Returns without waiting for the
+   processor to run. */
+bool
+lapic_start_ap (uint8_t apic_id, uintptr_t start_paddr)
+{
+  int i;
+
+  ASSERT (start_paddr % PGSIZE == 0 && start_paddr < 0x100000);
+
+  /* INIT, asserted then deasserted. */
+  wait_icr ();
+  lapic_write (LAPIC_ICR_HI, (uint32_t) apic_id << 24);
+  lapic_write (LAPIC_ICR_LO, ICR_INIT | ICR_LEVEL | ICR_ASSERT);
+  wait_icr ();
+  lapic_write (LAPIC_ICR_HI, (uint32_t) apic_id << 24);
+  lapic_write (LAPIC_ICR_LO, ICR_INIT | ICR_LEVEL);
+  wait_icr ();
+  timer_mdelay (10);
+
+  /* Two start-up IPIs, as the specification asks. */
+  for (i = 0; i < 2; i++)
+    {
+      lapic_write (LAPIC_ICR_HI, (uint32_t) apic_id << 24);
+      lapic_write (LAPIC_ICR_LO, ICR_STARTUP | (start_paddr >> 12));
+      timer_udelay (200);
+      wait_icr ();
+    }
+  return (lapic_read (LAPIC_ESR) & 0xef) == 0;
+}
+
+/* Measures the local APIC timer's rate against timer_nanos().
+   All local APIC timers run off the same bus clock, so one
+   measurement on the bootstrap processor serves every CPU.
+   Must follow timer_calibrate(). */
+void
+lapic_timer_calibrate (void)
+{
+  int64_t start, elapsed;
+  uint32_t counted;
+
+  lapic_write (LAPIC_TIMER_DIV, TIMER_DIV_16);
+  lapic_write (LAPIC_LVT_TIMER, LVT_MASKED);
+  start = timer_nanos ();
+  lapic_write (LAPIC_TIMER_INIT, 0xffffffff);
+  timer_mdelay (1000 / TIMER_FREQ);
+  counted = 0xffffffff - lapic_read (LAPIC_TIMER_CUR);
+  elapsed = timer_nanos () - start;
+  lapic_write (LAPIC_TIMER_INIT, 0);
+
+  timer_count = (uint64_t) counted * (1000000000 / TIMER_FREQ) / elapsed;
+  printf ("Local APIC timer: %'"PRIu32" counts/tick.\n", timer_count);
+}
+
+/* Starts the running CPU's local APIC timer, interrupting on
+   LAPIC_TIMER_VEC TIMER_FREQ times per second. */
+void
+lapic_timer_start (void)
+{
+  ASSERT (timer_count > 0);
+
+  lapic_write (LAPIC_TIMER_DIV, TIMER_DIV_16);
+  lapic_write (LAPIC_LVT_TIMER, LVT_PERIODIC | LAPIC_TIMER_VEC);
+  lapic_write (LAPIC_TIMER_INIT, timer_count);
+}
@@ -0,0 +1,22 @@
+#ifndef DEVICES_LAPIC_H
+#define DEVICES_LAPIC_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Interrupt vectors used by the local APIC, above all of the
+   PIC's and the system call's. */
+#define LAPIC_TIMER_VEC 0xf0    /* Per-CPU timer tick. */
+#define LAPIC_RESCHED_VEC 0xf1  /* Reschedule inter-processor interrupt. */
+#define LAPIC_SPURIOUS_VEC 0xff /* Spurious interrupt. */
+
+bool lapic_init (void);
+void lapic_init_cpu (bool bsp);
+uint8_t lapic_id (void);
+void lapic_eoi (void);
+void lapic_send_ipi (uint8_t apic_id, uint8_t vec);
+bool lapic_start_ap (uint8_t apic_id, uintptr_t start_paddr);
+void lapic_timer_calibrate (void);
+void lapic_timer_start (void);
+
+#endif /* devices/lapic.h */
@@ -0,0 +1,169 @@
+#include "devices/pci.h"
+#include <debug.h>
+#include "threads/io.h"
+
+/* PCI configuration space access through "configuration
+   mechanism #1": the address of a 32-bit configuration register
+   is written to CONFIG_ADDRESS, and the register is then read or
+   written through CONFIG_DATA.  See [PCI] section 3.2.2.3.2.
+
+   We only look for devices, read their registers, and turn on
+   bus mastering.  Resources are used as the BIOS assigned
+   them. */
+
+/* I/O ports. */
+#define CONFIG_ADDRESS 0xcf8
+#define CONFIG_DATA 0xcfc
+
+/* CONFIG_ADDRESS bits. */
+#define CONFIG_ENABLE 0x80000000
+
+/* Base address register bits. */
+#define BAR_IO 0x1              /* Set for I/O space, clear for memory. */
+#define BAR_IO_MASK 0xfffc      /* I/O base address. */
+
+/* Header type bits. */
+#define HEADER_MULTIFUNCTION 0x80
+
+static bool probe (uint8_t bus, uint8_t dev, uint8_t func,
+                   struct pci_device *);
+
+/* Calls SCAN for each device function on the PCI bus, in bus,
+   device, and function order, passing AUX along, until SCAN
+   returns false. */
+void
+pci_scan (pci_scan_func *scan, void *aux)
+{
+  struct pci_device pci;
+  int bus, dev, func;
+
+  for (bus = 0; bus < 256; bus++)
+    for (dev = 0; dev < 32; dev++)
+      for (func = 0; func < 8; func++)
+        {
+          if (!probe (bus, dev, func, &pci))
+            {
+              /* With no function 0 there are no others. */
+              if (func == 0)
+                break;
+              continue;
+            }
+          if (!scan (&pci, aux))
+            return;
+          if (func == 0
+              && !((pci_read_config (&pci, PCI_REG_HEADER) >> 16)
+                   & HEADER_MULTIFUNCTION))
+            break;
+        }
+}
+
+/* Search state for pci_find_class(). */
+struct find_class
+  {
+    uint8_t class, subclass;            /* What to look for. */
+    struct pci_device *pci;             /* Receives the device found. */
+    bool found;                         /* Found yet? */
+  };
+
+/* pci_scan_func for pci_find_class(). */
+static bool
+find_class (const struct pci_device *pci, void *fc_)
+{
+  struct find_class *fc = fc_;
+
+  if (pci->class != fc->class || pci->subclass != fc->subclass)
+    return true;
+  *fc->pci = *pci;
+  fc->found = true;
+  return false;
+}
+
+/* Searches the PCI bus for the first device function of the
+   given CLASS and SUBCLASS.  If one is found, stores it in *PCI
+   and returns true; otherwise, returns false. */
+bool
+pci_find_class (uint8_t class, uint8_t subclass, struct pci_device *pci)
+{
+  struct find_class fc;
+
+  fc.class = class;
+  fc.subclass = subclass;
+  fc.pci = pci;
+  fc.found = false;
+  pci_scan (find_class, &fc);
+  return fc.found;
+}
+
+/* Returns the 32-bit configuration register at byte offset REG,
+   which must be a multiple of 4, of device PCI. */
+uint32_t
+pci_read_config (const struct pci_device *pci, uint8_t reg)
+{
+  ASSERT (reg % 4 == 0);
+
+  outl (CONFIG_ADDRESS, (CONFIG_ENABLE | (pci->bus << 16) | (pci->dev << 11)
+                         | (pci->func << 8) | reg));
+  return inl (CONFIG_DATA);
+}
+
+/* Writes VALUE to the 32-bit configuration register at byte
+   offset REG, which must be a multiple of 4, of device PCI. */
+void
+pci_write_config (const struct pci_device *pci, uint8_t reg, uint32_t value)
+{
+  ASSERT (reg % 4 == 0);
+
+  outl (CONFIG_ADDRESS, (CONFIG_ENABLE | (pci->bus << 16) | (pci->dev << 11)
+                         | (pci->func << 8) | reg));
+  outl (CONFIG_DATA, value);
+}
+
+/* Returns the I/O port base that base address register BAR
+   (0...5) of device PCI decodes, or 0 if BAR is unassigned or
+   maps memory rather than I/O ports. */
+uint16_t
+pci_io_base (const struct pci_device *pci, int bar)
+{
+  uint32_t value;
+
+  ASSERT (bar >= 0 && bar < 6);
+
+  value = pci_read_config (pci, PCI_REG_BAR0 + bar * 4);
+  return value & BAR_IO ? value & BAR_IO_MASK : 0;
+}
+
+/* Lets device PCI respond to I/O port accesses and act as a bus
+   master, for DMA. */
+void
+pci_enable_master (const struct pci_device *pci)
+{
+  uint32_t command = pci_read_config (pci, PCI_REG_COMMAND);
+
+  /* Keep the upper half zero: its status bits clear when 1s are
+     written to them. */
+  command = (command & 0xffff) | PCI_COMMAND_IO | PCI_COMMAND_MASTER;
+  pci_write_config (pci, PCI_REG_COMMAND, command);
+}
+
+/* Reads the identity of device function FUNC of device DEV on
+   BUS into *PCI.  Returns false if there is no such function. */
+static bool
+probe (uint8_t bus, uint8_t dev, uint8_t func, struct pci_device *pci)
+{
+  uint32_t id, class;
+
+  pci->bus = bus;
+  pci->dev = dev;
+  pci->func = func;
+  id = pci_read_config (pci, PCI_REG_ID);
+  if ((id & 0xffff) == 0xffff)
+    return false;
+
+  class = pci_read_config (pci, PCI_REG_CLASS);
+  pci->vendor_id = id & 0xffff;
+  pci->device_id = id >> 16;
+  pci->class = class >> 24;
+  pci->subclass = class >> 16;
+  pci->prog_if = class >> 8;
+  return true;
+}
@@ -0,0 +1,50 @@
+#ifndef DEVICES_PCI_H
+#define DEVICES_PCI_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+/* Configuration space registers, as byte offsets. */
+#define PCI_REG_ID 0x00         /* Device ID (31:16), vendor ID (15:0). */
+#define PCI_REG_COMMAND 0x04    /* Status (31:16), command (15:0). */
+#define PCI_REG_CLASS 0x08      /* Class, subclass, prog. if, revision. */
+#define PCI_REG_HEADER 0x0c     /* Header type in bits 23:16. */
+#define PCI_REG_BAR0 0x10       /* Base address registers 0...5. */
+#define PCI_REG_IRQ 0x3c        /* Interrupt line in bits 7:0. */
+
+/* Command register bits. */
+#define PCI_COMMAND_IO 0x0001           /* Respond to I/O space. */
+#define PCI_COMMAND_MEMORY 0x0002       /* Respond to memory space. */
+#define PCI_COMMAND_MASTER 0x0004       /* May act as bus master. */
+
+/* Device classes. */
+#define PCI_CLASS_STORAGE 0x01          /* Mass storage controller. */
+#define PCI_SUBCLASS_IDE 0x01           /* IDE controller. */
+
+/* Vendors. */
+#define PCI_VENDOR_VIRTIO 0x1af4        /* Red Hat, for virtio devices. */
+
+/* A device function found on the PCI bus. */
+struct pci_device
+  {
+    uint8_t bus, dev, func;     /* Location. */
+    uint16_t vendor_id;         /* Vendor ID. */
+    uint16_t device_id;         /* Device ID. */
+    uint8_t class;              /* Class code. */
+    uint8_t subclass;           /* Subclass code. */
+    uint8_t prog_if;            /* Programming interface. */
+  };
+
+/* Called by pci_scan() for each device function found, with
+   the AUX passed to pci_scan().  Returns false to stop the scan. */
+typedef bool pci_scan_func (const struct pci_device *, void *aux);
+
+void pci_scan (pci_scan_func *, void *aux);
+bool pci_find_class (uint8_t class, uint8_t subclass, struct pci_device *);
+
+uint32_t pci_read_config (const struct pci_device *, uint8_t reg);
+void pci_write_config (const struct pci_device *, uint8_t reg, uint32_t);
+uint16_t pci_io_base (const struct pci_device *, int bar);
+void pci_enable_master (const struct pci_device *);
+
+#endif /* devices/pci.h */
@@ -1,10 +1,12 @@
 #include "devices/timer.h"
 #include <debug.h>
 #include <inttypes.h>
+#include <list.h>
 #include <round.h>
 #include <stdio.h>
 #include "devices/pit.h"
 #include "threads/interrupt.h"
+#include "threads/profile.h"
 #include "threads/synch.h"
 #include "threads/thread.h"
   
@@ -17,62 +19,126 @@
 #error TIMER_FREQ <= 1000 recommended
 #endif
 
-/* Number of timer ticks since OS booted. */
-static int64_t ticks;
+/* Number of timer ticks measured by timer_calibrate(). */
+#define CALIBRATE_TICKS 8
+
+/* Shortest one-shot countdown we program into the PIT, in PIT
+   cycles (about 4 us).  Shorter counts would expire before the
+   interrupt handler has even returned. */
+#define ONESHOT_MIN_COUNT 5
 
-/* Number of loops per timer tick.
-   Initialized by timer_calibrate(). */
-static unsigned loops_per_tick;
+/* Number of timer ticks since OS booted.  Read through
+   ticks_seq, so that timer_ticks() need not turn interrupts
+   off. */
+static int64_t ticks;
+static struct seqlock ticks_seq;
+
+/* Time stamp counter (TSC) state.  The TSC counts CPU cycles
+   at a constant rate; timer_calibrate() measures that rate
+   against the PIT, after which it serves as the kernel's
+   high-resolution clock. */
+static uint64_t tsc_base;       /* TSC value at timer_init(). */
+static uint64_t tsc_hz;         /* TSC cycles per second, 0 if unknown. */
+static uint64_t tsc_per_tick;   /* TSC cycles per timer tick. */
+static uint64_t last_tick_tsc;  /* TSC value at the latest periodic tick. */
+
+/* Once calibrated, channel 0 runs in one-shot mode: each
+   interrupt reprograms it for the earlier of the next periodic
+   tick and the earliest sub-tick sleeper's deadline. */
+static bool oneshot;
+static uint64_t next_tick_tsc;  /* TSC value at which the next tick is due. */
+
+/* A thread in a sub-tick sleep.  Lives on the sleeping thread's
+   stack, in hr_sleepers, ordered by DEADLINE. */
+struct hr_sleeper
+  {
+    struct list_elem elem;      /* Element in hr_sleepers. */
+    uint64_t deadline;          /* TSC value to wake up at. */
+    struct semaphore sema;      /* Upped once DEADLINE passes. */
+  };
+static struct list hr_sleepers;
 
 static intr_handler_func timer_interrupt;
-static bool too_many_loops (unsigned loops);
-static void busy_wait (int64_t loops);
+static void program_next_event (uint64_t now);
+static void wake_hr_sleepers (uint64_t now);
+static void hr_sleep (int64_t num, int32_t denom);
 static void real_time_sleep (int64_t num, int32_t denom);
 static void real_time_delay (int64_t num, int32_t denom);
 
+/* Reads the CPU's time stamp counter.
+   See [IA32-v2b] "RDTSC". */
+static inline uint64_t
+rdtsc (void)
+{
+  uint64_t tsc;
+  asm volatile ("rdtsc" : "=A" (tsc));
+  return tsc;
+}
+
 /* Sets up the timer to interrupt TIMER_FREQ times per second,
    and registers the corresponding interrupt. */
 void
 timer_init (void) 
 {
+  list_init (&hr_sleepers);
+  seqlock_init (&ticks_seq);
+  tsc_base = rdtsc ();
   pit_configure_channel (0, 2, TIMER_FREQ);
   intr_register_ext (0x20, timer_interrupt, "8254 Timer");
 }
 
-/* Calibrates loops_per_tick, used to implement brief delays. */
+/* Measures the TSC frequency against the periodic PIT tick,
+   then switches the timer to one-shot mode so that sub-tick
+   sleeps need not spin. */
 void
 timer_calibrate (void) 
 {
-  unsigned high_bit, test_bit;
+  enum intr_level old_level;
+  uint64_t start_tsc;
+  int64_t start;
 
   ASSERT (intr_get_level () == INTR_ON);
   printf ("Calibrating timer...  ");
 
-  /* Approximate loops_per_tick as the largest power-of-two
-     still less than one timer tick. */
-  loops_per_tick = 1u << 10;
-  while (!too_many_loops (loops_per_tick << 1)) 
-    {
-      loops_per_tick <<= 1;
-      ASSERT (loops_per_tick != 0);
-    }
+  /* Wait for a timer tick, then count TSC cycles across
+     CALIBRATE_TICKS more of them. */
+  start = ticks;
+  while (ticks == start)
+    barrier ();
+  old_level = intr_disable ();
+  start_tsc = last_tick_tsc;
+  start = ticks;
+  intr_set_level (old_level);
+  while (ticks - start < CALIBRATE_TICKS)
+    barrier ();
 
-  /* Refine the next 8 bits of loops_per_tick. */
-  high_bit = loops_per_tick;
-  for (test_bit = high_bit >> 1; test_bit != high_bit >> 10; test_bit >>= 1)
-    if (!too_many_loops (high_bit | test_bit))
-      loops_per_tick |= test_bit;
+  old_level = intr_disable ();
+  tsc_per_tick = (last_tick_tsc - start_tsc) / (ticks - start);
+  tsc_hz = tsc_per_tick * TIMER_FREQ;
 
-  printf ("%'"PRIu64" loops/s.\n", (uint64_t) loops_per_tick * TIMER_FREQ);
+  /* Hand channel 0 over to one-shot mode, keeping the phase of
+     the periodic tick. */
+  next_tick_tsc = last_tick_tsc + tsc_per_tick;
+  oneshot = true;
+  program_next_event (rdtsc ());
+  intr_set_level (old_level);
+
+  printf ("%'"PRIu64" TSC cycles/s.\n", tsc_hz);
 }
 
 /* Returns the number of timer ticks since the OS booted. */
 int64_t
 timer_ticks (void) 
 {
-  enum intr_level old_level = intr_disable ();
-  int64_t t = ticks;
-  intr_set_level (old_level);
+  unsigned seq;
+  int64_t t;
+
+  do
+    {
+      seq = seqlock_read_begin (&ticks_seq);
+      t = ticks;
+    }
+  while (seqlock_read_retry (&ticks_seq, seq));
   return t;
 }
 
@@ -84,6 +150,26 @@ timer_elapsed (int64_t then)
   return timer_ticks () - then;
 }
 
+/* Returns the number of nanoseconds since timer_init(), from a
+   monotonic clock with sub-microsecond resolution.  Before
+   timer_calibrate() has run, the result only has tick
+   granularity.
+
+   Meant for latency instrumentation: take a timestamp before
+   and after an event and subtract. */
+int64_t
+timer_nanos (void) 
+{
+  uint64_t cycles;
+
+  if (tsc_hz == 0)
+    return timer_ticks () * (1000 * 1000 * 1000 / TIMER_FREQ);
+
+  cycles = rdtsc () - tsc_base;
+  return (cycles / tsc_hz) * 1000000000
+         + (cycles % tsc_hz) * 1000000000 / tsc_hz;
+}
+
 /* Sleeps for approximately TICKS timer ticks.  Interrupts must
    be turned on. */
 void
@@ -170,9 +256,40 @@ timer_print_stats (void)
 
 /* Timer interrupt handler. */
 static void
-timer_interrupt (struct intr_frame *args UNUSED)
+timer_interrupt (struct intr_frame *args)
 {
-  ticks++;
+  if (oneshot)
+    {
+      uint64_t now = rdtsc ();
+
+      wake_hr_sleepers (now);
+      if (now < next_tick_tsc)
+        {
+          /* Early event, only for a sub-tick sleeper. */
+          program_next_event (now);
+          return;
+        }
+
+      /* Account for every tick period that has passed, even if
+         interrupts were off for longer than one of them. */
+      seqlock_write_begin (&ticks_seq);
+      do
+        {
+          ticks++;
+          next_tick_tsc += tsc_per_tick;
+        }
+      while (next_tick_tsc <= now);
+      seqlock_write_end (&ticks_seq);
+      program_next_event (now);
+    }
+  else
+    {
+      seqlock_write_begin (&ticks_seq);
+      ticks++;
+      seqlock_write_end (&ticks_seq);
+      last_tick_tsc = rdtsc ();
+    }
+  profile_sample (args);
   thread_tick ();
 
   if (get_next_tick_to_wakeup() <= ticks) {
@@ -180,37 +297,83 @@ timer_interrupt (struct intr_frame *args UNUSED)
   }
 }
 
-/* Returns true if LOOPS iterations waits for more than one timer
-   tick, otherwise false. */
-static bool
-too_many_loops (unsigned loops) 
+/* Programs a one-shot PIT countdown that expires at the next
+   periodic tick or at the earliest sub-tick sleeper's deadline,
+   whichever comes first.  NOW is the current TSC value. */
+static void
+program_next_event (uint64_t now)
 {
-  /* Wait for a timer tick. */
-  int64_t start = ticks;
-  while (ticks == start)
-    barrier ();
+  uint64_t deadline = next_tick_tsc;
+  uint64_t count;
 
-  /* Run LOOPS loops. */
-  start = ticks;
-  busy_wait (loops);
+  ASSERT (intr_get_level () == INTR_OFF);
 
-  /* If the tick count changed, we iterated too long. */
-  barrier ();
-  return start != ticks;
+  if (!list_empty (&hr_sleepers))
+    {
+      struct hr_sleeper *s = list_entry (list_front (&hr_sleepers),
+                                         struct hr_sleeper, elem);
+      if (s->deadline < deadline)
+        deadline = s->deadline;
+    }
+
+  count = 0;
+  if (deadline > now)
+    count = DIV_ROUND_UP ((deadline - now) * PIT_HZ, tsc_hz);
+  if (count < ONESHOT_MIN_COUNT)
+    count = ONESHOT_MIN_COUNT;
+  if (count > UINT16_MAX)
+    count = UINT16_MAX;
+  pit_start_oneshot (0, count);
 }
 
-/* Iterates through a simple loop LOOPS times, for implementing
-   brief delays.
+/* Wakes every sub-tick sleeper whose deadline is not after
+   NOW. */
+static void
+wake_hr_sleepers (uint64_t now)
+{
+  while (!list_empty (&hr_sleepers))
+    {
+      struct hr_sleeper *s = list_entry (list_front (&hr_sleepers),
+                                         struct hr_sleeper, elem);
+      if (s->deadline > now)
+        break;
+      list_pop_front (&hr_sleepers);
+      sema_up (&s->sema);
+    }
+}
 
-   Marked NO_INLINE because code alignment can significantly
-   affect timings, so that if this function was inlined
-   differently in different places the results would be difficult
-   to predict. */
-static void NO_INLINE
-busy_wait (int64_t loops) 
+/* Returns true if sub-tick sleeper A's deadline precedes B's. */
+static bool
+hr_sleeper_less (const struct list_elem *a_, const struct list_elem *b_,
+                 void *aux UNUSED)
 {
-  while (loops-- > 0)
-    barrier ();
+  const struct hr_sleeper *a = list_entry (a_, struct hr_sleeper, elem);
+  const struct hr_sleeper *b = list_entry (b_, struct hr_sleeper, elem);
+
+  return a->deadline < b->deadline;
+}
+
+/* Blocks the current thread for NUM/DENOM seconds, which should
+   be less than a timer tick, by arming a one-shot timer
+   interrupt for its deadline. */
+static void
+hr_sleep (int64_t num, int32_t denom)
+{
+  struct hr_sleeper s;
+  enum intr_level old_level;
+  uint64_t now;
+
+  sema_init (&s.sema, 0);
+
+  old_level = intr_disable ();
+  now = rdtsc ();
+  s.deadline = now + num * tsc_hz / denom;
+  list_insert_ordered (&hr_sleepers, &s.elem, hr_sleeper_less, NULL);
+  if (list_front (&hr_sleepers) == &s.elem)
+    program_next_event (now);
+  intr_set_level (old_level);
+
+  sema_down (&s.sema);
 }
 
 /* Sleep for approximately NUM/DENOM seconds. */
@@ -233,10 +396,17 @@ real_time_sleep (int64_t num, int32_t denom)
          processes. */                
       timer_sleep (ticks); 
     }
+  else if (oneshot)
+    {
+      /* Otherwise, block until a one-shot timer interrupt
+         fires at the sub-tick deadline. */
+      if (num > 0)
+        hr_sleep (num, denom);
+    }
   else 
     {
-      /* Otherwise, use a busy-wait loop for more accurate
-         sub-tick timing. */
+      /* The timer is not calibrated yet, so all we can do is
+         spin. */
       real_time_delay (num, denom); 
     }
 }
@@ -245,8 +415,12 @@ real_time_sleep (int64_t num, int32_t denom)
 static void
 real_time_delay (int64_t num, int32_t denom)
 {
+  uint64_t start;
+
   /* Scale the numerator and denominator down by 1000 to avoid
      the possibility of overflow. */
   ASSERT (denom % 1000 == 0);
-  busy_wait (loops_per_tick * num / 1000 * TIMER_FREQ / (denom / 1000)); 
-}
\ No newline at end of file
+  start = rdtsc ();
+  while (rdtsc () - start < tsc_hz / 1000 * num / (denom / 1000))
+    barrier ();
+}
@@ -0,0 +1,443 @@
+#include "devices/virtio-blk.h"
+#include <debug.h>
+#include <round.h>
+#include <stdio.h>
+#include "devices/block.h"
+#include "devices/partition.h"
+#include "devices/pci.h"
+#include "threads/interrupt.h"
+#include "threads/io.h"
+#include "threads/malloc.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
+
+/* Driver for virtio block devices on the PCI bus, through the
+   legacy register interface, as QEMU provides with "-device
+   virtio-blk-pci,disable-modern=on".  See [Virtio] sections 2.4
+   "Virtqueues", 4.1.5 "Legacy Interfaces", and 5.2 "Block
+   Device".
+
+   A virtio device needs no port I/O per sector, just one write
+   to start each request, so it is much faster under emulation
+   than IDE.  Each device has one virtqueue, a table of
+   descriptors shared with the host.  A request is a chain of
+   descriptors: a header naming the operation and sector, the
+   data, and a status byte for the device to fill in.  Many
+   requests may be outstanding at once.  The device interrupts as
+   it finishes them, in any order, and the interrupt handler
+   reports each to the block layer. */
+
+/* PCI device ID of a legacy or transitional block device. */
+#define VIRTIO_BLK_DEVICE_ID 0x1001
+
+/* Legacy registers, as offsets from the I/O base in BAR 0. */
+#define REG_DEVICE_FEATURES 0x00        /* Device features (32 bits). */
+#define REG_GUEST_FEATURES 0x04         /* Driver features (32 bits). */
+#define REG_QUEUE_PFN 0x08              /* Queue page number (32 bits). */
+#define REG_QUEUE_SIZE 0x0c             /* Queue size (16 bits, r/o). */
+#define REG_QUEUE_SELECT 0x0e           /* Queue selector (16 bits). */
+#define REG_QUEUE_NOTIFY 0x10           /* Queue notifier (16 bits). */
+#define REG_STATUS 0x12                 /* Device status (8 bits). */
+#define REG_ISR 0x13                    /* Interrupt status (8 bits, r/o),
+                                           acknowledged by reading. */
+#define REG_CAPACITY 0x14               /* Sectors (64 bits, r/o). */
+
+/* Device status bits. */
+#define STATUS_ACKNOWLEDGE 0x01         /* Guest has noticed the device. */
+#define STATUS_DRIVER 0x02              /* Guest has a driver for it. */
+#define STATUS_DRIVER_OK 0x04           /* Driver is ready. */
+#define STATUS_FAILED 0x80              /* Driver gave up on it. */
+
+/* Feature bits. */
+#define FEATURE_RO 0x20                 /* Device is read-only. */
+
+/* Virtqueue descriptor. */
+struct vring_desc
+  {
+    uint64_t addr;                      /* Physical address of buffer. */
+    uint32_t len;                       /* Buffer length in bytes. */
+    uint16_t flags;                     /* DESC_* flags. */
+    uint16_t next;                      /* Next descriptor, if DESC_NEXT. */
+  };
+#define DESC_NEXT 0x1                   /* Chain continues at `next'. */
+#define DESC_WRITE 0x2                  /* Device writes the buffer. */
+
+/* Ring of descriptor chains offered to the device. */
+struct vring_avail
+  {
+    uint16_t flags;                     /* Unused. */
+    uint16_t idx;                       /* Where the next entry goes. */
+    uint16_t ring[];                    /* Heads of chains. */
+  };
+
+/* Ring of descriptor chains the device is done with. */
+struct vring_used_elem
+  {
+    uint32_t id;                        /* Head of chain. */
+    uint32_t len;                       /* Bytes written into chain. */
+  };
+struct vring_used
+  {
+    uint16_t flags;                     /* Unused. */
+    uint16_t idx;                       /* Where the next entry goes. */
+    struct vring_used_elem ring[];
+  };
+
+/* Request header, the first buffer in each chain. */
+struct request_header
+  {
+    uint32_t type;                      /* TYPE_IN or TYPE_OUT. */
+    uint32_t reserved;                  /* Must be zero. */
+    uint64_t sector;                    /* First sector. */
+  };
+#define TYPE_IN 0                       /* Read. */
+#define TYPE_OUT 1                      /* Write. */
+#define REQUEST_OK 0                    /* Request status: success. */
+
+/* A request in flight, indexed by its chain's head descriptor. */
+struct chain
+  {
+    struct request_header header;       /* Read by the device. */
+    uint8_t status;                     /* Written by the device. */
+    void *token;                        /* For block_transfer_done(), or
+                                           null if waited for. */
+  };
+
+/* A virtio block device. */
+struct virtio_blk
+  {
+    char name[8];                       /* Name, e.g. "vda". */
+    uint16_t io_base;                   /* Legacy register base. */
+    uint8_t irq;                        /* Interrupt vector. */
+
+    /* Virtqueue, shared with the device. */
+    uint16_t queue_size;                /* Number of descriptors. */
+    struct vring_desc *desc;            /* Descriptor table. */
+    volatile struct vring_avail *avail; /* Chains offered. */
+    volatile struct vring_used *used;   /* Chains finished. */
+    struct chain *chains;               /* `queue_size' requests. */
+
+    /* Protected by disabling interrupts. */
+    uint16_t free_head;                 /* First free descriptor. */
+    uint16_t free_cnt;                  /* Number of free descriptors. */
+    uint16_t used_idx;                  /* Next `used' entry to handle. */
+    bool waiting;                       /* A thread waits on `room'? */
+    struct semaphore room;              /* Up'd when descriptors are freed
+                                           and `waiting'. */
+    struct semaphore part_done;         /* Up'd when a request without a
+                                           token finishes. */
+  };
+
+/* Devices found. */
+#define VIRTIO_BLK_MAX 4
+static struct virtio_blk disks[VIRTIO_BLK_MAX];
+static size_t disk_cnt;
+
+static struct block_operations virtio_blk_operations;
+
+static pci_scan_func found_device;
+static bool init_device (struct virtio_blk *, const struct pci_device *);
+static void interrupt_handler (struct intr_frame *);
+
+/* Finds and initializes virtio block devices. */
+void
+virtio_blk_init (void)
+{
+  pci_scan (found_device, NULL);
+}
+
+/* pci_scan_func that initializes PCI if it is a virtio block
+   device. */
+static bool
+found_device (const struct pci_device *pci, void *aux UNUSED)
+{
+  if (pci->vendor_id != PCI_VENDOR_VIRTIO
+      || pci->device_id != VIRTIO_BLK_DEVICE_ID)
+    return true;
+
+  if (disk_cnt >= VIRTIO_BLK_MAX)
+    printf ("virtio-blk: more than %d devices, ignoring the rest\n",
+            VIRTIO_BLK_MAX);
+  else
+    init_device (&disks[disk_cnt], pci);
+  return disk_cnt < VIRTIO_BLK_MAX;
+}
+
+/* Brings up the virtio block device PCI as D, the next unused
+   entry in `disks', counts it in `disk_cnt', and registers it
+   with the block layer.  Returns false, leaving `disk_cnt'
+   alone, if it cannot be used. */
+static bool
+init_device (struct virtio_blk *d, const struct pci_device *pci)
+{
+  size_t avail_ofs, used_ofs, pages, i;
+  bool shared_irq;
+  uint32_t features;
+  block_sector_t capacity;
+  char extra_info[64];
+  struct block *block;
+  uint8_t *ring;
+
+  snprintf (d->name, sizeof d->name, "vd%c", 'a' + (int) disk_cnt);
+  d->io_base = pci_io_base (pci, 0);
+  if (d->io_base == 0)
+    {
+      printf ("%s: no I/O ports assigned, ignoring\n", d->name);
+      return false;
+    }
+  d->irq = (pci_read_config (pci, PCI_REG_IRQ) & 0xff) + 0x20;
+  pci_enable_master (pci);
+
+  /* Reset the device, say we have a driver for it, and accept
+     only the read-only feature, if offered. */
+  outb (d->io_base + REG_STATUS, 0);
+  outb (d->io_base + REG_STATUS, STATUS_ACKNOWLEDGE);
+  outb (d->io_base + REG_STATUS, STATUS_ACKNOWLEDGE | STATUS_DRIVER);
+  features = inl (d->io_base + REG_DEVICE_FEATURES) & FEATURE_RO;
+  outl (d->io_base + REG_GUEST_FEATURES, features);
+
+  /* Set up queue 0: the descriptor table and available ring,
+     then the used ring starting on a page boundary. */
+  outw (d->io_base + REG_QUEUE_SELECT, 0);
+  d->queue_size = inw (d->io_base + REG_QUEUE_SIZE);
+  avail_ofs = d->queue_size * sizeof *d->desc;
+  used_ofs = ROUND_UP (avail_ofs + sizeof (struct vring_avail)
+                       + (d->queue_size + 1) * sizeof (uint16_t), PGSIZE);
+  pages = DIV_ROUND_UP (used_ofs + sizeof (struct vring_used)
+                        + d->queue_size * sizeof (struct vring_used_elem)
+                        + sizeof (uint16_t), PGSIZE);
+  ring = d->queue_size >= 3 ? palloc_get_multiple (PAL_ZERO, pages) : NULL;
+  d->chains = malloc (d->queue_size * sizeof *d->chains);
+  if (ring == NULL || d->chains == NULL)
+    {
+      printf ("%s: cannot set up a queue of %"PRIu16" descriptors\n",
+              d->name, d->queue_size);
+      outb (d->io_base + REG_STATUS, STATUS_FAILED);
+      if (ring != NULL)
+        palloc_free_multiple (ring, pages);
+      free (d->chains);
+      return false;
+    }
+  d->desc = (struct vring_desc *) ring;
+  d->avail = (struct vring_avail *) (ring + avail_ofs);
+  d->used = (struct vring_used *) (ring + used_ofs);
+
+  /* Chain every descriptor into the free list. */
+  for (i = 0; i < d->queue_size; i++)
+    d->desc[i].next = i + 1;
+  d->free_head = 0;
+  d->free_cnt = d->queue_size;
+  d->used_idx = 0;
+  d->waiting = false;
+  sema_init (&d->room, 0);
+  sema_init (&d->part_done, 0);
+  outl (d->io_base + REG_QUEUE_PFN, vtop (ring) / PGSIZE);
+
+  /* Devices may share an interrupt line, and its handler.  The
+     handler only looks at counted devices, so count this one
+     before it can interrupt: the partition scan below waits for
+     a read. */
+  shared_irq = false;
+  for (i = 0; i < disk_cnt; i++)
+    if (disks[i].irq == d->irq)
+      shared_irq = true;
+  ASSERT (d == &disks[disk_cnt]);
+  disk_cnt++;
+  if (!shared_irq)
+    intr_register_ext (d->irq, interrupt_handler, "virtio-blk");
+
+  outb (d->io_base + REG_STATUS,
+        STATUS_ACKNOWLEDGE | STATUS_DRIVER | STATUS_DRIVER_OK);
+
+  /* Register.  Pintos sector numbers have 32 bits. */
+  capacity = inl (d->io_base + REG_CAPACITY);
+  if (inl (d->io_base + REG_CAPACITY + 4) != 0)
+    capacity = UINT32_MAX;
+  snprintf (extra_info, sizeof extra_info, "virtio, %"PRIu16" descriptors%s",
+            d->queue_size, features & FEATURE_RO ? ", read-only" : "");
+  block = block_register (d->name, BLOCK_RAW, extra_info, capacity,
+                          &virtio_blk_operations, d);
+  partition_scan (block);
+  return true;
+}
+
+/* Offers the device a request to read the CNT sectors starting
+   at SECTOR into BUFFERS, or to write them from BUFFERS if WRITE,
+   in a chain of SEGMENTS data descriptors, one per run of
+   physically contiguous buffers.  Waits for free descriptors if
+   there are not enough, but not for the request to finish. */
+static void
+offer_chain (struct virtio_blk *d, block_sector_t sector, size_t cnt,
+             void *buffers[], size_t segments, bool write, void *token)
+{
+  size_t need = segments + 2;
+  enum intr_level old_level;
+  struct chain *c;
+  uint16_t head, i;
+  size_t s;
+
+  /* Take NEED descriptors off the free list.  They are already
+     linked to each other through `next'. */
+  old_level = intr_disable ();
+  while (d->free_cnt < need)
+    {
+      d->waiting = true;
+      sema_down (&d->room);
+    }
+  head = i = d->free_head;
+  for (s = 0; s < need; s++)
+    {
+      d->free_head = d->desc[i].next;
+      i = d->desc[i].next;
+    }
+  d->free_cnt -= need;
+  intr_set_level (old_level);
+
+  c = &d->chains[head];
+  c->header.type = write ? TYPE_OUT : TYPE_IN;
+  c->header.reserved = 0;
+  c->header.sector = sector;
+  c->status = 0xff;
+  c->token = token;
+
+  /* Header. */
+  i = head;
+  d->desc[i].addr = vtop (&c->header);
+  d->desc[i].len = sizeof c->header;
+  d->desc[i].flags = DESC_NEXT;
+
+  /* Data, one descriptor per contiguous run of buffers. */
+  for (s = 0; s < cnt; s++)
+    {
+      ASSERT (is_kernel_vaddr (buffers[s]));
+      if (s > 0 && vtop (buffers[s]) == vtop (buffers[s - 1]) + BLOCK_SECTOR_SIZE)
+        d->desc[i].len += BLOCK_SECTOR_SIZE;
+      else
+        {
+          i = d->desc[i].next;
+          d->desc[i].addr = vtop (buffers[s]);
+          d->desc[i].len = BLOCK_SECTOR_SIZE;
+          d->desc[i].flags = DESC_NEXT | (write ? 0 : DESC_WRITE);
+        }
+    }
+
+  /* Status. */
+  i = d->desc[i].next;
+  d->desc[i].addr = vtop (&c->status);
+  d->desc[i].len = sizeof c->status;
+  d->desc[i].flags = DESC_WRITE;
+
+  /* Publish the chain, then tell the device. */
+  d->avail->ring[d->avail->idx % d->queue_size] = head;
+  barrier ();
+  d->avail->idx++;
+  barrier ();
+  outw (d->io_base + REG_QUEUE_NOTIFY, 0);
+}
+
+/* Starts reading the CNT sectors starting at SECTOR from device
+   D into BUFFERS, or writing them from BUFFERS if WRITE, and
+   arranges for block_transfer_done(TOKEN) when done.  A transfer
+   with more discontiguous buffers than fit in one chain is split,
+   and each part but the last waited for. */
+static void
+virtio_blk_start (void *d_, block_sector_t sector, size_t cnt,
+                  void *buffers[], bool write, void *token)
+{
+  struct virtio_blk *d = d_;
+  size_t max_segments = d->queue_size - 2;
+
+  while (cnt > 0)
+    {
+      size_t n, segments = 0;
+      bool last;
+
+      for (n = 0; n < cnt; n++)
+        if (n == 0
+            || vtop (buffers[n]) != vtop (buffers[n - 1]) + BLOCK_SECTOR_SIZE)
+          {
+            if (segments == max_segments)
+              break;
+            segments++;
+          }
+      last = n == cnt;
+
+      offer_chain (d, sector, n, buffers, segments, write,
+                   last ? token : NULL);
+      if (!last)
+        sema_down (&d->part_done);
+
+      sector += n;
+      buffers += n;
+      cnt -= n;
+    }
+}
+
+static struct block_operations virtio_blk_operations =
+  {
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    NULL,
+    virtio_blk_start
+  };
+
+/* Returns the chain headed by descriptor HEAD to D's free
+   list.  Interrupts must be off. */
+static void
+free_chain (struct virtio_blk *d, uint16_t head)
+{
+  uint16_t tail = head;
+  uint16_t cnt = 1;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  while (d->desc[tail].flags & DESC_NEXT)
+    {
+      tail = d->desc[tail].next;
+      cnt++;
+    }
+  d->desc[tail].next = d->free_head;
+  d->free_head = head;
+  d->free_cnt += cnt;
+}
+
+/* Virtio block interrupt handler: finishes the requests that
+   each device on the interrupt line is done with. */
+static void
+interrupt_handler (struct intr_frame *f)
+{
+  struct virtio_blk *d;
+
+  for (d = disks; d < disks + disk_cnt; d++)
+    {
+      if (d->irq != f->vec_no)
+        continue;
+
+      inb (d->io_base + REG_ISR);       /* Acknowledge interrupt. */
+      while (d->used_idx != d->used->idx)
+        {
+          uint16_t head = d->used->ring[d->used_idx % d->queue_size].id;
+          struct chain *c = &d->chains[head];
+          void *token = c->token;
+
+          d->used_idx++;
+          if (c->status != REQUEST_OK)
+            PANIC ("%s: %s failed, sector=%"PRIu64", status %d", d->name,
+                   c->header.type == TYPE_OUT ? "write" : "read",
+                   c->header.sector, c->status);
+          free_chain (d, head);
+          if (token != NULL)
+            block_transfer_done (token);
+          else
+            sema_up (&d->part_done);
+        }
+      if (d->waiting)
+        {
+          d->waiting = false;
+          sema_up (&d->room);
+        }
+    }
+}
@@ -0,0 +1,656 @@
+#include "filesys/cache.h"
+#include <debug.h>
+#include <hash.h>
+#include <list.h>
+#include <stdio.h>
+#include <string.h>
+#include "filesys/filesys.h"
+#include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Buffer cache.
+
+   Holds up to CACHE_SIZE sectors of the file system device, so
+   that repeated reads and small writes of the same sector, such
+   as a directory scan reading an entry at a time, need not each
+   go to disk.  Writes are kept in the cache until the sector is
+   evicted or cache_flush() is called, at the latest by
+   filesys_done().
+
+   Entries are found through a hash table keyed by sector number
+   and evicted by the clock algorithm.  `cache_lock' protects the
+   table and which sector each entry holds; each entry's own lock
+   protects its data, so transfers to different sectors go on at
+   once.
+
+   Sectors that a sequential reader will want next can be handed
+   to cache_prefetch(), which queues them for the "readahead"
+   thread to read in while the reader works on what it has.  A
+   sector read ahead gets no second chance from the clock until it
+   has been used.
+
+   Long runs of whole sectors can be moved with
+   cache_read_multiple() and cache_write_multiple(), which send
+   the sectors that are not cached to or from the disk as one
+   multi-sector request each, without pushing out what the cache
+   holds.  A run being written is listed in `write_runs' for the
+   length of the write, without holding cache_lock, and its
+   sectors may not be brought into the cache or sent to the disk
+   by anyone else until it is done. */
+
+#if CACHE_SIZE * BLOCK_SECTOR_SIZE % PGSIZE != 0
+#error CACHE_SIZE sectors must fill whole pages
+#endif
+
+/* A cached sector. */
+struct cache_entry
+  {
+    struct hash_elem hash_elem;         /* Element in `cache_map'. */
+    block_sector_t sector;              /* Sector held, if `valid'. */
+    bool valid;                         /* Holds a sector? */
+    bool accessed;                      /* Used since the clock hand
+                                           last passed? */
+    int users;                          /* # of threads using or waiting
+                                           to use it; never evicted
+                                           while nonzero. */
+
+    /* Protected by `lock'. */
+    struct lock lock;                   /* Protects the following. */
+    bool dirty;                         /* Modified since read? */
+    uint8_t *data;                      /* Sector contents. */
+  };
+
+static struct cache_entry entries[CACHE_SIZE];
+static struct hash cache_map;           /* Valid entries by sector. */
+static struct lock cache_lock;          /* Protects the cache as a whole. */
+static struct condition entry_unused;   /* Some entry's `users' hit 0. */
+static size_t clock_hand;               /* Next entry to consider. */
+
+/* A run of uncached sectors that cache_write_multiple() is
+   writing to disk. */
+struct write_run
+  {
+    struct list_elem elem;              /* Element in `write_runs'. */
+    block_sector_t first;               /* First sector. */
+    size_t cnt;                         /* Number of sectors. */
+  };
+static struct list write_runs;          /* Protected by cache_lock. */
+static struct condition write_run_done; /* Some write run finished. */
+
+/* Sectors waiting to be read ahead, a ring buffer. */
+#define READAHEAD_QUEUE 64
+static block_sector_t ra_queue[READAHEAD_QUEUE];
+static size_t ra_head, ra_cnt;
+static struct lock ra_lock;             /* Protects the queue. */
+static struct condition ra_queued;      /* Signaled when `ra_cnt' rises. */
+
+bool cache_readahead = true;
+
+/* Write-back requests for cache_flush(), one per entry. */
+static struct lock flush_lock;          /* Protects the following. */
+static struct block_request flush_requests[CACHE_SIZE];
+static void *flush_buffers[CACHE_SIZE];
+static struct semaphore flush_written;  /* Up'd as each write finishes. */
+
+/* Statistics. */
+static long long hit_cnt, miss_cnt, writeback_cnt;
+static long long readahead_cnt, readahead_drops;
+
+static struct cache_entry *cache_lookup (block_sector_t);
+static struct cache_entry *cache_get (block_sector_t, bool whole_write);
+static struct cache_entry *cache_claim (block_sector_t, bool accessed);
+static thread_func readahead_thread;
+static void cache_put (struct cache_entry *);
+static block_request_func flush_done;
+static struct cache_entry *cache_evict (block_sector_t);
+static bool being_written (block_sector_t);
+static hash_hash_func entry_hash;
+static hash_less_func entry_less;
+
+/* Initializes the buffer cache. */
+void
+cache_init (void)
+{
+  uint8_t *data;
+  size_t i;
+
+  data = palloc_get_multiple (PAL_ASSERT,
+                              CACHE_SIZE * BLOCK_SECTOR_SIZE / PGSIZE);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &entries[i];
+      e->valid = false;
+      e->accessed = false;
+      e->users = 0;
+      lock_init (&e->lock);
+      e->dirty = false;
+      e->data = data + i * BLOCK_SECTOR_SIZE;
+    }
+  if (!hash_init (&cache_map, entry_hash, entry_less, NULL))
+    PANIC ("buffer cache: out of memory");
+  lock_init_named (&cache_lock, "cache");
+  cond_init (&entry_unused);
+  list_init (&write_runs);
+  cond_init (&write_run_done);
+
+  lock_init (&flush_lock);
+
+  lock_init (&ra_lock);
+  cond_init (&ra_queued);
+  if (thread_create ("readahead", PRI_DEFAULT, readahead_thread, NULL)
+      == TID_ERROR)
+    PANIC ("buffer cache: could not start read-ahead thread");
+}
+
+/* Reads SECTOR into BUFFER, which must have room for
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_read (block_sector_t sector, void *buffer)
+{
+  cache_read_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Reads SIZE bytes starting at offset OFS within SECTOR into
+   BUFFER. */
+void
+cache_read_at (block_sector_t sector, void *buffer, size_t ofs, size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, false);
+  memcpy (buffer, e->data + ofs, size);
+  cache_put (e);
+}
+
+/* Writes SECTOR from BUFFER, which must contain
+   BLOCK_SECTOR_SIZE bytes. */
+void
+cache_write (block_sector_t sector, const void *buffer)
+{
+  cache_write_at (sector, buffer, 0, BLOCK_SECTOR_SIZE);
+}
+
+/* Writes SIZE bytes from BUFFER into SECTOR, starting at offset
+   OFS within it. */
+void
+cache_write_at (block_sector_t sector, const void *buffer,
+                size_t ofs, size_t size)
+{
+  struct cache_entry *e;
+
+  ASSERT (ofs + size <= BLOCK_SECTOR_SIZE);
+
+  e = cache_get (sector, size == BLOCK_SECTOR_SIZE);
+  memcpy (e->data + ofs, buffer, size);
+  e->dirty = true;
+  cache_put (e);
+}
+
+/* Reads the CNT sectors starting at FIRST, the Ith into
+   BUFFERS[I], which must have room for BLOCK_SECTOR_SIZE bytes.
+   Sectors found in the cache are copied out of it.  Each run of
+   sectors that are not is read from disk straight into the
+   buffers with one block_read_multiple(), and is not cached. */
+void
+cache_read_multiple (block_sector_t first, size_t cnt, void *buffers[])
+{
+  size_t i = 0;
+
+  while (i < cnt)
+    {
+      struct cache_entry *e;
+      size_t run;
+
+      lock_acquire (&cache_lock);
+      while (being_written (first + i))
+        cond_wait (&write_run_done, &cache_lock);
+      e = cache_lookup (first + i);
+      if (e != NULL)
+        {
+          e->users++;
+          e->accessed = true;
+          hit_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          memcpy (buffers[i], e->data, BLOCK_SECTOR_SIZE);
+          cache_put (e);
+          i++;
+          continue;
+        }
+
+      /* A sector absent from the cache is up to date on disk:
+         eviction writes it back before dropping it. */
+      for (run = 1; i + run < cnt; run++)
+        if (cache_lookup (first + i + run) != NULL
+            || being_written (first + i + run))
+          break;
+      miss_cnt += run;
+      lock_release (&cache_lock);
+
+      block_read_multiple (fs_device, first + i, run, buffers + i);
+      i += run;
+    }
+}
+
+/* Writes the CNT sectors starting at FIRST, the Ith from
+   BUFFERS[I], which must contain BLOCK_SECTOR_SIZE bytes.
+   Sectors found in the cache are updated there.  Each run of
+   sectors that are not is written to disk from the buffers with
+   one block_write_multiple().  cache_lock is not held during the
+   write, but the run is listed in `write_runs', so that no one
+   caches a sector's old contents or writes it meanwhile. */
+void
+cache_write_multiple (block_sector_t first, size_t cnt,
+                      const void *buffers[])
+{
+  size_t i = 0;
+
+  while (i < cnt)
+    {
+      struct cache_entry *e;
+      struct write_run wr;
+
+      lock_acquire (&cache_lock);
+      while (being_written (first + i))
+        cond_wait (&write_run_done, &cache_lock);
+      e = cache_lookup (first + i);
+      if (e != NULL)
+        {
+          e->users++;
+          e->accessed = true;
+          hit_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          memcpy (e->data, buffers[i], BLOCK_SECTOR_SIZE);
+          e->dirty = true;
+          cache_put (e);
+          i++;
+          continue;
+        }
+
+      wr.first = first + i;
+      for (wr.cnt = 1; i + wr.cnt < cnt; wr.cnt++)
+        if (cache_lookup (first + i + wr.cnt) != NULL
+            || being_written (first + i + wr.cnt))
+          break;
+      miss_cnt += wr.cnt;
+      list_push_back (&write_runs, &wr.elem);
+      lock_release (&cache_lock);
+
+      block_write_multiple (fs_device, wr.first, wr.cnt, buffers + i);
+
+      lock_acquire (&cache_lock);
+      list_remove (&wr.elem);
+      cond_broadcast (&write_run_done, &cache_lock);
+      lock_release (&cache_lock);
+      i += wr.cnt;
+    }
+}
+
+/* Queues SECTOR to be read into the cache in the background, if
+   read-ahead is enabled.  Never waits for the disk; if too many
+   sectors are queued already, SECTOR is dropped. */
+void
+cache_prefetch (block_sector_t sector)
+{
+  size_t i;
+
+  if (!cache_readahead)
+    return;
+
+  lock_acquire (&ra_lock);
+  for (i = 0; i < ra_cnt; i++)
+    if (ra_queue[(ra_head + i) % READAHEAD_QUEUE] == sector)
+      {
+        lock_release (&ra_lock);
+        return;
+      }
+  if (ra_cnt < READAHEAD_QUEUE)
+    {
+      ra_queue[(ra_head + ra_cnt++) % READAHEAD_QUEUE] = sector;
+      cond_signal (&ra_queued, &ra_lock);
+    }
+  else
+    readahead_drops++;
+  lock_release (&ra_lock);
+}
+
+/* Writes every dirty sector in the cache to disk.
+
+   The writes are all submitted to the device's queue while it is
+   plugged, then waited for, so that the elevator can put them in
+   order and merge neighbouring sectors into single requests. */
+void
+cache_flush (void)
+{
+  size_t i, submitted = 0;
+
+  lock_acquire (&flush_lock);
+  sema_init (&flush_written, 0);
+  block_plug (fs_device);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &entries[i];
+
+      lock_acquire (&cache_lock);
+      if (!e->valid)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e->users++;
+      lock_release (&cache_lock);
+
+      /* Keep the lock of a dirty entry until its write is done. */
+      lock_acquire (&e->lock);
+      if (e->dirty)
+        {
+          flush_buffers[i] = e->data;
+          block_request_init (&flush_requests[i], e->sector, 1,
+                              &flush_buffers[i], true,
+                              flush_done, &flush_written);
+          block_submit (fs_device, &flush_requests[i]);
+          submitted++;
+        }
+      else
+        cache_put (e);
+    }
+  block_unplug (fs_device);
+
+  for (; submitted > 0; submitted--)
+    sema_down (&flush_written);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &entries[i];
+
+      if (lock_held_by_current_thread (&e->lock))
+        {
+          e->dirty = false;
+          lock_acquire (&cache_lock);
+          writeback_cnt++;
+          lock_release (&cache_lock);
+          cache_put (e);
+        }
+    }
+  lock_release (&flush_lock);
+}
+
+/* Writes every dirty sector in the cache to disk, then drops
+   every sector not in use from the cache, so that the next access
+   to each goes to disk. */
+void
+cache_invalidate (void)
+{
+  size_t i;
+
+  cache_flush ();
+  lock_acquire (&cache_lock);
+  for (i = 0; i < CACHE_SIZE; i++)
+    {
+      struct cache_entry *e = &entries[i];
+      if (e->valid && e->users == 0 && !e->dirty)
+        {
+          hash_delete (&cache_map, &e->hash_elem);
+          e->valid = false;
+        }
+    }
+  lock_release (&cache_lock);
+}
+
+/* Prints buffer cache statistics. */
+void
+cache_print_stats (void)
+{
+  long long lookups = hit_cnt + miss_cnt;
+  long long permille = lookups > 0 ? hit_cnt * 1000 / lookups : 0;
+
+  printf ("Buffer cache: %lld hits, %lld misses (%lld.%lld%% hit rate), "
+          "%lld write-backs\n", hit_cnt, miss_cnt,
+          permille / 10, permille % 10, writeback_cnt);
+  printf ("Read-ahead: %lld sectors, %lld dropped\n",
+          readahead_cnt, readahead_drops);
+}
+
+/* Returns the entry holding SECTOR, or a null pointer if SECTOR
+   is not cached.  cache_lock must be held. */
+static struct cache_entry *
+cache_lookup (block_sector_t sector)
+{
+  struct cache_entry key;
+  struct hash_elem *found;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  key.sector = sector;
+  found = hash_find (&cache_map, &key.hash_elem);
+  return (found != NULL
+          ? hash_entry (found, struct cache_entry, hash_elem)
+          : NULL);
+}
+
+/* Returns the cache entry for SECTOR, with its lock held,
+   reading the sector from disk if it is not cached unless the
+   caller will overwrite all of it (WHOLE_WRITE).  The caller
+   must release the entry with cache_put(). */
+static struct cache_entry *
+cache_get (block_sector_t sector, bool whole_write)
+{
+  struct cache_entry *e;
+
+  lock_acquire (&cache_lock);
+  for (;;)
+    {
+      e = cache_lookup (sector);
+      if (e != NULL)
+        {
+          /* Hit.  If another thread is still reading the sector
+             in, acquiring the entry's lock waits for it to
+             finish. */
+          e->users++;
+          e->accessed = true;
+          hit_cnt++;
+          lock_release (&cache_lock);
+          lock_acquire (&e->lock);
+          return e;
+        }
+
+      /* Miss, unless cache_claim() had to wait, for an entry or
+         for SECTOR to be written, and so we must look again. */
+      e = cache_claim (sector, true);
+      if (e != NULL)
+        break;
+    }
+
+  miss_cnt++;
+  if (!whole_write)
+    block_read (fs_device, sector, e->data);
+  return e;
+}
+
+/* Takes an unused entry for SECTOR, which must not be cached,
+   setting its `accessed' bit to ACCESSED.  cache_lock must be
+   held, and is released.  Returns the entry with its lock held,
+   before anyone else can find it under its new sector, but
+   without reading the sector in.  The caller must release the
+   entry with cache_put().
+
+   If SECTOR is being written by cache_write_multiple(), waits
+   for the write to finish and returns a null pointer, with
+   cache_lock still held, so that the caller looks SECTOR up
+   again.  Waiting for an unused entry also drops cache_lock, so
+   another thread may cache SECTOR meanwhile; if so, returns a
+   null pointer in the same way. */
+static struct cache_entry *
+cache_claim (block_sector_t sector, bool accessed)
+{
+  struct cache_entry *e;
+  struct hash_elem *old UNUSED;
+
+  if (being_written (sector))
+    {
+      do
+        cond_wait (&write_run_done, &cache_lock);
+      while (being_written (sector));
+      return NULL;
+    }
+  e = cache_evict (sector);
+  if (e == NULL)
+    return NULL;
+  e->users++;
+  lock_acquire (&e->lock);
+  e->sector = sector;
+  e->valid = true;
+  e->accessed = accessed;
+  old = hash_insert (&cache_map, &e->hash_elem);
+  ASSERT (old == NULL);
+  lock_release (&cache_lock);
+  return e;
+}
+
+/* Read-ahead thread: reads queued sectors into the cache, unless
+   they are there already. */
+static void
+readahead_thread (void *aux UNUSED)
+{
+  for (;;)
+    {
+      struct cache_entry *e;
+      block_sector_t sector;
+
+      lock_acquire (&ra_lock);
+      while (ra_cnt == 0)
+        cond_wait (&ra_queued, &ra_lock);
+      sector = ra_queue[ra_head];
+      ra_head = (ra_head + 1) % READAHEAD_QUEUE;
+      ra_cnt--;
+      lock_release (&ra_lock);
+
+      lock_acquire (&cache_lock);
+      if (cache_lookup (sector) != NULL)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      e = cache_claim (sector, false);
+      if (e == NULL)
+        {
+          lock_release (&cache_lock);
+          continue;
+        }
+      readahead_cnt++;
+      block_read (fs_device, sector, e->data);
+      cache_put (e);
+    }
+}
+
+/* Called when a write submitted by cache_flush() is done. */
+static void
+flush_done (struct block_request *req)
+{
+  sema_up (req->aux);
+}
+
+/* Releases entry E, obtained from cache_get(). */
+static void
+cache_put (struct cache_entry *e)
+{
+  lock_release (&e->lock);
+
+  lock_acquire (&cache_lock);
+  if (--e->users == 0)
+    cond_signal (&entry_unused, &cache_lock);
+  lock_release (&cache_lock);
+}
+
+/* Chooses an entry not in use, writes it back if it is dirty,
+   and removes it from the table, to hold SECTOR.  Waits for an
+   entry to become unused if none is, and returns a null pointer
+   if SECTOR was cached by someone else in the meantime.
+   cache_lock must be held.
+
+   The write-back happens with cache_lock held, so that no one
+   can read the old sector from disk before its new contents
+   reach it. */
+static struct cache_entry *
+cache_evict (block_sector_t sector)
+{
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (;;)
+    {
+      size_t i;
+
+      /* Two sweeps of the clock hand clear every `accessed' bit,
+         so if no entry is found by then, all are in use. */
+      for (i = 0; i < 2 * CACHE_SIZE; i++)
+        {
+          struct cache_entry *e = &entries[clock_hand];
+          clock_hand = (clock_hand + 1) % CACHE_SIZE;
+
+          if (e->users > 0)
+            continue;
+          if (e->valid && e->accessed)
+            {
+              e->accessed = false;
+              continue;
+            }
+
+          if (e->valid)
+            {
+              if (e->dirty)
+                {
+                  block_write (fs_device, e->sector, e->data);
+                  e->dirty = false;
+                  writeback_cnt++;
+                }
+              hash_delete (&cache_map, &e->hash_elem);
+              e->valid = false;
+            }
+          return e;
+        }
+      cond_wait (&entry_unused, &cache_lock);
+      if (cache_lookup (sector) != NULL)
+        return NULL;
+    }
+}
+
+/* Returns true if SECTOR is in a run that cache_write_multiple()
+   is writing.  cache_lock must be held. */
+static bool
+being_written (block_sector_t sector)
+{
+  struct list_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&cache_lock));
+
+  for (e = list_begin (&write_runs); e != list_end (&write_runs);
+       e = list_next (e))
+    {
+      struct write_run *wr = list_entry (e, struct write_run, elem);
+      if (sector >= wr->first && sector - wr->first < wr->cnt)
+        return true;
+    }
+  return false;
+}
+
+/* Returns a hash value for the cache entry containing E. */
+static unsigned
+entry_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  const struct cache_entry *ce = hash_entry (e, struct cache_entry, hash_elem);
+  return hash_int (ce->sector);
+}
+
+/* Returns true if the cache entry containing A holds a lower
+   sector than the one containing B. */
+static bool
+entry_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct cache_entry, hash_elem)->sector
+          < hash_entry (b, struct cache_entry, hash_elem)->sector);
+}
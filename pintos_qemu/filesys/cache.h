@@ -0,0 +1,26 @@
+#ifndef FILESYS_CACHE_H
+#define FILESYS_CACHE_H
+
+#include <stdbool.h>
+#include <stddef.h>
+#include "devices/block.h"
+
+/* Number of sectors in the buffer cache. */
+#define CACHE_SIZE 64
+
+/* Read sectors ahead of sequential readers? */
+extern bool cache_readahead;
+
+void cache_init (void);
+void cache_read (block_sector_t, void *);
+void cache_read_at (block_sector_t, void *, size_t ofs, size_t size);
+void cache_write (block_sector_t, const void *);
+void cache_write_at (block_sector_t, const void *, size_t ofs, size_t size);
+void cache_read_multiple (block_sector_t, size_t cnt, void *buffers[]);
+void cache_write_multiple (block_sector_t, size_t cnt, const void *buffers[]);
+void cache_prefetch (block_sector_t);
+void cache_flush (void);
+void cache_invalidate (void);
+void cache_print_stats (void);
+
+#endif /* filesys/cache.h */
@@ -1,10 +1,14 @@
 #include "filesys/directory.h"
+#include <hash.h>
+#include <round.h>
+#include <stddef.h>
 #include <stdio.h>
 #include <string.h>
 #include <list.h>
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
 
 /* A directory. */
 struct dir 
@@ -21,12 +25,160 @@ struct dir_entry
     bool in_use;                        /* In use or free? */
   };
 
-/* Creates a directory with space for ENTRY_CNT entries in the
-   given SECTOR.  Returns true if successful, false on failure. */
+/* A directory is a hash table.  Its file starts with a table of
+   DIR_BUCKETS bucket heads, each the number of the first
+   BLOCK_SECTOR_SIZE-byte block of the file in that bucket's
+   chain of blocks, or 0 if the bucket is empty.  The blocks
+   follow the table.  An entry goes in bucket
+   hash_string(name) % DIR_BUCKETS, so a lookup reads one chain,
+   which is a single block until a bucket holds more than
+   DIR_BLOCK_ENTRIES names, or about 12,000 in the directory. */
+#define DIR_BUCKETS 512
+#define DIR_TABLE_SIZE (DIR_BUCKETS * sizeof (uint32_t))
+#define DIR_TABLE_BLOCKS DIV_ROUND_UP (DIR_TABLE_SIZE, BLOCK_SECTOR_SIZE)
+
+/* A block of a bucket's chain. */
+#define DIR_BLOCK_ENTRIES \
+  ((BLOCK_SECTOR_SIZE - sizeof (uint32_t)) / sizeof (struct dir_entry))
+struct dir_block
+  {
+    uint32_t next;                      /* Next block in chain, or 0. */
+    struct dir_entry entries[DIR_BLOCK_ENTRIES];
+  };
+
+/* Bucket tables of recently used directories, most recent first,
+   so that finding a bucket does not read the disk. */
+#define TABLE_CACHE_SIZE 4
+struct dir_table
+  {
+    struct list_elem elem;              /* Element in table_cache. */
+    block_sector_t sector;              /* Directory's inode sector. */
+    uint32_t buckets[DIR_BUCKETS];      /* Copy of the bucket table. */
+  };
+static struct list table_cache;
+static struct lock table_cache_lock;
+
+/* Initializes the directory module. */
+void
+dir_init (void)
+{
+  list_init (&table_cache);
+  lock_init (&table_cache_lock);
+}
+
+/* Returns the byte offset of entry IDX in block BLOCK. */
+static off_t
+entry_ofs (uint32_t block, size_t idx)
+{
+  return (block * BLOCK_SECTOR_SIZE + offsetof (struct dir_block, entries)
+          + idx * sizeof (struct dir_entry));
+}
+
+/* Returns the cached bucket table of the directory in INODE,
+   reading it in if necessary, or a null pointer if memory runs
+   out.  table_cache_lock must be held. */
+static struct dir_table *
+get_table (struct inode *inode)
+{
+  block_sector_t sector = inode_get_inumber (inode);
+  struct dir_table *t;
+  struct list_elem *e;
+
+  ASSERT (lock_held_by_current_thread (&table_cache_lock));
+
+  for (e = list_begin (&table_cache); e != list_end (&table_cache);
+       e = list_next (e))
+    {
+      t = list_entry (e, struct dir_table, elem);
+      if (t->sector == sector)
+        {
+          list_remove (e);
+          list_push_front (&table_cache, e);
+          return t;
+        }
+    }
+
+  /* Reuse the least recently used table, or make a new one. */
+  if (list_size (&table_cache) >= TABLE_CACHE_SIZE)
+    t = list_entry (list_pop_back (&table_cache), struct dir_table, elem);
+  else
+    {
+      t = malloc (sizeof *t);
+      if (t == NULL)
+        return NULL;
+    }
+  if (inode_read_at (inode, t->buckets, DIR_TABLE_SIZE, 0) != DIR_TABLE_SIZE)
+    {
+      free (t);
+      return NULL;
+    }
+  t->sector = sector;
+  list_push_front (&table_cache, &t->elem);
+  return t;
+}
+
+/* Sets *BLOCKP to the first block of BUCKET in the directory in
+   INODE, or to 0 if the bucket is empty.  Returns true if
+   successful, false if the table cannot be read. */
+static bool
+get_bucket (struct inode *inode, unsigned bucket, uint32_t *blockp)
+{
+  struct dir_table *t;
+
+  lock_acquire (&table_cache_lock);
+  t = get_table (inode);
+  if (t != NULL)
+    *blockp = t->buckets[bucket];
+  lock_release (&table_cache_lock);
+  return t != NULL;
+}
+
+/* Makes BLOCK the first block of BUCKET in the directory in
+   INODE.  Returns true if successful, false on failure. */
+static bool
+set_bucket (struct inode *inode, unsigned bucket, uint32_t block)
+{
+  struct dir_table *t;
+  bool success;
+
+  lock_acquire (&table_cache_lock);
+  success = (inode_write_at (inode, &block, sizeof block,
+                             bucket * sizeof block) == sizeof block);
+  if (success)
+    {
+      t = get_table (inode);
+      if (t != NULL)
+        t->buckets[bucket] = block;
+    }
+  lock_release (&table_cache_lock);
+  return success;
+}
+
+/* Creates a directory in the given SECTOR.  Directories grow as
+   entries are added, so ENTRY_CNT is only a hint and unused.
+   Returns true if successful, false on failure. */
 bool
-dir_create (block_sector_t sector, size_t entry_cnt)
+dir_create (block_sector_t sector, size_t entry_cnt UNUSED)
 {
-  return inode_create (sector, entry_cnt * sizeof (struct dir_entry));
+  struct list_elem *e;
+
+  /* Forget any table cached for whatever used to be in SECTOR. */
+  lock_acquire (&table_cache_lock);
+  for (e = list_begin (&table_cache); e != list_end (&table_cache);
+       e = list_next (e))
+    {
+      struct dir_table *t = list_entry (e, struct dir_table, elem);
+      if (t->sector == sector)
+        {
+          list_remove (e);
+          free (t);
+          break;
+        }
+    }
+  lock_release (&table_cache_lock);
+
+  /* The table starts out all zeros, that is, every bucket empty. */
+  return inode_create (sector, DIR_TABLE_BLOCKS * BLOCK_SECTOR_SIZE);
 }
 
 /* Opens and returns the directory for the given INODE, of which
@@ -83,32 +235,74 @@ dir_get_inode (struct dir *dir)
   return dir->inode;
 }
 
+/* Result of lookup(). */
+enum lookup_result
+  {
+    LOOKUP_FOUND,                       /* Name is in the directory. */
+    LOOKUP_NOT_FOUND,                   /* Name is not. */
+    LOOKUP_ERROR                        /* Memory or disk error. */
+  };
+
 /* Searches DIR for a file with the given NAME.
-   If successful, returns true, sets *EP to the directory entry
+   If found, returns LOOKUP_FOUND, sets *EP to the directory entry
    if EP is non-null, and sets *OFSP to the byte offset of the
    directory entry if OFSP is non-null.
-   otherwise, returns false and ignores EP and OFSP. */
-static bool
+   If not, returns LOOKUP_NOT_FOUND, and sets *OFSP, if OFSP is
+   non-null, to the byte offset of a free slot in NAME's bucket,
+   or to -1 if there is none.
+   Returns LOOKUP_ERROR if the bucket cannot be read, which does
+   not mean NAME is absent.
+   Reads only NAME's bucket's chain of blocks. */
+static enum lookup_result
 lookup (const struct dir *dir, const char *name,
         struct dir_entry *ep, off_t *ofsp) 
 {
-  struct dir_entry e;
-  size_t ofs;
-  
+  enum lookup_result result = LOOKUP_NOT_FOUND;
+  struct dir_block *b;
+  uint32_t block;
+  off_t free_ofs = -1;
+
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (e.in_use && !strcmp (name, e.name)) 
-      {
-        if (ep != NULL)
-          *ep = e;
-        if (ofsp != NULL)
-          *ofsp = ofs;
-        return true;
-      }
-  return false;
+  b = malloc (sizeof *b);
+  if (b == NULL
+      || !get_bucket (dir->inode, hash_string (name) % DIR_BUCKETS, &block))
+    {
+      free (b);
+      return LOOKUP_ERROR;
+    }
+
+  for (; block != 0 && result == LOOKUP_NOT_FOUND; block = b->next)
+    {
+      size_t i;
+
+      if (inode_read_at (dir->inode, b, sizeof *b, block * BLOCK_SECTOR_SIZE)
+          != sizeof *b)
+        {
+          result = LOOKUP_ERROR;
+          break;
+        }
+      for (i = 0; i < DIR_BLOCK_ENTRIES; i++)
+        {
+          struct dir_entry *e = &b->entries[i];
+          if (e->in_use && !strcmp (name, e->name))
+            {
+              if (ep != NULL)
+                *ep = *e;
+              free_ofs = entry_ofs (block, i);
+              result = LOOKUP_FOUND;
+              break;
+            }
+          else if (!e->in_use && free_ofs == -1)
+            free_ofs = entry_ofs (block, i);
+        }
+    }
+  free (b);
+
+  if (ofsp != NULL)
+    *ofsp = free_ofs;
+  return result;
 }
 
 /* Searches DIR for a file with the given NAME
@@ -124,7 +318,7 @@ dir_lookup (const struct dir *dir, const char *name,
   ASSERT (dir != NULL);
   ASSERT (name != NULL);
 
-  if (lookup (dir, name, &e, NULL))
+  if (lookup (dir, name, &e, NULL) == LOOKUP_FOUND)
     *inode = inode_open (e.inode_sector);
   else
     *inode = NULL;
@@ -152,29 +346,37 @@ dir_add (struct dir *dir, const char *name, block_sector_t inode_sector)
   if (*name == '\0' || strlen (name) > NAME_MAX)
     return false;
 
-  /* Check that NAME is not in use. */
-  if (lookup (dir, name, NULL, NULL))
-    goto done;
+  /* Check that NAME is not in use, and find a free slot in its
+     bucket.  Without a readable bucket, neither is known. */
+  if (lookup (dir, name, NULL, &ofs) != LOOKUP_NOT_FOUND)
+    return false;
 
-  /* Set OFS to offset of free slot.
-     If there are no free slots, then it will be set to the
-     current end-of-file.
-     
-     inode_read_at() will only return a short read at end of file.
-     Otherwise, we'd need to verify that we didn't get a short
-     read due to something intermittent such as low memory. */
-  for (ofs = 0; inode_read_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
-       ofs += sizeof e) 
-    if (!e.in_use)
-      break;
-
-  /* Write slot. */
   e.in_use = true;
   strlcpy (e.name, name, sizeof e.name);
   e.inode_sector = inode_sector;
-  success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  if (ofs != -1)
+    success = inode_write_at (dir->inode, &e, sizeof e, ofs) == sizeof e;
+  else
+    {
+      /* The bucket is full.  Put a new block at the end of the
+         directory, holding just this entry, at the head of the
+         bucket's chain. */
+      unsigned bucket = hash_string (name) % DIR_BUCKETS;
+      uint32_t block = DIV_ROUND_UP (inode_length (dir->inode),
+                                     BLOCK_SECTOR_SIZE);
+      struct dir_block *b = calloc (1, sizeof *b);
 
- done:
+      if (b == NULL || !get_bucket (dir->inode, bucket, &b->next))
+        {
+          free (b);
+          return false;
+        }
+      b->entries[0] = e;
+      success = (inode_write_at (dir->inode, b, sizeof *b,
+                                 block * BLOCK_SECTOR_SIZE) == sizeof *b
+                 && set_bucket (dir->inode, bucket, block));
+      free (b);
+    }
   return success;
 }
 
@@ -193,7 +395,7 @@ dir_remove (struct dir *dir, const char *name)
   ASSERT (name != NULL);
 
   /* Find directory entry. */
-  if (!lookup (dir, name, &e, &ofs))
+  if (lookup (dir, name, &e, &ofs) != LOOKUP_FOUND)
     goto done;
 
   /* Open inode. */
@@ -223,9 +425,14 @@ dir_readdir (struct dir *dir, char name[NAME_MAX + 1])
 {
   struct dir_entry e;
 
-  while (inode_read_at (dir->inode, &e, sizeof e, dir->pos) == sizeof e) 
+  /* DIR->pos counts entries, in every block after the table. */
+  while (inode_read_at (dir->inode, &e, sizeof e,
+                        entry_ofs (DIR_TABLE_BLOCKS
+                                   + dir->pos / DIR_BLOCK_ENTRIES,
+                                   dir->pos % DIR_BLOCK_ENTRIES))
+         == sizeof e) 
     {
-      dir->pos += sizeof e;
+      dir->pos++;
       if (e.in_use)
         {
           strlcpy (name, e.name, NAME_MAX + 1);
@@ -4,9 +4,13 @@
 #include "filesys/file.h"
 #include "filesys/filesys.h"
 #include "filesys/inode.h"
+#include "threads/synch.h"
 
 static struct file *free_map_file;   /* Free map file. */
 static struct bitmap *free_map;      /* Free map, one bit per sector. */
+static struct lock free_map_lock;    /* Protects free_map. */
+
+static size_t allocate_run (block_sector_t, size_t cnt);
 
 /* Initializes the free map. */
 void
@@ -17,6 +21,7 @@ free_map_init (void)
     PANIC ("bitmap creation failed--file system device is too large");
   bitmap_mark (free_map, FREE_MAP_SECTOR);
   bitmap_mark (free_map, ROOT_DIR_SECTOR);
+  lock_init (&free_map_lock);
 }
 
 /* Allocates CNT consecutive sectors from the free map and stores
@@ -27,26 +32,113 @@ free_map_init (void)
 bool
 free_map_allocate (size_t cnt, block_sector_t *sectorp)
 {
-  block_sector_t sector = bitmap_scan_and_flip (free_map, 0, cnt, false);
-  if (sector != BITMAP_ERROR
-      && free_map_file != NULL
-      && !bitmap_write (free_map, free_map_file))
-    {
-      bitmap_set_multiple (free_map, sector, cnt, false); 
-      sector = BITMAP_ERROR;
-    }
+  block_sector_t sector;
+
+  lock_acquire (&free_map_lock);
+  sector = bitmap_scan (free_map, 0, cnt, false);
+  if (sector != BITMAP_ERROR && allocate_run (sector, cnt) == 0)
+    sector = BITMAP_ERROR;
+  lock_release (&free_map_lock);
+
   if (sector != BITMAP_ERROR)
     *sectorp = sector;
   return sector != BITMAP_ERROR;
 }
 
+/* Allocates the free sectors starting at SECTOR, up to CNT of
+   them or the first one in use, whichever comes first.
+   Returns the number allocated, which is 0 if SECTOR is in use
+   or the free_map file could not be written. */
+size_t
+free_map_allocate_at (block_sector_t sector, size_t cnt)
+{
+  size_t run = 0;
+
+  lock_acquire (&free_map_lock);
+  while (run < cnt && sector + run < bitmap_size (free_map)
+         && !bitmap_test (free_map, sector + run))
+    run++;
+  run = allocate_run (sector, run);
+  lock_release (&free_map_lock);
+
+  return run;
+}
+
+/* Allocates CNT consecutive sectors if there are that many, and
+   otherwise the longest run of free sectors there is, and stores
+   the first into *SECTORP.
+   Returns the number of sectors allocated, which is 0 if the
+   disk is full or the free_map file could not be written. */
+size_t
+free_map_allocate_some (size_t cnt, block_sector_t *sectorp)
+{
+  size_t sector, run;
+
+  lock_acquire (&free_map_lock);
+  sector = bitmap_scan (free_map, 0, cnt, false);
+  if (sector != BITMAP_ERROR)
+    run = cnt;
+  else
+    {
+      /* Find the longest run. */
+      size_t size = bitmap_size (free_map);
+      size_t i = 0;
+
+      run = 0;
+      while (i < size)
+        {
+          size_t start, len;
+
+          while (i < size && bitmap_test (free_map, i))
+            i++;
+          for (start = i; i < size && !bitmap_test (free_map, i); i++)
+            continue;
+          len = i - start;
+          if (len > run)
+            {
+              sector = start;
+              run = len;
+            }
+        }
+    }
+  run = allocate_run (sector, run);
+  lock_release (&free_map_lock);
+
+  if (run > 0)
+    *sectorp = sector;
+  return run;
+}
+
+/* Marks the CNT free sectors starting at SECTOR as in use and
+   writes out the free map.  Returns CNT if successful, 0 if CNT
+   is 0 or the free_map file could not be written.
+   free_map_lock must be held. */
+static size_t
+allocate_run (block_sector_t sector, size_t cnt)
+{
+  ASSERT (lock_held_by_current_thread (&free_map_lock));
+
+  if (cnt == 0)
+    return 0;
+  ASSERT (bitmap_none (free_map, sector, cnt));
+  bitmap_set_multiple (free_map, sector, cnt, true);
+  if (free_map_file != NULL && !bitmap_write (free_map, free_map_file))
+    {
+      bitmap_set_multiple (free_map, sector, cnt, false);
+      return 0;
+    }
+  return cnt;
+}
+
 /* Makes CNT sectors starting at SECTOR available for use. */
 void
 free_map_release (block_sector_t sector, size_t cnt)
 {
+  lock_acquire (&free_map_lock);
   ASSERT (bitmap_all (free_map, sector, cnt));
   bitmap_set_multiple (free_map, sector, cnt, false);
   bitmap_write (free_map, free_map_file);
+  lock_release (&free_map_lock);
 }
 
 /* Opens the free map file and reads it from disk. */
@@ -1,14 +1,21 @@
 #include "filesys/fsutil.h"
 #include <debug.h>
+#include <round.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 #include <ustar.h>
+#include "devices/ide.h"
+#include "devices/timer.h"
+#include "filesys/cache.h"
 #include "filesys/directory.h"
 #include "filesys/file.h"
 #include "filesys/filesys.h"
+#include "filesys/inode.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
 #include "threads/vaddr.h"
 
 /* List files in the root directory. */
@@ -56,6 +63,316 @@ fsutil_cat (char **argv)
   file_close (file);
 }
 
+/* Reads FILE from start to end, from disk rather than the buffer
+   cache, in PGSIZE chunks into BUFFER, and returns the elapsed
+   time in nanoseconds.  Stores the file's size in *SIZE. */
+static int64_t
+time_read (struct file *file, void *buffer, off_t *size)
+{
+  int64_t start;
+  off_t n;
+
+  cache_invalidate ();
+  file_seek (file, 0);
+  start = timer_nanos ();
+  do
+    n = file_read (file, buffer, PGSIZE);
+  while (n > 0);
+  *size = file_tell (file);
+  return timer_nanos () - start;
+}
+
+/* Reads file ARGV[1] sequentially without and then with
+   read-ahead, and prints the throughput of each. */
+void
+fsutil_readbench (char **argv)
+{
+  const char *file_name = argv[1];
+  bool readahead = cache_readahead;
+  struct file *file;
+  void *buffer;
+  int pass;
+
+  file = filesys_open (file_name);
+  if (file == NULL)
+    PANIC ("%s: open failed", file_name);
+  buffer = palloc_get_page (PAL_ASSERT);
+  for (pass = 0; pass < 2; pass++)
+    {
+      int64_t ns;
+      off_t size;
+
+      cache_readahead = pass == 1;
+      ns = time_read (file, buffer, &size);
+      printf ("readbench: %s read-ahead: %d bytes in %lld us, %lld kB/s\n",
+              cache_readahead ? "with" : "without", size, ns / 1000,
+              ns > 0 ? (int64_t) size * 1000000000 / 1024 / ns : 0);
+    }
+  cache_readahead = readahead;
+  palloc_free_page (buffer);
+  file_close (file);
+}
+
+/* Sectors fsutil_iobench() reads per request. */
+#define IOBENCH_RUN 32
+
+/* A thread that keeps the CPU busy during fsutil_iobench(). */
+struct spinner
+  {
+    volatile bool stop;                 /* Set to make it exit. */
+    volatile long long loops;           /* Work done so far. */
+    struct semaphore done;              /* Up'd when it exits. */
+  };
+
+/* Spins on CPU 0, counting loops, until told to stop. */
+static void
+spinner_thread (void *sp_)
+{
+  struct spinner *sp = sp_;
+
+  thread_set_affinity (0);
+  while (!sp->stop)
+    sp->loops++;
+  sema_up (&sp->done);
+}
+
+/* Reads the first ARGV[1] sectors of the file system device by
+   PIO and then by DMA, while a thread of the same priority spins
+   on the same CPU, and prints the throughput of each along with
+   how much CPU time was left over for the spinner. */
+void
+fsutil_iobench (char **argv)
+{
+  block_sector_t cnt = atoi (argv[1]);
+  bool dma = ide_dma;
+  void *buffers[IOBENCH_RUN];
+  uint8_t *data;
+  size_t i;
+  int pass;
+
+  if (cnt == 0 || cnt > block_size (fs_device))
+    cnt = block_size (fs_device);
+  data = palloc_get_multiple (PAL_ASSERT,
+                              IOBENCH_RUN * BLOCK_SECTOR_SIZE / PGSIZE);
+  for (i = 0; i < IOBENCH_RUN; i++)
+    buffers[i] = data + i * BLOCK_SECTOR_SIZE;
+
+  /* The disk interrupts CPU 0, so run everything there. */
+  thread_set_affinity (0);
+  for (pass = 0; pass < 2; pass++)
+    {
+      struct spinner sp;
+      block_sector_t sector;
+      int64_t ns;
+
+      ide_dma = pass == 1;
+      sp.stop = false;
+      sp.loops = 0;
+      sema_init (&sp.done, 0);
+      if (thread_create ("spinner", thread_get_priority (), spinner_thread,
+                         &sp) == TID_ERROR)
+        PANIC ("iobench: thread_create failed");
+
+      ns = timer_nanos ();
+      for (sector = 0; sector < cnt; sector += IOBENCH_RUN)
+        block_read_multiple (fs_device, sector,
+                             (cnt - sector < IOBENCH_RUN
+                              ? cnt - sector : IOBENCH_RUN), buffers);
+      ns = timer_nanos () - ns;
+      sp.stop = true;
+      sema_down (&sp.done);
+
+      printf ("iobench: %s: %"PRDSNu" sectors in %lld us, %lld kB/s, "
+              "spinner %lld loops/ms\n", ide_dma ? "DMA" : "PIO", cnt,
+              ns / 1000,
+              ns > 0 ? (int64_t) cnt * BLOCK_SECTOR_SIZE * 1000000000
+                       / 1024 / ns : 0,
+              ns > 0 ? sp.loops * 1000000 / ns : 0);
+    }
+  thread_set_affinity (-1);
+  ide_dma = dma;
+  palloc_free_multiple (data, IOBENCH_RUN * BLOCK_SECTOR_SIZE / PGSIZE);
+}
+
+/* Sectors per request, and requests in flight at once, in
+   fsutil_blkbench(). */
+#define BLKBENCH_RUN 8
+#define BLKBENCH_DEPTH 16
+
+/* fsutil_blkbench()'s request slots, too big for a kernel
+   stack. */
+struct blkbench_slots
+  {
+    struct block_request reqs[BLKBENCH_DEPTH];
+    struct semaphore idle[BLKBENCH_DEPTH];
+    void *buffers[BLKBENCH_DEPTH][BLKBENCH_RUN];
+  };
+
+/* Completion callback for fsutil_blkbench()'s requests: frees
+   the request's slot. */
+static void
+blkbench_done (struct block_request *req)
+{
+  sema_up (req->aux);
+}
+
+/* Reads the first ARGV[1] sectors of each raw disk, one request
+   at a time and then with BLKBENCH_DEPTH requests in flight, and
+   prints the throughput of each.  Given the same image as IDE
+   and as virtio disks, e.g. with `pintos --virtio-mirror', this
+   compares the two drivers side by side. */
+void
+fsutil_blkbench (char **argv)
+{
+  size_t pages = DIV_ROUND_UP (BLKBENCH_DEPTH * BLKBENCH_RUN
+                               * BLOCK_SECTOR_SIZE, PGSIZE);
+  struct blkbench_slots *slots;
+  struct block *block;
+  uint8_t *data;
+  size_t i, j;
+
+  slots = malloc (sizeof *slots);
+  if (slots == NULL)
+    PANIC ("blkbench: out of memory");
+  data = palloc_get_multiple (PAL_ASSERT, pages);
+  for (i = 0; i < BLKBENCH_DEPTH; i++)
+    for (j = 0; j < BLKBENCH_RUN; j++)
+      slots->buffers[i][j] = data + (i * BLKBENCH_RUN + j) * BLOCK_SECTOR_SIZE;
+
+  for (block = block_first (); block != NULL; block = block_next (block))
+    {
+      block_sector_t cnt = atoi (argv[1]);
+      int depth;
+
+      if (block_type (block) != BLOCK_RAW)
+        continue;
+      if (cnt == 0 || cnt > block_size (block))
+        cnt = block_size (block);
+
+      for (depth = 1; depth <= BLKBENCH_DEPTH; depth += BLKBENCH_DEPTH - 1)
+        {
+          block_sector_t sector;
+          int64_t ns;
+          int k;
+
+          for (k = 0; k < depth; k++)
+            sema_init (&slots->idle[k], 1);
+          ns = timer_nanos ();
+          for (sector = 0, k = 0; sector < cnt; sector += BLKBENCH_RUN, k++)
+            {
+              struct block_request *req = &slots->reqs[k % depth];
+
+              sema_down (&slots->idle[k % depth]);
+              block_request_init (req, sector,
+                                  (cnt - sector < BLKBENCH_RUN
+                                   ? cnt - sector : BLKBENCH_RUN),
+                                  slots->buffers[k % depth], false,
+                                  blkbench_done, &slots->idle[k % depth]);
+              block_submit (block, req);
+            }
+          for (k = 0; k < depth; k++)
+            sema_down (&slots->idle[k]);
+          ns = timer_nanos () - ns;
+
+          printf ("blkbench: %s: %"PRDSNu" sectors, %d in flight: "
+                  "%lld us, %lld kB/s\n", block_name (block), cnt,
+                  depth * BLKBENCH_RUN, ns / 1000,
+                  ns > 0 ? (int64_t) cnt * BLOCK_SECTOR_SIZE * 1000000000
+                           / 1024 / ns : 0);
+        }
+    }
+  palloc_free_multiple (data, pages);
+  free (slots);
+}
+
+/* Creates a file of ARGV[1] kB, as fsutil_extract() does before
+   filling one in, and prints how long that took, and how long
+   flushing the buffer cache took afterward, before deleting the
+   file again. */
+void
+fsutil_createbench (char **argv)
+{
+  static const char file_name[] = "createbench.tmp";
+  off_t size = atoi (argv[1]) * 1024;
+  int64_t create_ns, flush_ns;
+
+  cache_flush ();
+  create_ns = timer_nanos ();
+  if (!filesys_create (file_name, size))
+    PANIC ("createbench: %s: create failed", file_name);
+  create_ns = timer_nanos () - create_ns;
+
+  flush_ns = timer_nanos ();
+  cache_flush ();
+  flush_ns = timer_nanos () - flush_ns;
+
+  printf ("createbench: %d kB file: create %lld us, flush %lld us\n",
+          size / 1024, create_ns / 1000, flush_ns / 1000);
+  if (!filesys_remove (file_name))
+    PANIC ("createbench: %s: delete failed", file_name);
+}
+
+/* Creates ARGV[1] empty files in the root directory, and prints
+   the average time to create a file and to look one up each time
+   the directory reaches another power of 10 entries.  Then
+   deletes the files again. */
+void
+fsutil_dirbench (char **argv)
+{
+  int cnt = atoi (argv[1]);
+  char name[NAME_MAX + 1];
+  struct dir *dir;
+  int created = 0;
+  int size;
+
+  dir = dir_open_root ();
+  if (dir == NULL)
+    PANIC ("dirbench: root dir open failed");
+  for (size = 10; created < cnt; size *= 10)
+    {
+      int64_t create_ns, lookup_ns;
+      int target = size < cnt ? size : cnt;
+      int batch = target - created;
+      int i;
+
+      create_ns = timer_nanos ();
+      for (; created < target; created++)
+        {
+          snprintf (name, sizeof name, "db%d", created);
+          if (!filesys_create (name, 0))
+            PANIC ("dirbench: %s: create failed", name);
+        }
+      create_ns = timer_nanos () - create_ns;
+
+      /* Look up every file once, up to 1,000 of them, spread over
+         the directory. */
+      lookup_ns = timer_nanos ();
+      for (i = 0; i < created && i < 1000; i++)
+        {
+          int file = created <= 1000 ? i : (int) ((int64_t) i * created / 1000);
+          struct inode *inode;
+
+          snprintf (name, sizeof name, "db%d", file);
+          if (!dir_lookup (dir, name, &inode))
+            PANIC ("dirbench: %s: lookup failed", name);
+          inode_close (inode);
+        }
+      lookup_ns = (timer_nanos () - lookup_ns) / i;
+
+      printf ("dirbench: %d entries: create %lld us/file, "
+              "lookup %lld us/file\n",
+              created, create_ns / batch / 1000, lookup_ns / 1000);
+    }
+  dir_close (dir);
+
+  while (created-- > 0)
+    {
+      snprintf (name, sizeof name, "db%d", created);
+      if (!filesys_remove (name))
+        PANIC ("dirbench: %s: delete failed", name);
+    }
+}
+
 /* Deletes file ARGV[1]. */
 void
 fsutil_rm (char **argv) 
@@ -67,6 +384,9 @@ fsutil_rm (char **argv)
     PANIC ("%s: delete failed\n", file_name);
 }
 
+/* Sectors of file data fsutil_extract() reads at a time. */
+#define EXTRACT_SECTORS 32
+
 /* Extracts a ustar-format tar archive from the scratch block
    device into the Pintos file system. */
 void
@@ -79,7 +399,7 @@ fsutil_extract (char **argv UNUSED)
 
   /* Allocate buffers. */
   header = malloc (BLOCK_SECTOR_SIZE);
-  data = malloc (BLOCK_SECTOR_SIZE);
+  data = malloc (EXTRACT_SECTORS * BLOCK_SECTOR_SIZE);
   if (header == NULL || data == NULL)
     PANIC ("couldn't allocate buffers");
 
@@ -124,13 +444,24 @@ fsutil_extract (char **argv UNUSED)
           if (dst == NULL)
             PANIC ("%s: open failed", file_name);
 
-          /* Do copy. */
+          /* Do copy, up to EXTRACT_SECTORS sectors per read. */
           while (size > 0)
             {
-              int chunk_size = (size > BLOCK_SECTOR_SIZE
-                                ? BLOCK_SECTOR_SIZE
-                                : size);
-              block_read (src, sector++, data);
+              void *buffers[EXTRACT_SECTORS];
+              size_t sectors = DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
+              int chunk_size;
+              size_t i;
+
+              if (sectors > EXTRACT_SECTORS)
+                sectors = EXTRACT_SECTORS;
+              for (i = 0; i < sectors; i++)
+                buffers[i] = (uint8_t *) data + i * BLOCK_SECTOR_SIZE;
+              block_read_multiple (src, sector, sectors, buffers);
+              sector += sectors;
+
+              chunk_size = (size > (int) (sectors * BLOCK_SECTOR_SIZE)
+                            ? (int) (sectors * BLOCK_SECTOR_SIZE)
+                            : size);
               if (file_write (dst, data, chunk_size) != chunk_size)
                 PANIC ("%s: write failed with %d bytes unwritten",
                        file_name, size);
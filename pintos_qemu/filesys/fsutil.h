@@ -4,6 +4,11 @@
 void fsutil_ls (char **argv);
 void fsutil_cat (char **argv);
 void fsutil_rm (char **argv);
+void fsutil_readbench (char **argv);
+void fsutil_iobench (char **argv);
+void fsutil_blkbench (char **argv);
+void fsutil_createbench (char **argv);
+void fsutil_dirbench (char **argv);
 void fsutil_extract (char **argv);
 void fsutil_append (char **argv);
 
@@ -1,25 +1,52 @@
 #include "filesys/inode.h"
-#include <list.h>
 #include <debug.h>
+#include <hash.h>
 #include <round.h>
 #include <string.h>
+#include "filesys/cache.h"
 #include "filesys/filesys.h"
 #include "filesys/free-map.h"
+#include "threads/interrupt.h"
 #include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/vaddr.h"
 
 /* Identifies an inode. */
 #define INODE_MAGIC 0x494e4f44
 
+/* A run of consecutive disk sectors holding consecutive
+   sectors of a file.  It ends where the next extent begins, or
+   the last one at the end of the sectors allocated to the file. */
+struct extent
+  {
+    uint32_t offset;                    /* First file sector. */
+    block_sector_t start;               /* First disk sector. */
+  };
+
+/* Extents kept in the inode and in its overflow sector. */
+#define INODE_EXTENTS 61
+#define OVERFLOW_EXTENTS (BLOCK_SECTOR_SIZE / sizeof (struct extent))
+#define MAX_EXTENTS (INODE_EXTENTS + OVERFLOW_EXTENTS)
+
 /* On-disk inode.
    Must be exactly BLOCK_SECTOR_SIZE bytes long. */
 struct inode_disk
   {
-    block_sector_t start;               /* First data sector. */
     off_t length;                       /* File size in bytes. */
     unsigned magic;                     /* Magic number. */
-    uint32_t unused[125];               /* Not used. */
+    uint32_t sectors;                   /* Data sectors allocated. */
+    uint32_t extent_cnt;                /* Number of extents. */
+    block_sector_t overflow;            /* Sector holding the extents
+                                           past INODE_EXTENTS, or 0 if
+                                           none is allocated. */
+    uint32_t initialized;               /* Sectors ever written; the
+                                           rest read as zeros. */
+    struct extent extents[INODE_EXTENTS]; /* Extents, by offset. */
   };
 
+/* Most sectors moved by one multi-sector transfer. */
+#define INODE_RUN_SECTORS 32
+
 /* Returns the number of sectors to allocate for an inode SIZE
    bytes long. */
 static inline size_t
@@ -28,52 +55,233 @@ bytes_to_sectors (off_t size)
   return DIV_ROUND_UP (size, BLOCK_SECTOR_SIZE);
 }
 
+/* What open_inodes knows an inode by.  A lookup key needs only
+   this, not a whole `struct inode', which is too big for the
+   stack. */
+struct inode_key
+  {
+    struct hash_elem elem;              /* Element in open_inodes. */
+    block_sector_t sector;              /* Sector number of disk location. */
+  };
+
 /* In-memory inode. */
 struct inode 
   {
-    struct list_elem elem;              /* Element in inode list. */
-    block_sector_t sector;              /* Sector number of disk location. */
+    struct inode_key key;               /* Sector, in open_inodes. */
     int open_cnt;                       /* Number of openers. */
     bool removed;                       /* True if deleted, false otherwise. */
     int deny_write_cnt;                 /* 0: writes ok, >0: deny writes. */
+    struct lock grow_lock;              /* Held while extending. */
     struct inode_disk data;             /* Inode content. */
+    struct extent *overflow;            /* Contents of overflow sector,
+                                           if in use. */
   };
 
+/* Returns INODE's extent number IDX. */
+static struct extent *
+extent_at (const struct inode *inode, size_t idx)
+{
+  ASSERT (idx < MAX_EXTENTS);
+  return (idx < INODE_EXTENTS
+          ? (struct extent *) &inode->data.extents[idx]
+          : &inode->overflow[idx - INODE_EXTENTS]);
+}
+
 /* Returns the block device sector that contains byte offset POS
    within INODE.
-   Returns -1 if INODE does not contain data for a byte at offset
-   POS. */
+   Returns -1 if INODE does not have a sector allocated for a
+   byte at offset POS.
+
+   Extents are added and extended with a barrier between filling
+   them in and counting them, so this needs no lock. */
 static block_sector_t
 byte_to_sector (const struct inode *inode, off_t pos) 
 {
+  uint32_t idx = pos / BLOCK_SECTOR_SIZE;
+  const struct extent *e;
+  size_t lo, hi;
+
   ASSERT (inode != NULL);
-  if (pos < inode->data.length)
-    return inode->data.start + pos / BLOCK_SECTOR_SIZE;
-  else
+  if (pos < 0 || idx >= inode->data.sectors)
     return -1;
+  barrier ();
+
+  /* The extent holding IDX is in [LO, HI). */
+  lo = 0;
+  hi = inode->data.extent_cnt;
+  while (hi - lo > 1)
+    {
+      size_t mid = lo + (hi - lo) / 2;
+      if (extent_at (inode, mid)->offset <= idx)
+        lo = mid;
+      else
+        hi = mid;
+    }
+  e = extent_at (inode, lo);
+  return e->start + (idx - e->offset);
+}
+
+/* Zeros INODE's sectors from its first uninitialized one up to,
+   but not including, file sector IDX, and counts them as
+   initialized.  The caller must hold INODE's grow_lock. */
+static void
+initialize_to (struct inode *inode, uint32_t idx)
+{
+  static char zeros[BLOCK_SECTOR_SIZE];
+  const void *buffers[INODE_RUN_SECTORS];
+  size_t i;
+
+  for (i = 0; i < INODE_RUN_SECTORS; i++)
+    buffers[i] = zeros;
+  while (inode->data.initialized < idx)
+    {
+      uint32_t first = inode->data.initialized;
+      block_sector_t sector;
+      size_t cnt = 1;
+
+      sector = byte_to_sector (inode, first * BLOCK_SECTOR_SIZE);
+
+      while (first + cnt < idx && cnt < INODE_RUN_SECTORS
+             && (byte_to_sector (inode, (first + cnt) * BLOCK_SECTOR_SIZE)
+                 == sector + cnt))
+        cnt++;
+      cache_write_multiple (sector, cnt, buffers);
+      barrier ();
+      inode->data.initialized += cnt;
+    }
 }
 
-/* List of open inodes, so that opening a single inode twice
-   returns the same `struct inode'. */
-static struct list open_inodes;
+/* Allocates sectors to INODE until it has at least CNT, by
+   extending its last extent where the sectors after it are free
+   and otherwise adding as few extents as possible.  The new
+   sectors are not written: they read as zeros until they are.
+   Returns false if the disk or INODE's extent list fills up
+   first, in which case INODE keeps what it got.
+   The caller must hold INODE's grow_lock, and write INODE to
+   disk afterward. */
+static bool
+inode_grow (struct inode *inode, size_t cnt)
+{
+  struct inode_disk *data = &inode->data;
+
+  while (data->sectors < cnt)
+    {
+      size_t want = cnt - data->sectors;
+      block_sector_t start;
+      struct extent *e;
+      size_t got;
+
+      /* Extend the last extent in place, if possible. */
+      if (data->extent_cnt > 0)
+        {
+          e = extent_at (inode, data->extent_cnt - 1);
+          start = e->start + (data->sectors - e->offset);
+          got = free_map_allocate_at (start, want);
+          if (got > 0)
+            {
+              data->sectors += got;
+              continue;
+            }
+        }
+
+      /* Otherwise start a new extent, first making room for it. */
+      if (data->extent_cnt == MAX_EXTENTS)
+        return false;
+      if (data->extent_cnt == INODE_EXTENTS && inode->overflow == NULL)
+        {
+          struct extent *overflow = calloc (1, BLOCK_SECTOR_SIZE);
+          if (overflow == NULL)
+            return false;
+          if (!free_map_allocate (1, &data->overflow))
+            {
+              free (overflow);
+              return false;
+            }
+          inode->overflow = overflow;
+        }
+      got = free_map_allocate_some (want, &start);
+      if (got == 0)
+        return false;
+      e = extent_at (inode, data->extent_cnt);
+      e->offset = data->sectors;
+      e->start = start;
+      barrier ();
+      data->extent_cnt++;
+      barrier ();
+      data->sectors += got;
+    }
+  return true;
+}
+
+/* Writes INODE's on-disk inode, and its overflow extents if it
+   has any, to disk. */
+static void
+write_inode (struct inode *inode)
+{
+  cache_write (inode->key.sector, &inode->data);
+  if (inode->overflow != NULL)
+    cache_write (inode->data.overflow, inode->overflow);
+}
+
+/* Releases all of INODE's data sectors, and its overflow
+   sector. */
+static void
+release_sectors (struct inode *inode)
+{
+  struct inode_disk *data = &inode->data;
+  size_t i;
+
+  for (i = 0; i < data->extent_cnt; i++)
+    {
+      uint32_t end = (i + 1 < data->extent_cnt
+                      ? extent_at (inode, i + 1)->offset : data->sectors);
+      struct extent *e = extent_at (inode, i);
+      free_map_release (e->start, end - e->offset);
+    }
+  if (inode->overflow != NULL)
+    {
+      free_map_release (data->overflow, 1);
+      free (inode->overflow);
+      inode->overflow = NULL;
+      data->overflow = 0;
+    }
+  data->extent_cnt = 0;
+  data->sectors = 0;
+  data->initialized = 0;
+}
+
+/* Open inodes, hashed by sector, so that opening a single inode
+   twice returns the same `struct inode'.  Opening an inode that
+   is already open only needs to read the table, so it is guarded
+   by a reader-writer lock. */
+static struct hash open_inodes;
+static struct rwlock open_inodes_lock;
+
+static struct inode *find_open_inode (block_sector_t);
+static hash_hash_func inode_hash;
+static hash_less_func inode_less;
 
 /* Initializes the inode module. */
 void
 inode_init (void) 
 {
-  list_init (&open_inodes);
+  if (!hash_init (&open_inodes, inode_hash, inode_less, NULL))
+    PANIC ("inode table: out of memory");
+  rwlock_init (&open_inodes_lock, false);
 }
 
 /* Initializes an inode with LENGTH bytes of data and
    writes the new inode to sector SECTOR on the file system
-   device.
+   device.  The data sectors are allocated but not written; they
+   read as zeros until they are.
    Returns true if successful.
    Returns false if memory or disk allocation fails. */
 bool
 inode_create (block_sector_t sector, off_t length)
 {
   struct inode_disk *disk_inode = NULL;
-  bool success = false;
+  struct inode *inode;
+  bool success;
 
   ASSERT (length >= 0);
 
@@ -81,27 +289,28 @@ inode_create (block_sector_t sector, off_t length)
      one sector in size, and you should fix that. */
   ASSERT (sizeof *disk_inode == BLOCK_SECTOR_SIZE);
 
+  /* Write an empty inode, then grow it to LENGTH. */
   disk_inode = calloc (1, sizeof *disk_inode);
-  if (disk_inode != NULL)
-    {
-      size_t sectors = bytes_to_sectors (length);
-      disk_inode->length = length;
-      disk_inode->magic = INODE_MAGIC;
-      if (free_map_allocate (sectors, &disk_inode->start)) 
-        {
-          block_write (fs_device, sector, disk_inode);
-          if (sectors > 0) 
-            {
-              static char zeros[BLOCK_SECTOR_SIZE];
-              size_t i;
-              
-              for (i = 0; i < sectors; i++) 
-                block_write (fs_device, disk_inode->start + i, zeros);
-            }
-          success = true; 
-        } 
-      free (disk_inode);
-    }
+  if (disk_inode == NULL)
+    return false;
+  disk_inode->magic = INODE_MAGIC;
+  cache_write (sector, disk_inode);
+  free (disk_inode);
+  if (length == 0)
+    return true;
+
+  inode = inode_open (sector);
+  if (inode == NULL)
+    return false;
+  lock_acquire (&inode->grow_lock);
+  success = inode_grow (inode, bytes_to_sectors (length));
+  if (success)
+    inode->data.length = length;
+  else
+    release_sectors (inode);
+  write_inode (inode);
+  lock_release (&inode->grow_lock);
+  inode_close (inode);
   return success;
 }
 
@@ -111,42 +320,100 @@ inode_create (block_sector_t sector, off_t length)
 struct inode *
 inode_open (block_sector_t sector)
 {
-  struct list_elem *e;
   struct inode *inode;
 
   /* Check whether this inode is already open. */
-  for (e = list_begin (&open_inodes); e != list_end (&open_inodes);
-       e = list_next (e)) 
+  rwlock_acquire_read (&open_inodes_lock);
+  inode = inode_reopen (find_open_inode (sector));
+  rwlock_release_read (&open_inodes_lock);
+  if (inode != NULL)
+    return inode;
+
+  /* Check again, since someone else may have opened it while we
+     did not hold the lock. */
+  rwlock_acquire_write (&open_inodes_lock);
+  inode = inode_reopen (find_open_inode (sector));
+  if (inode != NULL)
     {
-      inode = list_entry (e, struct inode, elem);
-      if (inode->sector == sector) 
-        {
-          inode_reopen (inode);
-          return inode; 
-        }
+      rwlock_release_write (&open_inodes_lock);
+      return inode;
     }
 
-  /* Allocate memory. */
+  /* Allocate memory and read the inode. */
   inode = malloc (sizeof *inode);
   if (inode == NULL)
-    return NULL;
+    {
+      rwlock_release_write (&open_inodes_lock);
+      return NULL;
+    }
+  cache_read (sector, &inode->data);
+  inode->overflow = NULL;
+  if (inode->data.overflow != 0)
+    {
+      inode->overflow = malloc (BLOCK_SECTOR_SIZE);
+      if (inode->overflow == NULL)
+        {
+          free (inode);
+          rwlock_release_write (&open_inodes_lock);
+          return NULL;
+        }
+      cache_read (inode->data.overflow, inode->overflow);
+    }
 
   /* Initialize. */
-  list_push_front (&open_inodes, &inode->elem);
-  inode->sector = sector;
+  inode->key.sector = sector;
+  hash_insert (&open_inodes, &inode->key.elem);
   inode->open_cnt = 1;
   inode->deny_write_cnt = 0;
   inode->removed = false;
-  block_read (fs_device, inode->sector, &inode->data);
+  lock_init (&inode->grow_lock);
+  rwlock_release_write (&open_inodes_lock);
   return inode;
 }
 
-/* Reopens and returns INODE. */
+/* Returns the open inode for SECTOR, or a null pointer if there
+   is none.  open_inodes_lock must be held. */
+static struct inode *
+find_open_inode (block_sector_t sector)
+{
+  struct inode_key key;
+  struct hash_elem *found;
+
+  key.sector = sector;
+  found = hash_find (&open_inodes, &key.elem);
+  return found != NULL ? hash_entry (found, struct inode, key.elem) : NULL;
+}
+
+/* Returns a hash value for the inode key containing E. */
+static unsigned
+inode_hash (const struct hash_elem *e, void *aux UNUSED)
+{
+  return hash_int (hash_entry (e, struct inode_key, elem)->sector);
+}
+
+/* Returns true if the inode key containing A is for a lower
+   sector than the one containing B. */
+static bool
+inode_less (const struct hash_elem *a, const struct hash_elem *b,
+            void *aux UNUSED)
+{
+  return (hash_entry (a, struct inode_key, elem)->sector
+          < hash_entry (b, struct inode_key, elem)->sector);
+}
+
+/* Reopens and returns INODE.
+
+   Readers of open_inodes may reopen the same inode at once, so
+   the open count changes with interrupts off. */
 struct inode *
 inode_reopen (struct inode *inode)
 {
   if (inode != NULL)
-    inode->open_cnt++;
+    {
+      enum intr_level old_level = intr_disable ();
+      inode->open_cnt++;
+      intr_set_level (old_level);
+    }
   return inode;
 }
 
@@ -154,7 +421,7 @@ inode_reopen (struct inode *inode)
 block_sector_t
 inode_get_inumber (const struct inode *inode)
 {
-  return inode->sector;
+  return inode->key.sector;
 }
 
 /* Closes INODE and writes it to disk.
@@ -163,24 +430,32 @@ inode_get_inumber (const struct inode *inode)
 void
 inode_close (struct inode *inode) 
 {
+  enum intr_level old_level;
+  bool last;
+
   /* Ignore null pointer. */
   if (inode == NULL)
     return;
 
   /* Release resources if this was the last opener. */
-  if (--inode->open_cnt == 0)
+  rwlock_acquire_write (&open_inodes_lock);
+  old_level = intr_disable ();
+  last = --inode->open_cnt == 0;
+  intr_set_level (old_level);
+  if (last)
+    hash_delete (&open_inodes, &inode->key.elem);
+  rwlock_release_write (&open_inodes_lock);
+
+  if (last)
     {
-      /* Remove from inode list and release lock. */
-      list_remove (&inode->elem);
- 
       /* Deallocate blocks if removed. */
       if (inode->removed) 
         {
-          free_map_release (inode->sector, 1);
-          free_map_release (inode->data.start,
-                            bytes_to_sectors (inode->data.length)); 
+          free_map_release (inode->key.sector, 1);
+          release_sectors (inode);
         }
 
+      free (inode->overflow);
       free (inode); 
     }
 }
@@ -202,7 +477,6 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
 {
   uint8_t *buffer = buffer_;
   off_t bytes_read = 0;
-  uint8_t *bounce = NULL;
 
   while (size > 0) 
     {
@@ -220,59 +494,107 @@ inode_read_at (struct inode *inode, void *buffer_, off_t size, off_t offset)
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if ((uint32_t) (offset / BLOCK_SECTOR_SIZE) >= inode->data.initialized)
         {
-          /* Read full sector directly into caller's buffer. */
-          block_read (fs_device, sector_idx, buffer + bytes_read);
+          /* Never written: zeros, without reading the disk. */
+          memset (buffer + bytes_read, 0, chunk_size);
         }
-      else 
+      else if (chunk_size == BLOCK_SECTOR_SIZE && is_kernel_vaddr (buffer))
         {
-          /* Read sector into bounce buffer, then partially copy
-             into caller's buffer. */
-          if (bounce == NULL) 
+          /* Whole sectors: read as many as lie next to each other on
+             disk with one multi-sector transfer.  Only into kernel
+             memory, since the disk's I/O thread cannot see user
+             memory. */
+          void *buffers[INODE_RUN_SECTORS];
+          size_t cnt = 0;
+
+          do
             {
-              bounce = malloc (BLOCK_SECTOR_SIZE);
-              if (bounce == NULL)
-                break;
+              buffers[cnt] = buffer + bytes_read + cnt * BLOCK_SECTOR_SIZE;
+              cnt++;
             }
-          block_read (fs_device, sector_idx, bounce);
-          memcpy (buffer + bytes_read, bounce + sector_ofs, chunk_size);
+          while (cnt < INODE_RUN_SECTORS
+                 && size >= (off_t) (cnt + 1) * BLOCK_SECTOR_SIZE
+                 && inode_left >= (off_t) (cnt + 1) * BLOCK_SECTOR_SIZE
+                 && (offset / BLOCK_SECTOR_SIZE + cnt
+                     < inode->data.initialized)
+                 && (byte_to_sector (inode, offset + cnt * BLOCK_SECTOR_SIZE)
+                     == sector_idx + cnt));
+          cache_read_multiple (sector_idx, cnt, buffers);
+          chunk_size = cnt * BLOCK_SECTOR_SIZE;
         }
-      
+      else
+        cache_read_at (sector_idx, buffer + bytes_read, sector_ofs,
+                       chunk_size);
+
       /* Advance. */
       size -= chunk_size;
       offset += chunk_size;
       bytes_read += chunk_size;
     }
-  free (bounce);
 
   return bytes_read;
 }
 
+/* Asks for the sectors holding INODE's bytes from OFFSET up to
+   OFFSET + SIZE, or its end, to be read into the buffer cache in
+   the background.  Sectors never written are skipped, since
+   reading them needs no disk access. */
+void
+inode_readahead (struct inode *inode, off_t offset, off_t size)
+{
+  off_t end = offset + size;
+
+  if (end > inode_length (inode))
+    end = inode_length (inode);
+  if (end > (off_t) inode->data.initialized * BLOCK_SECTOR_SIZE)
+    end = inode->data.initialized * BLOCK_SECTOR_SIZE;
+  for (offset = ROUND_DOWN (offset, BLOCK_SECTOR_SIZE); offset < end;
+       offset += BLOCK_SECTOR_SIZE)
+    cache_prefetch (byte_to_sector (inode, offset));
+}
+
 /* Writes SIZE bytes from BUFFER into INODE, starting at OFFSET.
    Returns the number of bytes actually written, which may be
-   less than SIZE if end of file is reached or an error occurs.
-   (Normally a write at end of file would extend the inode, but
-   growth is not yet implemented.) */
+   less than SIZE if the disk fills up or an error occurs.
+   Writing past end of file extends INODE, filling any gap with
+   zeros. */
 off_t
 inode_write_at (struct inode *inode, const void *buffer_, off_t size,
                 off_t offset) 
 {
   const uint8_t *buffer = buffer_;
   off_t bytes_written = 0;
+  off_t end = offset + size;
   uint8_t *bounce = NULL;
+  bool locked;
 
   if (inode->deny_write_cnt)
     return 0;
 
+  /* Writes past end of file, or into sectors never written
+     before, go one at a time.  Readers only see the new length,
+     or the newly initialized sectors, once the data is in
+     place. */
+  locked = (end > inode_length (inode)
+            || bytes_to_sectors (end) > inode->data.initialized);
+  if (locked)
+    {
+      lock_acquire (&inode->grow_lock);
+      if (!inode_grow (inode, bytes_to_sectors (end))
+          && end > (off_t) inode->data.sectors * BLOCK_SECTOR_SIZE)
+        end = inode->data.sectors * BLOCK_SECTOR_SIZE;
+    }
+
   while (size > 0) 
     {
       /* Sector to write, starting byte offset within sector. */
       block_sector_t sector_idx = byte_to_sector (inode, offset);
       int sector_ofs = offset % BLOCK_SECTOR_SIZE;
 
-      /* Bytes left in inode, bytes left in sector, lesser of the two. */
-      off_t inode_left = inode_length (inode) - offset;
+      /* Bytes left to write, bytes left in sector, lesser of the
+         two. */
+      off_t inode_left = end - offset;
       int sector_left = BLOCK_SECTOR_SIZE - sector_ofs;
       int min_left = inode_left < sector_left ? inode_left : sector_left;
 
@@ -281,30 +603,31 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
       if (chunk_size <= 0)
         break;
 
-      if (sector_ofs == 0 && chunk_size == BLOCK_SECTOR_SIZE)
+      if ((uint32_t) (offset / BLOCK_SECTOR_SIZE) < inode->data.initialized
+          || chunk_size == BLOCK_SECTOR_SIZE)
+        cache_write_at (sector_idx, buffer + bytes_written, sector_ofs,
+                        chunk_size);
+      else
         {
-          /* Write full sector directly to disk. */
-          block_write (fs_device, sector_idx, buffer + bytes_written);
-        }
-      else 
-        {
-          /* We need a bounce buffer. */
-          if (bounce == NULL) 
+          /* First write to part of a sector: zero the rest of it,
+             in a bounce buffer rather than by reading it. */
+          if (bounce == NULL)
             {
               bounce = malloc (BLOCK_SECTOR_SIZE);
               if (bounce == NULL)
                 break;
             }
-
-          /* If the sector contains data before or after the chunk
-             we're writing, then we need to read in the sector
-             first.  Otherwise we start with a sector of all zeros. */
-          if (sector_ofs > 0 || chunk_size < sector_left) 
-            block_read (fs_device, sector_idx, bounce);
-          else
-            memset (bounce, 0, BLOCK_SECTOR_SIZE);
+          memset (bounce, 0, BLOCK_SECTOR_SIZE);
           memcpy (bounce + sector_ofs, buffer + bytes_written, chunk_size);
-          block_write (fs_device, sector_idx, bounce);
+          cache_write (sector_idx, bounce);
+        }
+      if ((uint32_t) (offset / BLOCK_SECTOR_SIZE) >= inode->data.initialized)
+        {
+          /* The sectors between the old initialized ones and this
+             one must now read back as zeros from disk too. */
+          initialize_to (inode, offset / BLOCK_SECTOR_SIZE);
+          barrier ();
+          inode->data.initialized++;
         }
 
       /* Advance. */
@@ -314,6 +637,16 @@ inode_write_at (struct inode *inode, const void *buffer_, off_t size,
     }
   free (bounce);
 
+  if (locked)
+    {
+      if (offset > inode->data.length)
+        {
+          barrier ();
+          inode->data.length = offset;
+        }
+      write_inode (inode);
+      lock_release (&inode->grow_lock);
+    }
   return bytes_written;
 }
 
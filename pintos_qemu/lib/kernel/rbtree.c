@@ -0,0 +1,345 @@
+#include "rbtree.h"
+#include "../debug.h"
+
+/* Our red-black tree follows the presentation in [CLRS] chapter
+   13, except that leaves are null pointers rather than a shared
+   sentinel node, so that trees need no setup beyond rb_init().
+   The properties maintained are:
+
+     1. The root is black.
+
+     2. A red node has no red child.
+
+     3. Every path from a node down to a null leaf passes
+        through the same number of black nodes.
+
+   Together these keep the height within 2 lg (n + 1). */
+
+static bool is_red (const struct rb_node *);
+static struct rb_node *leftmost (struct rb_node *);
+static void replace (struct rb_tree *, struct rb_node *old,
+                     struct rb_node *new);
+static void rotate_left (struct rb_tree *, struct rb_node *);
+static void rotate_right (struct rb_tree *, struct rb_node *);
+static void insert_fixup (struct rb_tree *, struct rb_node *);
+static void remove_fixup (struct rb_tree *, struct rb_node *,
+                          struct rb_node *parent);
+
+/* Initializes TREE as an empty tree ordered by LESS given
+   auxiliary data AUX. */
+void
+rb_init (struct rb_tree *tree, rb_less_func *less, void *aux)
+{
+  ASSERT (tree != NULL);
+  ASSERT (less != NULL);
+
+  tree->root = NULL;
+  tree->first = NULL;
+  tree->size = 0;
+  tree->less = less;
+  tree->aux = aux;
+}
+
+/* Inserts NODE into TREE.  NODE goes after any nodes that
+   compare equal to it. */
+void
+rb_insert (struct rb_tree *tree, struct rb_node *node)
+{
+  struct rb_node *parent = NULL;
+  struct rb_node **link = &tree->root;
+  bool is_first = true;
+
+  ASSERT (node != NULL);
+
+  while (*link != NULL)
+    {
+      parent = *link;
+      if (tree->less (node, parent, tree->aux))
+        link = &parent->left;
+      else
+        {
+          link = &parent->right;
+          is_first = false;
+        }
+    }
+
+  node->parent = parent;
+  node->left = node->right = NULL;
+  node->red = true;
+  *link = node;
+  if (is_first)
+    tree->first = node;
+  tree->size++;
+
+  insert_fixup (tree, node);
+}
+
+/* Removes NODE, which must be in TREE, from TREE. */
+void
+rb_remove (struct rb_tree *tree, struct rb_node *node)
+{
+  struct rb_node *child, *parent;
+  bool removed_red;
+
+  ASSERT (tree->size > 0);
+
+  if (tree->first == node)
+    tree->first = rb_next (node);
+
+  if (node->left == NULL || node->right == NULL)
+    {
+      /* At most one child: splice NODE out. */
+      child = node->left != NULL ? node->left : node->right;
+      parent = node->parent;
+      removed_red = node->red;
+      replace (tree, node, child);
+    }
+  else
+    {
+      /* Two children: NODE's successor, which has no left
+         child, takes NODE's place and color. */
+      struct rb_node *succ = leftmost (node->right);
+
+      removed_red = succ->red;
+      child = succ->right;
+      if (succ->parent == node)
+        parent = succ;
+      else
+        {
+          parent = succ->parent;
+          replace (tree, succ, succ->right);
+          succ->right = node->right;
+          succ->right->parent = succ;
+        }
+      replace (tree, node, succ);
+      succ->left = node->left;
+      succ->left->parent = succ;
+      succ->red = node->red;
+    }
+  tree->size--;
+
+  if (!removed_red)
+    remove_fixup (tree, child, parent);
+}
+
+/* Returns the smallest node in TREE, or a null pointer if TREE
+   is empty. */
+struct rb_node *
+rb_first (const struct rb_tree *tree)
+{
+  return tree->first;
+}
+
+/* Returns the node that follows NODE in its tree, or a null
+   pointer if NODE is the largest. */
+struct rb_node *
+rb_next (const struct rb_node *node)
+{
+  if (node->right != NULL)
+    return leftmost (node->right);
+  while (node->parent != NULL && node == node->parent->right)
+    node = node->parent;
+  return node->parent;
+}
+
+/* Returns the number of nodes in TREE. */
+size_t
+rb_size (const struct rb_tree *tree)
+{
+  return tree->size;
+}
+
+/* Returns true if TREE is empty, false otherwise. */
+bool
+rb_empty (const struct rb_tree *tree)
+{
+  return tree->root == NULL;
+}
+
+/* Returns true if NODE is red.  Null leaves are black. */
+static bool
+is_red (const struct rb_node *node)
+{
+  return node != NULL && node->red;
+}
+
+/* Returns the smallest node in the subtree rooted at NODE. */
+static struct rb_node *
+leftmost (struct rb_node *node)
+{
+  while (node->left != NULL)
+    node = node->left;
+  return node;
+}
+
+/* Puts NEW, which may be null, where OLD is in TREE, as the
+   child of OLD's parent. */
+static void
+replace (struct rb_tree *tree, struct rb_node *old, struct rb_node *new)
+{
+  if (old->parent == NULL)
+    tree->root = new;
+  else if (old == old->parent->left)
+    old->parent->left = new;
+  else
+    old->parent->right = new;
+  if (new != NULL)
+    new->parent = old->parent;
+}
+
+/* Rotates NODE down to the left, raising its right child. */
+static void
+rotate_left (struct rb_tree *tree, struct rb_node *node)
+{
+  struct rb_node *right = node->right;
+
+  node->right = right->left;
+  if (right->left != NULL)
+    right->left->parent = node;
+  replace (tree, node, right);
+  right->left = node;
+  node->parent = right;
+}
+
+/* Rotates NODE down to the right, raising its left child. */
+static void
+rotate_right (struct rb_tree *tree, struct rb_node *node)
+{
+  struct rb_node *left = node->left;
+
+  node->left = left->right;
+  if (left->right != NULL)
+    left->right->parent = node;
+  replace (tree, node, left);
+  left->right = node;
+  node->parent = left;
+}
+
+/* Restores property 2 after red NODE was inserted. */
+static void
+insert_fixup (struct rb_tree *tree, struct rb_node *node)
+{
+  struct rb_node *parent;
+
+  while ((parent = node->parent) != NULL && parent->red)
+    {
+      /* PARENT is red, so it is not the root. */
+      struct rb_node *grand = parent->parent;
+
+      if (parent == grand->left)
+        {
+          struct rb_node *uncle = grand->right;
+          if (is_red (uncle))
+            {
+              parent->red = uncle->red = false;
+              grand->red = true;
+              node = grand;
+              continue;
+            }
+          if (node == parent->right)
+            {
+              rotate_left (tree, parent);
+              node = parent;
+              parent = node->parent;
+            }
+          parent->red = false;
+          grand->red = true;
+          rotate_right (tree, grand);
+        }
+      else
+        {
+          struct rb_node *uncle = grand->left;
+          if (is_red (uncle))
+            {
+              parent->red = uncle->red = false;
+              grand->red = true;
+              node = grand;
+              continue;
+            }
+          if (node == parent->left)
+            {
+              rotate_right (tree, parent);
+              node = parent;
+              parent = node->parent;
+            }
+          parent->red = false;
+          grand->red = true;
+          rotate_left (tree, grand);
+        }
+    }
+  tree->root->red = false;
+}
+
+/* Restores property 3 after a black node was removed from
+   between PARENT and NODE, which may be null.  NODE's subtree is
+   one black node short. */
+static void
+remove_fixup (struct rb_tree *tree, struct rb_node *node,
+              struct rb_node *parent)
+{
+  while (node != tree->root && !is_red (node))
+    {
+      /* NODE is short a black node, so its sibling is not null. */
+      if (node == parent->left)
+        {
+          struct rb_node *sibling = parent->right;
+          if (sibling->red)
+            {
+              sibling->red = false;
+              parent->red = true;
+              rotate_left (tree, parent);
+              sibling = parent->right;
+            }
+          if (!is_red (sibling->left) && !is_red (sibling->right))
+            {
+              sibling->red = true;
+              node = parent;
+              parent = node->parent;
+              continue;
+            }
+          if (!is_red (sibling->right))
+            {
+              sibling->left->red = false;
+              sibling->red = true;
+              rotate_right (tree, sibling);
+              sibling = parent->right;
+            }
+          sibling->red = parent->red;
+          parent->red = false;
+          sibling->right->red = false;
+          rotate_left (tree, parent);
+        }
+      else
+        {
+          struct rb_node *sibling = parent->left;
+          if (sibling->red)
+            {
+              sibling->red = false;
+              parent->red = true;
+              rotate_right (tree, parent);
+              sibling = parent->left;
+            }
+          if (!is_red (sibling->left) && !is_red (sibling->right))
+            {
+              sibling->red = true;
+              node = parent;
+              parent = node->parent;
+              continue;
+            }
+          if (!is_red (sibling->left))
+            {
+              sibling->right->red = false;
+              sibling->red = true;
+              rotate_left (tree, sibling);
+              sibling = parent->left;
+            }
+          sibling->red = parent->red;
+          parent->red = false;
+          sibling->left->red = false;
+          rotate_right (tree, parent);
+        }
+      node = tree->root;
+    }
+  if (node != NULL)
+    node->red = false;
+}
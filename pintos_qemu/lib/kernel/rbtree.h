@@ -0,0 +1,66 @@
+#ifndef __LIB_KERNEL_RBTREE_H
+#define __LIB_KERNEL_RBTREE_H
+
+/* Red-black tree.
+
+   A balanced binary search tree: insertion and removal take
+   O(lg n) time, and the smallest element is cached so that
+   rb_first() takes O(1).
+
+   Like the list and hash table, the tree does no dynamic
+   allocation.  Each structure that can be in a tree embeds a
+   struct rb_node member, and the rb_entry macro converts a
+   pointer to that member back into a pointer to the structure,
+   in the same way as list_entry.  Elements that compare equal
+   are kept in insertion order. */
+
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdint.h>
+
+/* Tree node. */
+struct rb_node
+  {
+    struct rb_node *parent;     /* Parent, or null for the root. */
+    struct rb_node *left;       /* Left (smaller) child, or null. */
+    struct rb_node *right;      /* Right (larger) child, or null. */
+    bool red;                   /* Red or black? */
+  };
+
+/* Converts pointer to tree node NODE into a pointer to the
+   structure that NODE is embedded inside.  Supply the name of
+   the outer structure STRUCT and the member name MEMBER of the
+   tree node. */
+#define rb_entry(NODE, STRUCT, MEMBER)                          \
+        ((STRUCT *) ((uint8_t *) (NODE)                         \
+                     - offsetof (STRUCT, MEMBER)))
+
+/* Compares the value of two tree nodes A and B, given auxiliary
+   data AUX.  Returns true if A is less than B, or false if A is
+   greater than or equal to B. */
+typedef bool rb_less_func (const struct rb_node *a,
+                           const struct rb_node *b,
+                           void *aux);
+
+/* Red-black tree. */
+struct rb_tree
+  {
+    struct rb_node *root;       /* Root node, or null if empty. */
+    struct rb_node *first;      /* Smallest node, or null if empty. */
+    size_t size;                /* Number of nodes. */
+    rb_less_func *less;         /* Comparison function. */
+    void *aux;                  /* Auxiliary data for `less'. */
+  };
+
+void rb_init (struct rb_tree *, rb_less_func *, void *aux);
+
+void rb_insert (struct rb_tree *, struct rb_node *);
+void rb_remove (struct rb_tree *, struct rb_node *);
+
+struct rb_node *rb_first (const struct rb_tree *);
+struct rb_node *rb_next (const struct rb_node *);
+
+size_t rb_size (const struct rb_tree *);
+bool rb_empty (const struct rb_tree *);
+
+#endif /* lib/kernel/rbtree.h */
@@ -0,0 +1,9 @@
+#ifndef __PROJECTS_BENCH_BENCH_H__
+#define __PROJECTS_BENCH_BENCH_H__
+
+void run_threadbench(char **argv);
+void run_workbench(char **argv);
+void run_lockbench(char **argv);
+void run_condbench(char **argv);
+
+#endif /* __PROJECTS_BENCH_BENCH_H__ */
@@ -0,0 +1,128 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+#include "projects/bench/bench.h"
+
+/* Producer/consumer broadcast cost.
+
+   The running thread produces ROUNDS batches of CONSUMERS items
+   into a shared count, announcing each batch to CONSUMERS
+   consumer threads with a broadcast, then waits for the batch to
+   be consumed.  Runs once with cond_broadcast(), which requeues
+   all but one waiter onto the lock, and once waking every waiter
+   with cond_signal(), as cond_broadcast() used to, and reports
+   how often consumers had to sleep. */
+
+/* Shared state, all protected by `lock'. */
+static struct lock lock;
+static struct condition not_empty;   /* Items available, or done. */
+static struct condition empty;       /* Batch fully consumed. */
+static int items;                    /* Items produced, not consumed. */
+static bool done;                    /* No more items coming. */
+static long long sleeps;             /* Total consumer sleeps. */
+
+/* Use cond_broadcast(), or signal each waiter in turn? */
+static bool use_broadcast;
+
+/* Upped by each consumer when it exits. */
+static struct semaphore exited;
+
+/* Wakes every thread waiting on COND. */
+static void
+wake_all (struct condition *cond)
+{
+    if (use_broadcast)
+        cond_broadcast (cond, &lock);
+    else
+        while (!list_empty (&cond->waiters))
+            cond_signal (cond, &lock);
+}
+
+/* Consumer thread: takes items until told there are no more. */
+static void
+consumer (void *aux UNUSED)
+{
+    struct thread *cur = thread_current ();
+    unsigned slept = cur->stats.voluntary;
+
+    lock_acquire (&lock);
+    for (;;) {
+        while (items == 0 && !done)
+            cond_wait (&not_empty, &lock);
+        if (items == 0)
+            break;
+        if (--items == 0)
+            cond_signal (&empty, &lock);
+    }
+    sleeps += cur->stats.voluntary - slept;
+    lock_release (&lock);
+    sema_up (&exited);
+}
+
+/* Runs ROUNDS batches through CONSUMERS consumers, broadcasting
+   with cond_broadcast() if BROADCAST, and returns the elapsed
+   time in nanoseconds. */
+static int64_t
+produce (int consumers, int rounds, bool broadcast)
+{
+    int64_t start;
+    int i;
+
+    use_broadcast = broadcast;
+    items = 0;
+    done = false;
+    sleeps = 0;
+    sema_init (&exited, 0);
+    for (i = 0; i < consumers; i++)
+        if (thread_create ("consumer", PRI_DEFAULT, consumer, NULL)
+            == TID_ERROR)
+            PANIC ("condbench: thread_create failed");
+
+    start = timer_nanos ();
+    lock_acquire (&lock);
+    for (i = 0; i < rounds; i++) {
+        items += consumers;
+        wake_all (&not_empty);
+        while (items > 0)
+            cond_wait (&empty, &lock);
+    }
+    done = true;
+    wake_all (&not_empty);
+    lock_release (&lock);
+    for (i = 0; i < consumers; i++)
+        sema_down (&exited);
+    return timer_nanos () - start;
+}
+
+/* Prints one line of results for HOW over ROUNDS rounds in NS
+   nanoseconds. */
+static void
+report (const char *how, int rounds, int64_t ns)
+{
+    printf ("condbench: %-9s %d rounds in %lld us, %lld ns/round, "
+            "%lld consumer sleeps\n",
+            how, rounds, ns / 1000, ns / rounds, sleeps);
+}
+
+/* condbench CONSUMERS ROUNDS: times ROUNDS producer/consumer
+   rounds each way. */
+void
+run_condbench (char **argv)
+{
+    int consumers = atoi (argv[1]);
+    int rounds = atoi (argv[2]);
+
+    if (consumers <= 0 || rounds <= 0)
+        PANIC ("condbench: CONSUMERS and ROUNDS must be positive");
+
+    lock_init (&lock);
+    cond_init (&not_empty);
+    cond_init (&empty);
+
+    report ("broadcast", rounds, produce (consumers, rounds, true));
+    report ("signal", rounds, produce (consumers, rounds, false));
+}
@@ -0,0 +1,151 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+#include "projects/bench/bench.h"
+
+/* Lock contention on a read-mostly table.
+
+   THREADS threads each look up or, one time in WRITE_EVERY,
+   update a small shared table OPS times, first under a plain
+   lock, then under a reader-writer lock.  Every critical section
+   yields once partway through, standing in for the disk read
+   inode_open() does under its lock, so that the holder is
+   preempted while others want in.  Under the plain lock they all
+   line up behind it; under the reader-writer lock lookups go on.
+
+   Finally, times timer_ticks(), which reads the tick count
+   through a sequence lock instead of turning interrupts off. */
+
+#define TABLE_SIZE 64           /* Entries in the shared table. */
+#define WRITE_EVERY 16          /* One operation in this many writes. */
+
+static int table[TABLE_SIZE];
+
+/* Locking to measure. */
+static bool use_rwlock;
+static struct lock plain_lock;
+static struct rwlock rw_lock;
+
+/* Per-run state. */
+static int ops_per_thread;
+static struct semaphore finished;
+
+/* Sums the table, yielding halfway through. */
+static int
+lookup (void)
+{
+    int sum = 0;
+    int i;
+
+    for (i = 0; i < TABLE_SIZE; i++) {
+        sum += table[i];
+        if (i == TABLE_SIZE / 2)
+            thread_yield ();
+    }
+    return sum;
+}
+
+/* Bumps every table entry, yielding halfway through. */
+static void
+update (void)
+{
+    int i;
+
+    for (i = 0; i < TABLE_SIZE; i++) {
+        table[i]++;
+        if (i == TABLE_SIZE / 2)
+            thread_yield ();
+    }
+}
+
+/* Thread body: runs ops_per_thread lookups and updates. */
+static void
+contender (void *aux UNUSED)
+{
+    int i;
+
+    for (i = 0; i < ops_per_thread; i++) {
+        bool write = i % WRITE_EVERY == 0;
+
+        if (!use_rwlock) {
+            lock_acquire (&plain_lock);
+            if (write)
+                update ();
+            else
+                lookup ();
+            lock_release (&plain_lock);
+        } else if (write) {
+            rwlock_acquire_write (&rw_lock);
+            update ();
+            rwlock_release_write (&rw_lock);
+        } else {
+            rwlock_acquire_read (&rw_lock);
+            lookup ();
+            rwlock_release_read (&rw_lock);
+        }
+    }
+    sema_up (&finished);
+}
+
+/* Runs THREADS contenders of OPS operations each, under the
+   reader-writer lock if RWLOCK or the plain lock otherwise, and
+   returns the elapsed time in nanoseconds. */
+static int64_t
+contend (int threads, int ops, bool rwlock)
+{
+    int64_t start;
+    int i;
+
+    use_rwlock = rwlock;
+    ops_per_thread = ops;
+    sema_init (&finished, 0);
+
+    start = timer_nanos ();
+    for (i = 0; i < threads; i++)
+        if (thread_create ("contender", PRI_DEFAULT, contender, NULL)
+            == TID_ERROR)
+            PANIC ("lockbench: thread_create failed");
+    for (i = 0; i < threads; i++)
+        sema_down (&finished);
+    return timer_nanos () - start;
+}
+
+/* Prints one line of results for TOTAL operations under HOW in
+   NS nanoseconds. */
+static void
+report (const char *how, int64_t total, int64_t ns)
+{
+    printf ("lockbench: %-6s %lld ops in %lld us, %lld ns/op\n",
+            how, total, ns / 1000, ns / total);
+}
+
+/* lockbench THREADS OPS: times OPS table operations in each of
+   THREADS threads under each kind of lock. */
+void
+run_lockbench (char **argv)
+{
+    int threads = atoi (argv[1]);
+    int ops = atoi (argv[2]);
+    int64_t total, start, ns;
+    int i;
+
+    if (threads <= 0 || ops <= 0)
+        PANIC ("lockbench: THREADS and OPS must be positive");
+    total = (int64_t) threads * ops;
+
+    lock_init (&plain_lock);
+    rwlock_init (&rw_lock, false);
+
+    report ("lock", total, contend (threads, ops, false));
+    report ("rwlock", total, contend (threads, ops, true));
+
+    start = timer_nanos ();
+    for (i = 0; i < ops; i++)
+        timer_ticks ();
+    ns = timer_nanos () - start;
+    printf ("lockbench: timer_ticks() %lld ns/call\n", ns / ops);
+}
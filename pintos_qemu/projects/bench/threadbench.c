@@ -0,0 +1,64 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "threads/init.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "devices/timer.h"
+#include "projects/bench/bench.h"
+
+/* Thread create/join/exit throughput.
+
+   Creates short-lived worker threads one after another.  Each
+   worker only signals that it ran and exits, so the time per
+   round trip is dominated by thread creation, two context
+   switches and thread teardown. */
+
+/* Worker body: lets the creator know it ran, then exits. */
+static void
+exit_worker (void *done_)
+{
+    struct semaphore *done = done_;
+    sema_up (done);
+}
+
+/* Runs CNT create/join/exit round trips and returns the elapsed
+   time in nanoseconds. */
+static int64_t
+create_join_exit (int cnt)
+{
+    struct semaphore done;
+    int64_t start;
+    int i;
+
+    sema_init (&done, 0);
+    start = timer_nanos ();
+    for (i = 0; i < cnt; i++) {
+        if (thread_create ("worker", PRI_DEFAULT, exit_worker, &done)
+            == TID_ERROR)
+            PANIC ("threadbench: thread_create failed");
+        sema_down (&done);
+    }
+    return timer_nanos () - start;
+}
+
+/* threadbench COUNT: times COUNT create/join/exit round trips,
+   after a warm-up batch that fills the thread page cache. */
+void
+run_threadbench (char **argv)
+{
+    int cnt = atoi (argv[1]);
+    int64_t ns;
+
+    if (cnt <= 0)
+        PANIC ("threadbench: COUNT must be positive");
+
+    create_join_exit (16);
+    ns = create_join_exit (cnt);
+
+    printf ("threadbench: %d threads in %lld us, %lld ns/thread, "
+            "%lld threads/s\n",
+            cnt, ns / 1000, ns / cnt,
+            ns > 0 ? (int64_t) cnt * 1000000000 / ns : 0);
+    thread_print_stats ();
+}
@@ -0,0 +1,115 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/malloc.h"
+#include "threads/synch.h"
+#include "threads/thread.h"
+#include "threads/workqueue.h"
+#include "devices/timer.h"
+#include "projects/bench/bench.h"
+
+/* Deferred work throughput: threads vs. the system workqueue.
+
+   Runs the same tiny task COUNT times, first each in a thread of
+   its own, all created before any is waited for, then each as a
+   work item on system_wq.  The task only bumps a counter, so the
+   time per task is the cost of getting it run at all. */
+
+/* Tasks run so far. */
+static int tasks_run;
+
+/* The task: counts itself. */
+static void
+task (void *aux UNUSED)
+{
+    enum intr_level old_level = intr_disable ();
+    tasks_run++;
+    intr_set_level (old_level);
+}
+
+/* Thread body: runs the task, then lets the creator know. */
+static void
+task_thread (void *done_)
+{
+    struct semaphore *done = done_;
+    task (NULL);
+    sema_up (done);
+}
+
+/* Runs CNT tasks in threads of their own and returns the elapsed
+   time in nanoseconds. */
+static int64_t
+run_threads (int cnt)
+{
+    struct semaphore done;
+    int64_t start;
+    int i;
+
+    sema_init (&done, 0);
+    start = timer_nanos ();
+    for (i = 0; i < cnt; i++)
+        if (thread_create ("task", PRI_DEFAULT, task_thread, &done)
+            == TID_ERROR)
+            PANIC ("workbench: thread_create failed");
+    for (i = 0; i < cnt; i++)
+        sema_down (&done);
+    return timer_nanos () - start;
+}
+
+/* Runs CNT tasks as work items on system_wq and returns the
+   elapsed time in nanoseconds.  Pushing blocks whenever the
+   queue is full. */
+static int64_t
+run_work (int cnt)
+{
+    struct work *works;
+    int64_t start;
+    int i;
+
+    works = malloc (cnt * sizeof *works);
+    if (works == NULL)
+        PANIC ("workbench: out of memory");
+    for (i = 0; i < cnt; i++)
+        work_init (&works[i], task, NULL);
+
+    start = timer_nanos ();
+    for (i = 0; i < cnt; i++)
+        workqueue_push (&system_wq, &works[i]);
+    workqueue_flush (&system_wq);
+    start = timer_nanos () - start;
+
+    free (works);
+    return start;
+}
+
+/* Prints one line of results for CNT tasks run by HOW in NS
+   nanoseconds. */
+static void
+report (const char *how, int cnt, int64_t ns)
+{
+    printf ("workbench: %-9s %d tasks in %lld us, %lld ns/task\n",
+            how, cnt, ns / 1000, ns / cnt);
+}
+
+/* workbench COUNT: times COUNT tasks each way. */
+void
+run_workbench (char **argv)
+{
+    int cnt = atoi (argv[1]);
+
+    if (cnt <= 0)
+        PANIC ("workbench: COUNT must be positive");
+
+    /* Warm up the thread page cache and the workers. */
+    run_threads (16);
+    run_work (16);
+
+    tasks_run = 0;
+    report ("threads", cnt, run_threads (cnt));
+    report ("workqueue", cnt, run_work (cnt));
+    if (tasks_run != 2 * cnt)
+        PANIC ("workbench: %d tasks run, expected %d", tasks_run, 2 * cnt);
+    workqueue_print_stats (&system_wq);
+}
@@ -5,48 +5,377 @@
 #include "threads/init.h"
 #include "threads/malloc.h"
 #include "threads/synch.h"
+#include "threads/sched.h"
+#include "threads/smp.h"
 #include "threads/thread.h"
 #include "threads/interrupt.h"
 #include "devices/timer.h"
 #include "projects/mfq/mfq.h"
 
+/* Scheduler benchmark.
 
-void test_loop(void *aux)
+   Runs a mix of worker threads for a fixed number of timer
+   ticks and reports, per workload class, the throughput, the
+   mean and 99th percentile wakeup-to-run latency, and Jain's
+   fairness index over the per-thread throughputs.
+
+   With "-smp=N", a mix of CPU-bound threads only, such as
+   "cpu.8", shows how throughput scales with the number of CPUs.
+   Mixes that spend their time in the kernel, such as "io" and
+   "lock", should not be expected to scale: the kernel runs
+   under one lock (see threads/smp.c).
+
+   Workload classes:
+
+     - cpu: pure CPU-bound spinning.
+
+     - io: I/O-like sleeper.  Sleeps one tick, then does a
+       little work, like a thread waiting on a device.
+
+     - lock: pairs of threads contending for one lock per pair,
+       doing most of their work inside the critical section.
+
+     - burst: interactive thread.  Sleeps 1 to 5 ticks, then
+       runs a burst of 1 to 4 work units.
+
+     - rt: real-time poller.  Reserves RT_RUNTIME ticks every
+       RT_PERIOD ticks with thread_set_deadline(), then sleeps
+       half a period and does one unit of work, over and over.
+
+   Sleep lengths and burst sizes come from a per-thread
+   pseudo-random sequence with a fixed seed, so that runs are
+   reproducible. */
+
+/* Iterations of the spin loop in one unit of work. */
+#define WORK_UNIT 10000
+
+/* Maximum latency samples kept per class. */
+#define MAX_SAMPLES 4096
+
+/* Reservation of each rt thread, in ticks. */
+#define RT_RUNTIME 1
+#define RT_PERIOD 10
+
+enum bench_class
+  {
+    BENCH_CPU,
+    BENCH_IO,
+    BENCH_LOCK,
+    BENCH_BURST,
+    BENCH_RT,
+    BENCH_CLASS_CNT
+  };
+
+static const char *class_names[BENCH_CLASS_CNT] = {"cpu", "io", "lock", "burst", "rt"};
+
+/* One benchmark thread. */
+struct bench_thread
+  {
+    char name[16];              /* Thread name, or empty for a default. */
+    enum bench_class class;     /* Workload. */
+    struct lock *lock;          /* Shared with partner, for BENCH_LOCK. */
+    unsigned seed;              /* Pseudo-random state. */
+    long long ops;              /* Completed work items. */
+    unsigned misses;            /* Deadlines missed, for BENCH_RT. */
+  };
+
+/* Latency samples of one class, in nanoseconds. */
+struct bench_samples
+  {
+    int64_t *ns;
+    int cnt;
+  };
+
+/* State of the current run. */
+static volatile bool stop;
+static struct semaphore finished;
+static struct bench_samples samples[BENCH_CLASS_CNT];
+
+/* Burns CPU for UNITS units of work. */
+static void
+spin (int units)
 {
-    tid_t tid = thread_tid();
-    /// TODO: make your own test
-    while(1){
-        int i =2;
-        printf("[%s] test_loop in\n",thread_name());
-        for(;;){
-            if(2147483647 % i == 0){
-                printf("find the prime");
-                break;
-            }
-            i++;
-            if(i %100000000==0){
-                timer_msleep(300);
+    volatile int i;
+    for (i = 0; i < units * WORK_UNIT; i++)
+        continue;
+}
+
+/* Returns a pseudo-random number in [LO, HI] from B's sequence. */
+static int
+next_random (struct bench_thread *b, int lo, int hi)
+{
+    b->seed = b->seed * 1103515245 + 12345;
+    return lo + (int) ((b->seed >> 16) % (unsigned) (hi - lo + 1));
+}
+
+/* Records how long the current thread took to run after it was
+   last woken, if it was woken after WOKEN_BEFORE. */
+static void
+record_latency (struct bench_thread *b, int64_t woken_before)
+{
+    int64_t woken = thread_current ()->stats.woken_at;
+    struct bench_samples *s = &samples[b->class];
+    enum intr_level old_level;
+
+    if (woken == woken_before)
+        return;
+    old_level = intr_disable ();
+    if (s->cnt < MAX_SAMPLES)
+        s->ns[s->cnt++] = timer_nanos () - woken;
+    intr_set_level (old_level);
+}
+
+/* Body of every benchmark thread. */
+static void
+bench_worker (void *b_)
+{
+    struct bench_thread *b = b_;
+
+    if (b->class == BENCH_RT && !thread_set_deadline (RT_RUNTIME, RT_PERIOD))
+        PANIC ("schedbench: real-time admission failed");
+
+    while (!stop) {
+        int64_t woken = thread_current ()->stats.woken_at;
+
+        switch (b->class) {
+        case BENCH_CPU:
+            spin (1);
+            break;
+        case BENCH_IO:
+            timer_sleep (1);
+            record_latency (b, woken);
+            spin (1);
+            break;
+        case BENCH_LOCK:
+            lock_acquire (b->lock);
+            record_latency (b, woken);
+            spin (2);
+            lock_release (b->lock);
+            spin (1);
+            break;
+        case BENCH_BURST:
+            timer_sleep (next_random (b, 1, 5));
+            record_latency (b, woken);
+            spin (next_random (b, 1, 4));
+            break;
+        case BENCH_RT:
+            timer_sleep (RT_PERIOD / 2);
+            record_latency (b, woken);
+            spin (1);
+            break;
+        default:
+            NOT_REACHED ();
+        }
+        b->ops++;
+    }
+    b->misses = thread_current ()->dl_misses;
+    sema_up (&finished);
+}
+
+/* Compares two latency samples for qsort(). */
+static int
+compare_ns (const void *a_, const void *b_)
+{
+    int64_t a = *(const int64_t *) a_;
+    int64_t b = *(const int64_t *) b_;
+    return a < b ? -1 : a > b;
+}
+
+/* Prints the results of class C, whose threads are the CNT
+   entries of THREADS with that class, after a run of NS
+   nanoseconds. */
+static void
+report_class (enum bench_class c, struct bench_thread *threads, int cnt,
+              int64_t ns)
+{
+    struct bench_samples *s = &samples[c];
+    long long sum = 0, sum_sq = 0;
+    int64_t mean = 0, p99 = 0;
+    int n = 0, jain = 0;
+    int i;
+
+    for (i = 0; i < cnt; i++)
+        if (threads[i].class == c) {
+            sum += threads[i].ops;
+            sum_sq += threads[i].ops * threads[i].ops;
+            n++;
+        }
+    if (n == 0)
+        return;
+
+    /* Jain's index (sum x)^2 / (n * sum x^2), in thousandths. */
+    if (sum_sq > 0)
+        jain = (uint64_t) sum * sum * 1000 / ((uint64_t) n * sum_sq);
+
+    if (s->cnt > 0) {
+        int64_t total = 0;
+        qsort (s->ns, s->cnt, sizeof *s->ns, compare_ns);
+        for (i = 0; i < s->cnt; i++)
+            total += s->ns[i];
+        mean = total / s->cnt;
+        p99 = s->ns[(s->cnt * 99) / 100];
+    }
+
+    printf ("%-6s %4d %10lld %10lld %9lld %9lld %7d  %d.%03d\n",
+            class_names[c], n, sum, ns > 0 ? sum * 1000000000 / ns : 0,
+            mean / 1000, p99 / 1000, s->cnt, jain / 1000, jain % 1000);
+}
+
+/* Runs the threads described by the CNT entries of THREADS,
+   created at the given PRIORITIES, for TICKS timer ticks, and
+   prints the results. */
+static void
+run_bench (struct bench_thread *threads, const int *priorities, int cnt,
+           int64_t ticks)
+{
+    int64_t start, ns;
+    unsigned misses;
+    int c, i;
+
+    stop = false;
+    sema_init (&finished, 0);
+    for (c = 0; c < BENCH_CLASS_CNT; c++) {
+        samples[c].cnt = 0;
+        samples[c].ns = malloc (MAX_SAMPLES * sizeof *samples[c].ns);
+        if (samples[c].ns == NULL)
+            PANIC ("schedbench: out of memory");
+    }
+
+    start = timer_nanos ();
+    for (i = 0; i < cnt; i++) {
+        char *name = threads[i].name;
+        if (name[0] == '\0')
+            snprintf (name, sizeof threads[i].name, "%s-%d",
+                      class_names[threads[i].class], i);
+        if (thread_create (name, priorities[i], bench_worker, &threads[i])
+            == TID_ERROR)
+            PANIC ("schedbench: thread_create failed");
+    }
+    timer_sleep (ticks);
+    stop = true;
+    for (i = 0; i < cnt; i++)
+        sema_down (&finished);
+    ns = timer_nanos () - start;
+
+    printf ("schedbench: %d threads, %lld ticks, %lld ms, %d CPUs, "
+            "%s scheduler, wakeup boost %d%s\n",
+            cnt, ticks, ns / 1000000, cpu_cnt, scheduler->name,
+            thread_boost_levels, thread_boost_long_sleep ? "+long" : "");
+    printf ("%-6s %4s %10s %10s %9s %9s %7s  %s\n", "class", "thr", "ops",
+            "ops/s", "mean_us", "p99_us", "samples", "jain");
+    for (c = 0; c < BENCH_CLASS_CNT; c++)
+        report_class (c, threads, cnt, ns);
+    for (i = 0, misses = 0; i < cnt; i++)
+        misses += threads[i].misses;
+    if (misses > 0)
+        printf ("schedbench: %u real-time deadline misses\n", misses);
+
+    for (c = 0; c < BENCH_CLASS_CNT; c++)
+        free (samples[c].ns);
+}
+
+/* Returns the class named NAME, or BENCH_CLASS_CNT if none. */
+static enum bench_class
+parse_class (const char *name)
+{
+    int c;
+    for (c = 0; c < BENCH_CLASS_CNT; c++)
+        if (!strcmp (name, class_names[c]))
+            return c;
+    return BENCH_CLASS_CNT;
+}
+
+/* schedbench MIX TICKS
+
+   MIX is a colon-separated list of CLASS.COUNT[.PRIORITY]
+   entries, e.g. "cpu.4:io.4:lock.2:burst.2.0".  COUNT threads of
+   each CLASS are created at PRIORITY (default PRI_DEFAULT) and
+   run for TICKS timer ticks.  Lock threads come in pairs, so an
+   odd lock COUNT is rounded up. */
+void
+run_schedbench (char **argv)
+{
+    struct bench_thread *threads;
+    struct lock *locks;
+    int *priorities;
+    char *token, *save_ptr;
+    int64_t ticks = atoi (argv[2]);
+    int cnt, max_cnt, lock_cnt;
+
+    if (ticks <= 0)
+        PANIC ("schedbench: TICKS must be positive");
+
+    max_cnt = 64;
+    threads = calloc (max_cnt, sizeof *threads);
+    priorities = calloc (max_cnt, sizeof *priorities);
+    locks = calloc (max_cnt / 2, sizeof *locks);
+    if (threads == NULL || priorities == NULL || locks == NULL)
+        PANIC ("schedbench: out of memory");
+
+    cnt = lock_cnt = 0;
+    for (token = strtok_r (argv[1], ":", &save_ptr); token != NULL;
+         token = strtok_r (NULL, ":", &save_ptr)) {
+        char *subtoken, *save_ptr2;
+        enum bench_class class;
+        int n, priority, i;
+
+        class = parse_class (strtok_r (token, ".", &save_ptr2));
+        if (class == BENCH_CLASS_CNT)
+            PANIC ("schedbench: unknown class in `%s'", token);
+        subtoken = strtok_r (NULL, ".", &save_ptr2);
+        n = subtoken != NULL ? atoi (subtoken) : 1;
+        subtoken = strtok_r (NULL, ".", &save_ptr2);
+        priority = subtoken != NULL ? atoi (subtoken) : PRI_DEFAULT;
+        if (class == BENCH_LOCK)
+            n += n % 2;
+        if (priority < PRI_MIN || priority > PRI_MAX)
+            PANIC ("schedbench: priority %d out of range", priority);
+        if (cnt + n > max_cnt)
+            PANIC ("schedbench: more than %d threads", max_cnt);
+
+        for (i = 0; i < n; i++, cnt++) {
+            threads[cnt].class = class;
+            threads[cnt].seed = cnt + 1;
+            priorities[cnt] = priority;
+            if (class == BENCH_LOCK) {
+                /* Lock threads pair up in order, whatever comes
+                   between them. */
+                threads[cnt].lock = &locks[lock_cnt / 2];
+                if (lock_cnt % 2 == 0)
+                    lock_init (threads[cnt].lock);
+                lock_cnt++;
             }
         }
-        timer_msleep(1000);
     }
+
+    run_bench (threads, priorities, cnt, ticks);
+
+    free (locks);
+    free (priorities);
+    free (threads);
 }
 
+/* mfq "[NAME.PRIORITY:NAME.PRIORITY...]"
+
+   Runs one CPU-bound thread per entry at the given priority for
+   10 seconds and reports how the CPU was shared among them. */
 void run_mfqtest(char **argv)
-{   
-    printf("[run_mfqtest] argv[1] : %s\n",argv[1]);
+{
+    struct bench_thread *threads;
+    int *priorities;
+    char *token, *save_ptr;
     int cnt;
-	char *token, *save_ptr;
 
-    enum intr_level old_level;
-    old_level = intr_disable ();
+    printf("[run_mfqtest] argv[1] : %s\n",argv[1]);
 
-    /// TODO: make your own test
-    debug_on();
-	cnt = 0;
-	for (token = strtok_r (argv[1], ":", &save_ptr); token != NULL; 
-		token = strtok_r (NULL, ":", &save_ptr)) {
+    threads = calloc (64, sizeof *threads);
+    priorities = calloc (64, sizeof *priorities);
+    if (threads == NULL || priorities == NULL)
+        PANIC ("mfq: out of memory");
 
+    cnt = 0;
+    for (token = strtok_r (argv[1], ":", &save_ptr); token != NULL && cnt < 64;
+         token = strtok_r (NULL, ":", &save_ptr)) {
         char *subtoken, *save_ptr2, *name;
         int priority;
 
@@ -57,15 +386,118 @@ void run_mfqtest(char **argv)
         subtoken = strtok_r (NULL, ".", &save_ptr2);
         priority = atoi(subtoken);
 
-        // you can create threads here
-        // printf("[run_mfqtest] thread name: %s\n",name); 
-        thread_create(name, priority, test_loop, NULL);
+        strlcpy (threads[cnt].name, name, sizeof threads[cnt].name);
+        threads[cnt].class = BENCH_CPU;
+        threads[cnt].seed = cnt + 1;
+        priorities[cnt] = priority;
+        cnt++;
+    }
 
-		cnt++;
-	}
-    intr_set_level (old_level);
-    
-    while (1) {
-        timer_msleep(1000);
+    run_bench (threads, priorities, cnt, 10 * TIMER_FREQ);
+    thread_print_schedstats ();
+
+    free (priorities);
+    free (threads);
+}
+
+/* Priority donation across a lock handoff.
+
+   WINNER, at level 3, holds INNER and waits on OUTER behind the
+   driver.  BOOSTER, at level 0, waits on INNER, lifting WINNER
+   to level 0.  WAITER, at level 1, also waits on OUTER.  When
+   the driver releases OUTER, WINNER is the best waiter and gets
+   it.  Once WINNER releases INNER and loses BOOSTER's donation,
+   WAITER is still queued behind it and should keep it at
+   level 1. */
+struct donate_test
+  {
+    struct lock outer;
+    struct lock inner;
+    struct semaphore done;      /* Up'd as each thread finishes. */
+    int winner_level;           /* WINNER's level after releasing INNER. */
+  };
+
+static void
+donate_winner (void *t_)
+{
+    struct donate_test *t = t_;
+
+    lock_acquire (&t->inner);
+    lock_acquire (&t->outer);
+    lock_release (&t->inner);
+    t->winner_level = thread_get_priority ();
+    lock_release (&t->outer);
+    sema_up (&t->done);
+}
+
+static void
+donate_booster (void *t_)
+{
+    struct donate_test *t = t_;
+
+    lock_acquire (&t->inner);
+    lock_release (&t->inner);
+    sema_up (&t->done);
+}
+
+static void
+donate_waiter (void *t_)
+{
+    struct donate_test *t = t_;
+
+    lock_acquire (&t->outer);
+    lock_release (&t->outer);
+    sema_up (&t->done);
+}
+
+/* Sleeps until CNT threads wait on LOCK. */
+static void
+wait_for_waiters (struct lock *lock, size_t cnt)
+{
+    for (;;) {
+        enum intr_level old_level = intr_disable ();
+        size_t waiting = list_size (&lock->semaphore.waiters);
+        intr_set_level (old_level);
+        if (waiting >= cnt)
+            break;
+        timer_sleep (1);
     }
-}
\ No newline at end of file
+}
+
+/* donate
+
+   Runs the donation test above and reports whether WINNER kept
+   WAITER's level. */
+void
+run_donatetest (char **argv UNUSED)
+{
+    struct donate_test t;
+    int old_priority = thread_get_priority ();
+    int i;
+
+    if (thread_mlfqs) {
+        printf ("donate: no donation under -mlfqs\n");
+        return;
+    }
+
+    lock_init (&t.outer);
+    lock_init (&t.inner);
+    sema_init (&t.done, 0);
+    t.winner_level = -1;
+
+    thread_set_priority (PRI_MIN);
+    lock_acquire (&t.outer);
+    thread_create ("winner", 3, donate_winner, &t);
+    wait_for_waiters (&t.outer, 1);
+    thread_create ("booster", 0, donate_booster, &t);
+    wait_for_waiters (&t.inner, 1);
+    thread_create ("waiter", 1, donate_waiter, &t);
+    wait_for_waiters (&t.outer, 2);
+    lock_release (&t.outer);
+    for (i = 0; i < 3; i++)
+        sema_down (&t.done);
+    thread_set_priority (old_priority);
+
+    printf ("donate: winner at level %d, waiter at level 1: %s\n",
+            t.winner_level, t.winner_level == 1 ? "PASS" : "FAIL");
+}
@@ -2,5 +2,7 @@
 #define __PROJECTS_PROJECT2_MFQ_H__
 
 void run_mfqtest(char **argv);
+void run_schedbench(char **argv);
+void run_donatetest(char **argv);
 
 #endif /* __PROJECTS_PROJECT2_MFQ_H__ */
\ No newline at end of file
@@ -20,8 +20,13 @@
 #include "threads/loader.h"
 #include "threads/malloc.h"
 #include "threads/palloc.h"
+#include "threads/profile.h"
 #include "threads/pte.h"
+#include "threads/sched.h"
+#include "threads/smp.h"
+#include "threads/synch.h"
 #include "threads/thread.h"
+#include "threads/workqueue.h"
 #ifdef USERPROG
 #include "userprog/process.h"
 #include "userprog/exception.h"
@@ -32,10 +37,12 @@
 /* project #2 */
 #include "projects/mfq/mfq.h"
 #include "projects/pa/pa.h"
+#include "projects/bench/bench.h"
 #endif
 #ifdef FILESYS
 #include "devices/block.h"
 #include "devices/ide.h"
+#include "devices/virtio-blk.h"
 #include "filesys/filesys.h"
 #include "filesys/fsutil.h"
 #endif
@@ -59,6 +66,11 @@ static const char *swap_bdev_name;
 /* -ul: Maximum number of pages to put into palloc's user pool. */
 static size_t user_page_limit = SIZE_MAX;
 
+#ifndef USERPROG
+/* -smp: Number of CPUs to run on. */
+static int smp_cpu_cnt = 1;
+#endif
+
 static void bss_init (void);
 static void paging_init (void);
 
@@ -120,10 +132,15 @@ int main (void)
 	thread_start ();
 	serial_init_queue ();
 	timer_calibrate ();
+#ifndef USERPROG
+	smp_init (smp_cpu_cnt);
+#endif
+	workqueue_init_system ();
 
 #ifdef FILESYS
 	/* Initialize file system. */
 	ide_init ();
+	virtio_blk_init ();
 	locate_block_devices ();
 	filesys_init (format_filesys);
 #endif
@@ -250,9 +267,22 @@ static char **parse_options (char **argv)
 			random_init (atoi (value));
 		else if (!strcmp (name, "-mlfqs"))
 			thread_mlfqs = true;
+		else if (!strcmp (name, "-sched")) {
+			if (value == NULL || !sched_select (value))
+				PANIC ("unknown scheduler `%s' (use -h for help)", value);
+		}
+		else if (!strcmp (name, "-boost")) {
+			if (value != NULL && !strcmp (value, "long"))
+				thread_boost_long_sleep = true;
+			else if (value != NULL)
+				thread_boost_levels = atoi (value);
+		}
 #ifdef USERPROG
 		else if (!strcmp (name, "-ul"))
 			user_page_limit = atoi (value);
+#else
+		else if (!strcmp (name, "-smp"))
+			smp_cpu_cnt = value != NULL ? atoi (value) : 1;
 #endif
 		else
 			PANIC ("unknown option `%s' (use -h for help)", name);
@@ -286,6 +316,37 @@ run_task (char **argv)
 	printf ("Execution of '%s' complete.\n", task);
 }
 
+/* Prints per-thread scheduler statistics. */
+static void
+run_schedstat (char **argv UNUSED)
+{
+	thread_print_schedstats ();
+}
+
+/* Controls the sampling profiler: "profile start", "profile
+   stop", or "profile dump". */
+static void
+run_profile (char **argv)
+{
+	if (!strcmp (argv[1], "start")) {
+		if (!profile_start ())
+			PANIC ("profile: out of memory");
+	}
+	else if (!strcmp (argv[1], "stop"))
+		profile_stop ();
+	else if (!strcmp (argv[1], "dump"))
+		profile_dump ();
+	else
+		PANIC ("profile: unknown command `%s'", argv[1]);
+}
+
+/* Prints statistics for the most contended locks. */
+static void
+run_lockstat (char **argv UNUSED)
+{
+	lock_print_stats ();
+}
+
 /* Executes all of the actions specified in ARGV[]
    up to the null pointer sentinel. */
 static void
@@ -301,12 +362,28 @@ run_actions (char **argv)
 	/* Table of supported actions. */
 	static const struct action actions[] = {
 		{"run", 2, run_task},
+		{"schedstat", 1, run_schedstat},
+		{"lockstat", 1, run_lockstat},
+		{"profile", 2, run_profile},
+#ifndef USERPROG
 		{"mfq", 2, run_mfqtest},
+		{"schedbench", 3, run_schedbench},
+		{"donate", 1, run_donatetest},
 		{"pa", 1, run_patest},
+		{"threadbench", 2, run_threadbench},
+		{"workbench", 2, run_workbench},
+		{"lockbench", 3, run_lockbench},
+		{"condbench", 3, run_condbench},
+#endif
 #ifdef FILESYS
 		{"ls", 1, fsutil_ls},
 		{"cat", 2, fsutil_cat},
 		{"rm", 2, fsutil_rm},
+		{"readbench", 2, fsutil_readbench},
+		{"iobench", 2, fsutil_iobench},
+		{"blkbench", 2, fsutil_blkbench},
+		{"createbench", 2, fsutil_createbench},
+		{"dirbench", 2, fsutil_dirbench},
 		{"extract", 1, fsutil_extract},
 		{"append", 2, fsutil_append},
 #endif
@@ -348,11 +425,38 @@ usage (void)
 	        "  run 'PROG [ARG...]' Run PROG and wait for it to complete.\n"
 #else
 	        "  run PROJECT           Run PROJECT.\n"
+#endif
+	        "  schedstat          Print per-thread scheduler statistics.\n"
+	        "  lockstat           Print the most contended locks (LOCKSTAT).\n"
+	        "  profile start|stop|dump  Control the sampling profiler; see\n"
+	        "                     utils/pintos-profile.\n"
+#ifndef USERPROG
+	        "  schedbench MIX TICKS  Run scheduler benchmark MIX, e.g.\n"
+	        "                     cpu.4:io.4:lock.2:burst.2:rt.1, for TICKS.\n"
+	        "  donate             Check that lock waiters donate to each new\n"
+	        "                     holder.\n"
+#endif
+#ifndef USERPROG
+	        "  threadbench COUNT  Time COUNT thread create/join/exit trips.\n"
+	        "  workbench COUNT    Compare COUNT tasks on threads vs. the\n"
+	        "                     system workqueue.\n"
+	        "  lockbench THREADS OPS  Time a read-mostly table under a lock\n"
+	        "                     vs. a reader-writer lock.\n"
+	        "  condbench CONSUMERS ROUNDS  Time producer/consumer rounds\n"
+	        "                     with and without wait morphing.\n"
 #endif
 #ifdef FILESYS
 	        "  ls                 List files in the root directory.\n"
 	        "  cat FILE           Print FILE to the console.\n"
 	        "  rm FILE            Delete FILE.\n"
+	        "  readbench FILE     Time reading FILE with and without read-ahead.\n"
+	        "  iobench SECTORS    Time disk reads by PIO and DMA beside a\n"
+	        "                     CPU-bound thread (0 reads the whole disk).\n"
+	        "  blkbench SECTORS   Time reads from each raw disk, one request\n"
+	        "                     at a time and many at once.\n"
+	        "  createbench KB     Time creating a KB kB file.\n"
+	        "  dirbench COUNT     Time creating and looking up COUNT files\n"
+	        "                     in the root directory.\n"
 	        "Use these actions indirectly via `pintos' -g and -p options:\n"
 	        "  extract            Untar from scratch device into file system.\n"
 	        "  append FILE        Append FILE to tar file on scratch device.\n"
@@ -370,7 +474,16 @@ usage (void)
 #endif
 #endif
 	        "  -rs=SEED           Set random number seed to SEED.\n"
-	        "  -mlfqs             Use multi-level feedback queue scheduler.\n"
+	        "  -sched=NAME        Use scheduler NAME: mfq (aging feedback queues,\n"
+	        "                     the default), mlfqs (4.4BSD), or cfs (fair).\n"
+	        "  -mlfqs             Same as -sched=mlfqs.\n"
+	        "  -boost=N           Move waking threads up N feedback queues.\n"
+	        "  -boost=long        Move threads waking from a sleep longer\n"
+	        "                     than their time slice to queue 0.\n"
+#ifndef USERPROG
+	        "  -smp=N             Run on N CPUs (with `pintos --smp=N').  The\n"
+	        "                     kernel itself runs under one lock.\n"
+#endif
 #ifdef USERPROG
 	        "  -ul=COUNT          Limit user memory to COUNT pages.\n"
 #endif
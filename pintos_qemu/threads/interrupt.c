@@ -6,8 +6,10 @@
 #include "threads/flags.h"
 #include "threads/intr-stubs.h"
 #include "threads/io.h"
+#include "threads/smp.h"
 #include "threads/thread.h"
 #include "threads/vaddr.h"
+#include "devices/lapic.h"
 #include "devices/timer.h"
 
 /* Programmable Interrupt Controller (PIC) registers.
@@ -43,9 +45,16 @@ static unsigned int unexpected_cnt[INTR_CNT];
    pre-empted.  Handlers for external interrupts also may not
    sleep, although they may invoke intr_yield_on_return() to
    request that a new process be scheduled just before the
-   interrupt returns. */
-static bool in_external_intr;   /* Are we processing an external interrupt? */
-static bool yield_on_return;    /* Should we yield on interrupt return? */
+   interrupt returns.  Each CPU keeps track of its own in `struct
+   cpu'. */
+
+/* Returns true if VEC is an external interrupt, from the PICs
+   (0x20...0x2f) or from a local APIC (LAPIC_TIMER_VEC and up). */
+static inline bool
+is_external (uint8_t vec)
+{
+  return (vec >= 0x20 && vec <= 0x2f) || vec >= LAPIC_TIMER_VEC;
+}
 
 /* Programmable Interrupt Controller helpers. */
 static void pic_init (void);
@@ -90,6 +99,11 @@ intr_enable (void)
   enum intr_level old_level = intr_get_level ();
   ASSERT (!intr_context ());
 
+  /* With more than one CPU, interrupts on means not holding the
+     kernel lock. */
+  if (old_level == INTR_OFF)
+    kernel_lock_release ();
+
   /* Enable interrupts by setting the interrupt flag.
 
      See [IA32-v2b] "STI" and [IA32-v3a] 5.8.1 "Masking Maskable
@@ -110,6 +124,11 @@ intr_disable (void)
      Hardware Interrupts". */
   asm volatile ("cli" : : : "memory");
 
+  /* With more than one CPU, interrupts off means holding the
+     kernel lock. */
+  if (old_level == INTR_ON)
+    kernel_lock_acquire ();
+
   return old_level;
 }
 
@@ -157,6 +176,15 @@ intr_init (void)
   intr_names[19] = "#XF SIMD Floating-Point Exception";
 }
 
+/* Loads the IDT on an application processor, which shares it
+   with the bootstrap processor. */
+void
+intr_init_ap (void)
+{
+  uint64_t idtr_operand = make_idtr_operand (sizeof idt - 1, idt);
+  asm volatile ("lidt %0" : : "m" (idtr_operand));
+}
+
 /* Registers interrupt VEC_NO to invoke HANDLER with descriptor
    privilege level DPL.  Names the interrupt NAME for debugging
    purposes.  The interrupt handler will be invoked with
@@ -181,7 +209,7 @@ void
 intr_register_ext (uint8_t vec_no, intr_handler_func *handler,
                    const char *name) 
 {
-  ASSERT (vec_no >= 0x20 && vec_no <= 0x2f);
+  ASSERT (is_external (vec_no));
   register_handler (vec_no, 0, INTR_OFF, handler, name);
 }
 
@@ -202,7 +230,7 @@ void
 intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
                    intr_handler_func *handler, const char *name)
 {
-  ASSERT (vec_no < 0x20 || vec_no > 0x2f);
+  ASSERT (!is_external (vec_no));
   register_handler (vec_no, dpl, level, handler, name);
 }
 
@@ -211,7 +239,7 @@ intr_register_int (uint8_t vec_no, int dpl, enum intr_level level,
 bool
 intr_context (void) 
 {
-  return in_external_intr;
+  return cpu_current ()->in_external_intr;
 }
 
 /* During processing of an external interrupt, directs the
@@ -222,7 +250,7 @@ void
 intr_yield_on_return (void) 
 {
   ASSERT (intr_context ());
-  yield_on_return = true;
+  cpu_current ()->yield_on_return = true;
 }
 
 /* 8259A Programmable Interrupt Controller. */
@@ -346,26 +374,35 @@ intr_handler (struct intr_frame *frame)
 {
   bool external;
   intr_handler_func *handler;
+  struct cpu *cpu;
+
+  /* An interrupt that turned interrupts off must take the kernel
+     lock, like intr_disable(). */
+  if ((frame->eflags & FLAG_IF) && intr_get_level () == INTR_OFF)
+    kernel_lock_acquire ();
 
   /* External interrupts are special.
      We only handle one at a time (so interrupts must be off)
-     and they need to be acknowledged on the PIC (see below).
+     and they need to be acknowledged on the PIC or local APIC
+     (see below).
      An external interrupt handler cannot sleep. */
-  external = frame->vec_no >= 0x20 && frame->vec_no < 0x30;
+  external = is_external (frame->vec_no);
+  cpu = cpu_current ();
   if (external) 
     {
       ASSERT (intr_get_level () == INTR_OFF);
       ASSERT (!intr_context ());
 
-      in_external_intr = true;
-      yield_on_return = false;
+      cpu->in_external_intr = true;
+      cpu->yield_on_return = false;
     }
 
   /* Invoke the interrupt's handler. */
   handler = intr_handlers[frame->vec_no];
   if (handler != NULL)
     handler (frame);
-  else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f)
+  else if (frame->vec_no == 0x27 || frame->vec_no == 0x2f
+           || frame->vec_no == LAPIC_SPURIOUS_VEC)
     {
       /* There is no handler, but this interrupt can trigger
          spuriously due to a hardware fault or hardware race
@@ -380,12 +417,20 @@ intr_handler (struct intr_frame *frame)
       ASSERT (intr_get_level () == INTR_OFF);
       ASSERT (intr_context ());
 
-      in_external_intr = false;
-      pic_end_of_interrupt (frame->vec_no); 
+      cpu->in_external_intr = false;
+      if (frame->vec_no <= 0x2f)
+        pic_end_of_interrupt (frame->vec_no); 
+      else if (frame->vec_no != LAPIC_SPURIOUS_VEC)
+        lapic_eoi ();
 
-      if (yield_on_return) 
+      if (cpu->yield_on_return) 
         thread_yield (); 
     }
+
+  /* Returning turns interrupts back on: drop the kernel lock, on
+     whichever CPU we are running on now. */
+  if ((frame->eflags & FLAG_IF) && intr_get_level () == INTR_OFF)
+    kernel_lock_release ();
 }
 
 /* Handles an unexpected interrupt with interrupt frame F.  An
@@ -8,6 +8,10 @@
 /* Physical address of kernel base. */
 #define LOADER_KERN_BASE 0x20000       /* 128 kB. */
 
+/* Physical address at which application processors start, in
+   real mode, when -smp is given.  See ap-start.S. */
+#define AP_START_PADDR 0x8000          /* 32 kB. */
+
 /* Kernel virtual address at which all physical memory is mapped.
    Must be aligned on a 4 MB boundary. */
 #define LOADER_PHYS_BASE 0xc0000000     /* 3 GB. */
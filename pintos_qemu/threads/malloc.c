@@ -41,6 +41,7 @@ struct desc
     size_t blocks_per_arena;    /* Number of blocks in an arena. */
     struct list free_list;      /* List of free blocks. */
     struct lock lock;           /* Lock. */
+    char name[16];              /* Name of lock, e.g. "malloc16". */
   };
 
 /* Magic number for detecting arena corruption. */
@@ -80,7 +81,8 @@ malloc_init (void)
       d->block_size = block_size;
       d->blocks_per_arena = (PGSIZE - sizeof (struct arena)) / block_size;
       list_init (&d->free_list);
-      lock_init (&d->lock);
+      snprintf (d->name, sizeof d->name, "malloc%zu", block_size);
+      lock_init_named (&d->lock, d->name);
     }
 }
 
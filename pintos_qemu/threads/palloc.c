@@ -403,7 +403,7 @@ init_pool (struct pool *p, void *base, size_t page_cnt, const char *name)
 //  printf ("[init_pool] %zu bitmap_size in %s.\n", bm_pages, name);
 
   /* Initialize the pool. */
-  lock_init (&p->lock);
+  lock_init_named (&p->lock, name);
   p->used_map = bitmap_create_in_buf (page_cnt, base, bm_pages * PGSIZE);
   p->base = base + bm_pages * PGSIZE;
 
@@ -0,0 +1,150 @@
+#include "threads/profile.h"
+#include <debug.h>
+#include <inttypes.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/palloc.h"
+#include "threads/smp.h"
+#include "threads/vaddr.h"
+
+/* Sampling profiler.
+
+   While the profiler runs, every periodic timer tick on every
+   CPU records where the interrupted code was: its instruction
+   pointer, up to PROFILE_DEPTH return addresses found by
+   following the saved frame pointers, and the running thread.
+   Samples go into a ring buffer allocated by profile_start(), so
+   taking one never allocates; once the buffer fills, each new
+   sample replaces the oldest.
+
+   profile_dump() prints the samples to the console, and so to
+   the serial port, one "PROF" line each, for utils/pintos-profile
+   to symbolize against kernel.o into a flat profile or collapsed
+   stacks for a flame graph. */
+
+/* Pages of samples allocated by profile_start(). */
+#define PROFILE_PAGES 64
+
+/* Ring buffer of samples. */
+static struct profile_sample *samples;
+static size_t sample_cap;               /* Slots in `samples'. */
+static size_t sample_head;              /* Next slot to fill. */
+static size_t sample_cnt;               /* Slots in use. */
+static long long overwritten;           /* Samples replaced when full. */
+
+/* True while samples are being taken. */
+static volatile bool profiling;
+
+/* Allocates the sample buffer, if it has not been, discards any
+   earlier samples, and starts taking samples.  Returns false if
+   the buffer cannot be allocated. */
+bool
+profile_start (void)
+{
+  enum intr_level old_level;
+
+  if (samples == NULL)
+    {
+      samples = palloc_get_multiple (0, PROFILE_PAGES);
+      if (samples == NULL)
+        return false;
+      sample_cap = PROFILE_PAGES * PGSIZE / sizeof *samples;
+    }
+
+  old_level = intr_disable ();
+  sample_head = sample_cnt = 0;
+  overwritten = 0;
+  profiling = true;
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Stops taking samples.  The samples taken so far are kept for
+   profile_dump().  Disabling interrupts waits out any sample
+   another CPU is still recording. */
+void
+profile_stop (void)
+{
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  profiling = false;
+  intr_set_level (old_level);
+}
+
+/* Prints the samples taken, oldest first, between "PROFILE
+   BEGIN" and "PROFILE END" lines.  Each sample is a line
+   "PROF CPU TID LEVEL MODE EIP CALLER...", addresses in hex and
+   MODE "k" or "u".  Stops taking samples first, if the profiler
+   is running. */
+void
+profile_dump (void)
+{
+  size_t i;
+
+  profile_stop ();
+
+  printf ("PROFILE BEGIN %zu samples, %lld overwritten, %d Hz\n",
+          sample_cnt, overwritten, TIMER_FREQ);
+  for (i = 0; i < sample_cnt; i++)
+    {
+      const struct profile_sample *s;
+      int d;
+
+      s = &samples[(sample_head + sample_cap - sample_cnt + i) % sample_cap];
+      printf ("PROF %d %d %d %c %08"PRIx32, s->cpu, s->tid, s->level,
+              s->user ? 'u' : 'k', s->eip);
+      for (d = 0; d < s->depth; d++)
+        printf (" %08"PRIx32, s->stack[d]);
+      printf ("\n");
+    }
+  printf ("PROFILE END\n");
+}
+
+/* Records a sample of the code interrupted with frame F, if the
+   profiler is running.  Called by the timer interrupt handlers,
+   with interrupts off. */
+void
+profile_sample (const struct intr_frame *f)
+{
+  struct thread *t = running_thread ();
+  struct profile_sample *s;
+  uint32_t *frame;
+  int depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!profiling)
+    return;
+
+  s = &samples[sample_head];
+  sample_head = (sample_head + 1) % sample_cap;
+  if (sample_cnt < sample_cap)
+    sample_cnt++;
+  else
+    overwritten++;
+
+  s->eip = (uint32_t) f->eip;
+  s->tid = t->tid;
+  s->level = t->priority;
+  s->cpu = cpu_current ()->id;
+  s->user = !is_kernel_vaddr ((void *) f->eip);
+
+  /* Follow saved frame pointers, as long as each stays on the
+     interrupted thread's kernel stack and moves toward its top.
+     User stacks are not followed. */
+  depth = 0;
+  frame = s->user ? NULL : (uint32_t *) f->ebp;
+  while (depth < PROFILE_DEPTH
+         && pg_round_down (frame) == t
+         && (uint8_t *) frame > (uint8_t *) t + sizeof *t
+         && (uint8_t *) (frame + 2) <= (uint8_t *) t + PGSIZE
+         && is_kernel_vaddr ((void *) frame[1]))
+    {
+      s->stack[depth++] = frame[1];
+      if ((uint32_t *) frame[0] <= frame)
+        break;
+      frame = (uint32_t *) frame[0];
+    }
+  s->depth = depth;
+}
@@ -0,0 +1,29 @@
+#ifndef THREADS_PROFILE_H
+#define THREADS_PROFILE_H
+
+#include <stdbool.h>
+#include <stdint.h>
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+
+/* Return addresses recorded per sample, innermost first. */
+#define PROFILE_DEPTH 8
+
+/* One profiler sample, taken on a timer tick. */
+struct profile_sample
+  {
+    uint32_t eip;                       /* Interrupted instruction. */
+    uint32_t stack[PROFILE_DEPTH];      /* Callers, innermost first. */
+    tid_t tid;                          /* Interrupted thread. */
+    uint8_t level;                      /* Its queue level or priority. */
+    uint8_t cpu;                        /* CPU it ran on. */
+    uint8_t depth;                      /* # of entries in `stack'. */
+    bool user;                          /* Interrupted in user mode? */
+  };
+
+bool profile_start (void);
+void profile_stop (void);
+void profile_dump (void);
+void profile_sample (const struct intr_frame *);
+
+#endif /* threads/profile.h */
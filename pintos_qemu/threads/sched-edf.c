@@ -0,0 +1,333 @@
+#include "threads/sched.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+
+/* Earliest-deadline-first real-time class.
+
+   A thread joins this class with thread_set_deadline(), asking
+   for RUNTIME ticks of CPU every PERIOD ticks.  Real-time
+   threads always run ahead of the threads of the selected
+   scheduling class, and among themselves the one with the
+   earliest deadline runs first.
+
+   Each thread is a constant bandwidth server: it has a budget of
+   RUNTIME to spend before its deadline.  When the budget runs
+   out, the thread is throttled, that is, kept off the CPU until
+   its deadline, when it gets a new budget and a deadline one
+   PERIOD later.  Admission control keeps the sum of RUNTIME /
+   PERIOD over all real-time threads at or below
+   EDF_BANDWIDTH_CAP, so that the other classes always get the
+   rest of the CPU, less at most a tick of overrun per budget.
+
+   A deadline passing while its thread is still ready or running
+   with budget left, that is, before the thread has finished its
+   work and blocked, counts as a deadline miss.  A throttled
+   thread reaching its deadline has only used up its budget, as
+   the server allows, so it just gets a new one.
+
+   Budgets and deadlines are kept in nanoseconds and charged at
+   every timer tick and thread switch. */
+
+/* Largest share of the CPU that real-time threads may reserve,
+   in millionths. */
+#define EDF_BANDWIDTH_CAP 950000
+
+/* Ready real-time threads, by deadline. */
+static struct list edf_ready;
+
+/* Throttled real-time threads, which are ready but out of
+   budget until their deadlines. */
+static struct list edf_throttled;
+
+/* Sum of the bandwidths of all real-time threads, in
+   millionths. */
+static int64_t edf_bandwidth;
+
+/* Total deadline misses, including those of exited threads. */
+static unsigned long long edf_misses;
+
+/* Returns the share of the CPU, in millionths, rounded up, of
+   RUNTIME every PERIOD. */
+static int64_t
+bandwidth (int64_t runtime, int64_t period)
+{
+  return (runtime * 1000000 + period - 1) / period;
+}
+
+/* list_less_func that orders threads by deadline. */
+static bool
+deadline_less (const struct list_elem *a_, const struct list_elem *b_,
+               void *aux UNUSED)
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+
+  return a->dl_deadline < b->dl_deadline;
+}
+
+/* Returns the ready real-time thread with the earliest deadline,
+   or a null pointer if there is none. */
+static struct thread *
+edf_first (void)
+{
+  if (list_empty (&edf_ready))
+    return NULL;
+  return list_entry (list_front (&edf_ready), struct thread, elem);
+}
+
+/* Starts a new period for T at NOW with a full budget. */
+static void
+replenish (struct thread *t, int64_t now)
+{
+  t->dl_deadline = now + t->dl_period;
+  t->dl_budget = t->dl_runtime;
+}
+
+/* Charges running thread T's budget for its run time since it
+   was last charged, up to NOW. */
+static void
+charge (struct thread *t, int64_t now)
+{
+  t->dl_budget -= now - t->exec_start;
+  t->exec_start = now;
+}
+
+/* Gives T a new period if its deadline has passed by NOW,
+   counting a miss if T still had budget left.  Returns true if T
+   got a new period. */
+static bool
+check_deadline (struct thread *t, int64_t now)
+{
+  if (t->dl_deadline > now)
+    return false;
+  if (t->dl_budget > 0)
+    {
+      t->dl_misses++;
+      edf_misses++;
+    }
+  replenish (t, now);
+  t->dl_throttled = false;
+  return true;
+}
+
+/* Queues T, which is ready, on the ready or throttled list. */
+static void
+edf_insert (struct thread *t)
+{
+  if (t->dl_budget <= 0)
+    {
+      t->dl_throttled = true;
+      list_push_back (&edf_throttled, &t->elem);
+    }
+  else
+    list_insert_ordered (&edf_ready, &t->elem, deadline_less, NULL);
+}
+
+/* Returns true if ready real-time thread T should run instead of
+   CUR. */
+static bool
+preempts (const struct thread *t, const struct thread *cur)
+{
+  return cur->dl_period == 0 || t->dl_deadline < cur->dl_deadline;
+}
+
+static void
+edf_init (void)
+{
+  list_init (&edf_ready);
+  list_init (&edf_throttled);
+}
+
+/* A thread that wakes up keeps its deadline and budget only if
+   spending the budget by the deadline would not exceed its
+   bandwidth; otherwise it starts a new period.  A real-time
+   thread woken by an interrupt handler preempts the running
+   thread as soon as the handler returns. */
+static void
+edf_enqueue (struct thread *t, bool wakeup)
+{
+  if (wakeup)
+    {
+      int64_t now = timer_nanos ();
+      if (t->dl_deadline <= now
+          || (t->dl_budget * 1000000 / (t->dl_deadline - now)
+              > bandwidth (t->dl_runtime, t->dl_period)))
+        replenish (t, now);
+      t->dl_throttled = false;
+    }
+  edf_insert (t);
+
+  if (wakeup && !t->dl_throttled && intr_context ()
+      && preempts (t, thread_current ()))
+    intr_yield_on_return ();
+}
+
+static void
+edf_dequeue (struct thread *t)
+{
+  list_remove (&t->elem);
+}
+
+static struct thread *
+edf_pick_next (struct thread *prev)
+{
+  struct thread *t;
+
+  if (prev != NULL && prev->status == THREAD_BLOCKED)
+    charge (prev, timer_nanos ());
+
+  t = edf_first ();
+  if (t == NULL)
+    return NULL;
+  list_pop_front (&edf_ready);
+  t->exec_start = timer_nanos ();
+  return t;
+}
+
+/* Unlike the other classes' tick, called at every tick whatever
+   the class of running thread CUR.  Hands out new budgets, and
+   returns true if CUR ran out of budget or a real-time thread
+   should run instead. */
+static bool
+edf_tick (struct thread *cur, unsigned slice_ticks UNUSED)
+{
+  int64_t now = timer_nanos ();
+  struct list_elem *e;
+  struct thread *first;
+
+  /* New periods for throttled threads, which are not misses. */
+  for (e = list_begin (&edf_throttled); e != list_end (&edf_throttled); )
+    {
+      struct thread *t = list_entry (e, struct thread, elem);
+      e = list_next (e);
+      if (check_deadline (t, now))
+        {
+          list_remove (&t->elem);
+          edf_insert (t);
+        }
+    }
+
+  /* Ready threads that missed their deadlines. */
+  while ((first = edf_first ()) != NULL && first->dl_deadline <= now)
+    {
+      list_pop_front (&edf_ready);
+      check_deadline (first, now);
+      edf_insert (first);
+    }
+
+  if (cur->dl_period > 0)
+    {
+      charge (cur, now);
+      check_deadline (cur, now);
+      if (cur->dl_budget <= 0)
+        {
+          cur->dl_throttled = true;
+          return true;
+        }
+    }
+
+  first = edf_first ();
+  return first != NULL && preempts (first, cur);
+}
+
+static void
+edf_yield (struct thread *cur)
+{
+  charge (cur, timer_nanos ());
+  edf_insert (cur);
+}
+
+static void
+edf_dump (void)
+{
+  struct list_elem *e;
+
+  printf ("edf: bandwidth %lld/1000000, %llu misses\n",
+          edf_bandwidth, edf_misses);
+  for (e = list_begin (&edf_ready); e != list_end (&edf_ready);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, elem);
+      printf ("[%s] deadline:%lld, budget:%lld\n", t->name,
+              t->dl_deadline, t->dl_budget);
+    }
+  for (e = list_begin (&edf_throttled); e != list_end (&edf_throttled);
+       e = list_next (e))
+    {
+      struct thread *t = list_entry (e, struct thread, elem);
+      printf ("[%s] throttled until %lld\n", t->name, t->dl_deadline);
+    }
+}
+
+const struct sched_class sched_edf =
+  {
+    "edf",
+    edf_init,
+    edf_enqueue,
+    edf_dequeue,
+    edf_pick_next,
+    edf_tick,
+    edf_yield,
+    edf_dump,
+  };
+
+/* Takes T, which is running or exiting, out of the real-time
+   class and releases its bandwidth.  Interrupts must be off. */
+void
+edf_leave (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (t->dl_period == 0)
+    return;
+  edf_bandwidth -= bandwidth (t->dl_runtime, t->dl_period);
+  t->dl_runtime = t->dl_period = 0;
+  t->dl_throttled = false;
+}
+
+/* Makes the running thread a real-time thread that needs RUNTIME
+   timer ticks of CPU every PERIOD ticks, or, if RUNTIME is 0,
+   returns it to the selected scheduling class.  Returns false,
+   changing nothing, if the reservation would take real-time
+   threads past EDF_BANDWIDTH_CAP. */
+bool
+thread_set_deadline (int64_t runtime, int64_t period)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+  int64_t old_bandwidth;
+
+  ASSERT (runtime == 0 || (0 < runtime && runtime <= period));
+
+  old_level = intr_disable ();
+  old_bandwidth = (cur->dl_period > 0
+                   ? bandwidth (cur->dl_runtime, cur->dl_period) : 0);
+  if (runtime > 0)
+    {
+      int64_t runtime_ns = runtime * (1000000000 / TIMER_FREQ);
+      int64_t period_ns = period * (1000000000 / TIMER_FREQ);
+      int64_t new_bandwidth = bandwidth (runtime_ns, period_ns);
+
+      if (edf_bandwidth - old_bandwidth + new_bandwidth > EDF_BANDWIDTH_CAP)
+        {
+          intr_set_level (old_level);
+          return false;
+        }
+      edf_leave (cur);
+      cur->dl_runtime = runtime_ns;
+      cur->dl_period = period_ns;
+      edf_bandwidth += new_bandwidth;
+      cur->exec_start = timer_nanos ();
+      replenish (cur, cur->exec_start);
+    }
+  else
+    edf_leave (cur);
+  intr_set_level (old_level);
+
+  /* Let the scheduler decide anew in the new class. */
+  thread_yield ();
+  return true;
+}
@@ -0,0 +1,213 @@
+#include "threads/sched.h"
+#include <debug.h>
+#include <rbtree.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+
+/* Fair scheduler ("-sched=cfs"), after Linux's Completely Fair
+   Scheduler.
+
+   Each thread accumulates virtual run time: the nanoseconds it
+   has run, scaled down by its weight relative to a thread at
+   PRI_DEFAULT.  Ready threads are kept in a red-black tree
+   ordered by virtual run time, and the one that has had the
+   least runs next, so that over time each thread gets CPU in
+   proportion to its weight.  Picking, queuing, and dequeuing
+   all take O(lg n) time, or O(1) for the pick itself since the
+   tree caches its smallest node.
+
+   Weights come from `priority', including donations: each level
+   better than PRI_DEFAULT is worth about 3 times the CPU of the
+   level below it, like 5 steps of Linux niceness. */
+
+/* Time in which every ready thread should get to run once. */
+#define FAIR_LATENCY_NS 60000000
+
+/* Shortest slice a thread runs before it can be preempted by
+   another, one timer tick. */
+#define FAIR_MIN_GRANULARITY_NS (1000000000 / TIMER_FREQ)
+
+/* Weight of a thread at PRI_DEFAULT. */
+#define FAIR_DEFAULT_WEIGHT 1024
+
+/* Weight of each priority, from Linux's nice -15, -10, -5, 0, 5. */
+static const int prio_to_weight[PRI_MAX + 1] = {29154, 9548, 3121, 1024, 335};
+
+/* Ready threads, by virtual run time. */
+static struct rb_tree fair_tree;
+
+/* Sum of the weights of the threads in fair_tree. */
+static long long fair_load;
+
+/* Lower bound on the virtual run time of every ready or running
+   thread, which only increases.  Threads that wake up or are
+   created start from here, so that they cannot use up a long
+   absence's worth of credit all at once. */
+static int64_t min_vruntime;
+
+static int
+weight (const struct thread *t)
+{
+  ASSERT (PRI_MIN <= t->priority && t->priority <= PRI_MAX);
+  return prio_to_weight[t->priority];
+}
+
+/* rb_less_func that orders threads by virtual run time. */
+static bool
+vruntime_less (const struct rb_node *a_, const struct rb_node *b_,
+               void *aux UNUSED)
+{
+  const struct thread *a = rb_entry (a_, struct thread, run_node);
+  const struct thread *b = rb_entry (b_, struct thread, run_node);
+
+  return a->vruntime < b->vruntime;
+}
+
+/* Returns the ready thread with the least virtual run time, or a
+   null pointer if there is none. */
+static struct thread *
+fair_first (void)
+{
+  struct rb_node *node = rb_first (&fair_tree);
+  return node != NULL ? rb_entry (node, struct thread, run_node) : NULL;
+}
+
+/* Advances min_vruntime to the least virtual run time of CUR,
+   the thread that ran last, and the ready threads. */
+static void
+update_min_vruntime (const struct thread *cur)
+{
+  struct thread *first = fair_first ();
+  int64_t vruntime = cur->vruntime;
+
+  if (first != NULL && first->vruntime < vruntime)
+    vruntime = first->vruntime;
+  if (vruntime > min_vruntime)
+    min_vruntime = vruntime;
+}
+
+/* Charges thread T, which has been running, for its run time
+   since it was last charged. */
+static void
+update_curr (struct thread *t)
+{
+  int64_t now = timer_nanos ();
+  int64_t delta = now - t->exec_start;
+
+  t->exec_start = now;
+  if (delta > 0)
+    t->vruntime += delta * FAIR_DEFAULT_WEIGHT / weight (t);
+  update_min_vruntime (t);
+}
+
+static void
+fair_init (void)
+{
+  rb_init (&fair_tree, vruntime_less, NULL);
+  fair_load = 0;
+  min_vruntime = 0;
+}
+
+/* A thread that slept gets at most half a latency period of
+   credit over the threads that kept running; a new one gets
+   none. */
+static void
+fair_enqueue (struct thread *t, bool wakeup)
+{
+  if (wakeup)
+    {
+      int64_t floor = min_vruntime;
+      if (t->blocked_at >= 0)
+        floor -= FAIR_LATENCY_NS / 2;
+      if (t->vruntime < floor)
+        t->vruntime = floor;
+    }
+  rb_insert (&fair_tree, &t->run_node);
+  fair_load += weight (t);
+}
+
+static void
+fair_dequeue (struct thread *t)
+{
+  rb_remove (&fair_tree, &t->run_node);
+  fair_load -= weight (t);
+}
+
+static struct thread *
+fair_pick_next (struct thread *prev)
+{
+  struct thread *t;
+
+  /* A yielding PREV was charged by fair_yield(), and a dying one
+     no longer matters. */
+  if (prev != NULL && prev->status == THREAD_BLOCKED
+      && !sched_is_idle (prev))
+    update_curr (prev);
+
+  t = fair_first ();
+  if (t == NULL)
+    return NULL;
+  fair_dequeue (t);
+  t->exec_start = timer_nanos ();
+  return t;
+}
+
+/* Preempts CUR once it has had its share of the latency period,
+   or once it is that far ahead of the neediest ready thread.
+   Real-time threads are left to their own class, which charges
+   them through the same `exec_start'. */
+static bool
+fair_tick (struct thread *cur, unsigned slice_ticks)
+{
+  struct thread *first = fair_first ();
+  int64_t ideal, ran;
+
+  if (sched_is_idle (cur))
+    return first != NULL;
+  if (cur->dl_period > 0)
+    return false;
+  update_curr (cur);
+  if (first == NULL)
+    return false;
+
+  ideal = FAIR_LATENCY_NS * weight (cur) / (fair_load + weight (cur));
+  if (ideal < FAIR_MIN_GRANULARITY_NS)
+    ideal = FAIR_MIN_GRANULARITY_NS;
+  ran = (int64_t) slice_ticks * (1000000000 / TIMER_FREQ);
+  return ran >= ideal || cur->vruntime - first->vruntime > ideal;
+}
+
+static void
+fair_yield (struct thread *cur)
+{
+  update_curr (cur);
+  fair_enqueue (cur, false);
+}
+
+/* Prints the ready threads in the order they would run. */
+static void
+fair_dump (void)
+{
+  struct rb_node *node;
+
+  printf ("fair: min_vruntime %lld, load %lld\n", min_vruntime, fair_load);
+  for (node = rb_first (&fair_tree); node != NULL; node = rb_next (node))
+    {
+      struct thread *t = rb_entry (node, struct thread, run_node);
+      printf ("[%s] pri:%d, vruntime:%lld\n", t->name, t->priority,
+              t->vruntime);
+    }
+}
+
+const struct sched_class sched_fair =
+  {
+    "cfs",
+    fair_init,
+    fair_enqueue,
+    fair_dequeue,
+    fair_pick_next,
+    fair_tick,
+    fair_yield,
+    fair_dump,
+  };
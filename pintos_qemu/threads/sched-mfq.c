@@ -0,0 +1,399 @@
+#include "threads/sched.h"
+#include <debug.h>
+#include <list.h>
+#include <stdio.h>
+#include "devices/timer.h"
+#include "threads/interrupt.h"
+#include "threads/smp.h"
+
+/* Aging multilevel feedback queue scheduler, the default.
+
+   Ready threads wait in one of four FIFO queues by `priority',
+   level 0 first.  A thread that uses up its time slice drops a
+   level, and one that waits AGING_THRESHOLD ticks while a higher
+   queue runs moves up a level.  A thread woken after blocking
+   may move up by the wakeup boost policy.
+
+   Each CPU has its own four queues.  A thread is queued on the
+   CPU that last ran it or, if it never ran, on the CPU that made
+   it ready, unless it has affinity for a CPU.  A CPU with nothing
+   left to run steals a thread without affinity from the CPU with
+   the most ready threads rather than going idle. */
+
+/* Feedback queues of one CPU. */
+struct mfq_rq
+  {
+    struct list feedback_queue[MFQ_LEVELS];
+    int current_queue;          /* Level of the running thread. */
+    int nr_ready;               /* # of threads in the queues. */
+  };
+
+/* Feedback queues, indexed by CPU id. */
+static struct mfq_rq mfq_rqs[CPU_MAX];
+
+#define TIME_SLICE_0 4
+#define TIME_SLICE_1 5
+#define TIME_SLICE_2 6
+#define TIME_SLICE_3 7
+
+/* A ready thread moves up one feedback queue after waiting this
+   many ticks while a higher queue runs. */
+#define AGING_THRESHOLD 20
+
+/* Wakeup boost policy of the feedback queues.  A thread made
+   ready by thread_unblock() after blocking moves up
+   thread_boost_levels levels, or straight to level 0 if
+   thread_boost_long_sleep and it was blocked for longer than
+   its level's time slice.  Controlled by kernel command-line
+   options "-boost=N" and "-boost=long". */
+int thread_boost_levels;
+bool thread_boost_long_sleep;
+
+static struct mfq_rq *this_rq (void);
+static struct mfq_rq *home_rq (const struct thread *);
+static struct list *feedback_queue (struct mfq_rq *, int level);
+static void rq_push (struct thread *);
+static unsigned time_slice (int level);
+static void wakeup_boost (struct thread *);
+static void age_queue (struct mfq_rq *, int level);
+static struct thread *stealable (struct mfq_rq *);
+static struct thread *steal (void);
+static void aging (void);
+static int next_queue_to_search (void);
+static void debug_queue (void);
+
+static void
+mfq_init (void)
+{
+  int i, level;
+
+  for (i = 0; i < CPU_MAX; i++)
+    {
+      for (level = 0; level < MFQ_LEVELS; level++)
+        list_init (&mfq_rqs[i].feedback_queue[level]);
+      mfq_rqs[i].current_queue = 0;
+      mfq_rqs[i].nr_ready = 0;
+    }
+}
+
+static void
+mfq_enqueue (struct thread *t, bool wakeup)
+{
+  if(debug) printf("[mfq_enqueue] thread_name : %s, current_pri : %d, t->pri : %d t-> age : %d\n",t->name,this_rq ()->current_queue,t->priority,t->age);
+  if (wakeup)
+    wakeup_boost (t);
+  if (t->cpu == NULL)
+    t->cpu = cpu_current ();
+  rq_push (t);
+}
+
+static void
+mfq_dequeue (struct thread *t)
+{
+  list_remove (&t->elem);
+  home_rq (t)->nr_ready--;
+}
+
+/* Takes the first thread of the highest non-empty queue, or a
+   thread from another CPU if all are empty.  The level it runs
+   at, which decides its time slice and which queues age, is
+   fixed here until it is switched out. */
+static struct thread *
+mfq_pick_next (struct thread *prev UNUSED)
+{
+  struct mfq_rq *rq = this_rq ();
+  struct thread *t;
+  int next_queue = next_queue_to_search();
+
+  if (next_queue >= 0)
+    {
+      t = list_entry (list_pop_front (feedback_queue (rq, next_queue)),
+                      struct thread, elem);
+      rq->nr_ready--;
+      t->cpu = cpu_current ();
+    }
+  else
+    t = steal ();
+  if (t == NULL)
+    {
+      /* The idle thread runs at the top level. */
+      rq->current_queue = PRI_MIN;
+      return NULL;
+    }
+  rq->current_queue = t->priority;
+  t->age = 0;
+  return t;
+}
+
+static bool
+mfq_tick (struct thread *cur UNUSED, unsigned slice_ticks)
+{
+  bool expired = slice_ticks >= time_slice (this_rq ()->current_queue);
+
+  /* increase age of low priority queue */
+  aging();
+  return expired;
+}
+
+/* CUR used up its time slice, or gave up the CPU: demote it one
+   level, but never below what donors give it. */
+static void
+mfq_yield (struct thread *cur)
+{
+  if (cur->base_priority < 3)
+    {
+      cur->base_priority++;
+      cur->stats.demotions++;
+    }
+  thread_refresh_priority (cur);
+  rq_push (cur);
+}
+
+const struct sched_class sched_mfq =
+  {
+    "mfq",
+    mfq_init,
+    mfq_enqueue,
+    mfq_dequeue,
+    mfq_pick_next,
+    mfq_tick,
+    mfq_yield,
+    debug_queue,
+  };
+
+/* increase age of thread which has
+low priority then current thread */
+static void aging(void){
+  struct mfq_rq *rq = this_rq ();
+
+  switch(rq->current_queue){
+    case 0:
+      age_queue (rq, 1);
+      /* Fall through. */
+    case 1:
+      age_queue (rq, 2);
+      /* Fall through. */
+    case 2:
+      age_queue (rq, 3);
+      /* Fall through. */
+    default:
+      break;
+  }
+}
+
+/* Ages every thread in RQ's feedback queue LEVEL by one tick,
+   moving those that reach AGING_THRESHOLD up to queue
+   LEVEL - 1. */
+static void
+age_queue (struct mfq_rq *rq, int level)
+{
+  struct list *queue = feedback_queue (rq, level);
+  struct list_elem *e;
+
+  for (e = list_begin (queue); e != list_end (queue); )
+    {
+      struct thread *t = list_entry (e, struct thread, elem);
+
+      if (++t->age < AGING_THRESHOLD)
+        {
+          e = list_next (e);
+          continue;
+        }
+      if(debug) printf("\033[34m[%s] thread age reaches 20. move fq%d->fq%d\n\033[0m",t->name,level,level-1);
+      sched_charge_wait (t);
+      t->stats.promotions++;
+      t->age = 0;
+      t->priority = t->base_priority = level - 1;
+      e = list_remove (&t->elem);
+      list_push_back (feedback_queue (rq, level - 1), &t->elem);
+    }
+}
+
+/* Applies the wakeup boost policy to T, which is being made
+   ready after blocking.  Threads that never ran are left
+   alone. */
+static void
+wakeup_boost (struct thread *t)
+{
+  int level;
+
+  if (t->blocked_at < 0 || sched_is_idle (t))
+    return;
+
+  level = t->base_priority;
+  if (thread_boost_long_sleep
+      && timer_ticks () - t->blocked_at > time_slice (level))
+    level = 0;
+  else
+    level -= thread_boost_levels;
+  if (level < 0)
+    level = 0;
+
+  if (level < t->base_priority)
+    {
+      t->base_priority = level;
+      t->stats.boosts++;
+      thread_refresh_priority (t);
+    }
+}
+
+/* Returns the time slice, in ticks, of feedback queue LEVEL. */
+static unsigned
+time_slice (int level)
+{
+  switch (level)
+    {
+    case 0:
+      return TIME_SLICE_0;
+    case 1:
+      return TIME_SLICE_1;
+    case 2:
+      return TIME_SLICE_2;
+    default:
+      return TIME_SLICE_3;
+    }
+}
+
+/* Returns the feedback queues of the running CPU. */
+static struct mfq_rq *
+this_rq (void)
+{
+  return &mfq_rqs[cpu_current ()->id];
+}
+
+/* Returns RQ's feedback queue for LEVEL.  Levels past the last
+   queue share it. */
+static struct list *
+feedback_queue (struct mfq_rq *rq, int level)
+{
+  if (level >= MFQ_LEVELS)
+    level = MFQ_LEVELS - 1;
+  return &rq->feedback_queue[level];
+}
+
+/* Returns the feedback queues T waits in when ready: those of
+   the CPU T has affinity for, if any, otherwise those of T->cpu.
+   Neither changes while T is queued. */
+static struct mfq_rq *
+home_rq (const struct thread *t)
+{
+  return &mfq_rqs[(t->affinity != NULL ? t->affinity : t->cpu)->id];
+}
+
+/* Appends T to the feedback queue for its priority on its home
+   CPU.  T may be the running thread, yielding, so T->cpu is left
+   alone: it must keep naming the CPU T runs on until T is
+   switched out, and is updated when T is next picked to run. */
+static void
+rq_push (struct thread *t)
+{
+  struct mfq_rq *rq = home_rq (t);
+
+  list_push_back (feedback_queue (rq, t->priority), &t->elem);
+  rq->nr_ready++;
+}
+
+/* Returns the thread that RQ's CPU can best spare: the last
+   thread without CPU affinity in the lowest non-empty queue,
+   which would wait there the longest.  Returns a null pointer if
+   there is none. */
+static struct thread *
+stealable (struct mfq_rq *rq)
+{
+  int level;
+
+  for (level = MFQ_LEVELS - 1; level >= 0; level--)
+    {
+      struct list *queue = &rq->feedback_queue[level];
+      struct list_elem *e;
+
+      for (e = list_rbegin (queue); e != list_rend (queue);
+           e = list_prev (e))
+        {
+          struct thread *t = list_entry (e, struct thread, elem);
+          if (t->affinity == NULL)
+            return t;
+        }
+    }
+  return NULL;
+}
+
+/* Takes a thread for the running CPU, whose queues are empty,
+   from the CPU with the most ready threads that has one to
+   spare.  Returns a null pointer if there is none. */
+static struct thread *
+steal (void)
+{
+  struct cpu *self = cpu_current ();
+  struct mfq_rq *victim = NULL;
+  struct thread *t = NULL;
+  int i;
+
+  for (i = 0; i < cpu_cnt; i++)
+    {
+      struct mfq_rq *rq = &mfq_rqs[i];
+      struct thread *candidate;
+
+      if (&cpus[i] == self || rq->nr_ready == 0
+          || (victim != NULL && rq->nr_ready <= victim->nr_ready))
+        continue;
+      candidate = stealable (rq);
+      if (candidate != NULL)
+        {
+          victim = rq;
+          t = candidate;
+        }
+    }
+  if (t == NULL)
+    return NULL;
+
+  list_remove (&t->elem);
+  victim->nr_ready--;
+  t->cpu = self;
+  self->steals++;
+  return t;
+}
+
+/* Returns the highest non-empty feedback queue level of the
+   running CPU, or -1 if all are empty. */
+static int next_queue_to_search(void){
+  struct mfq_rq *rq = this_rq ();
+  int level;
+
+  for (level = 0; level < MFQ_LEVELS; level++)
+    if(!list_empty(&rq->feedback_queue[level]))
+      return level;
+  return -1;
+}
+
+static void debug_queue(void){
+  struct list_elem *e;
+  struct thread *t;
+  int i, level;
+  printf("\n");
+  printf("\033[33m========================= Debug Info [MLQ] =========================\033[0m\n");
+  printf("\033[36mCurrent Working Thread: [%s] pri:%d \033[0m\n",thread_current()->name,thread_current()->priority);
+  printf("\033[31mcurrent ticks: %lld \033[0m\n\n",timer_ticks ());
+  for (i = 0; i < cpu_cnt; i++){
+    struct mfq_rq *rq = &mfq_rqs[i];
+    if (cpu_cnt > 1)
+      printf("=============== CPU %d ====================\n", i);
+    for (level = 0; level < MFQ_LEVELS; level++){
+      struct list *queue = &rq->feedback_queue[level];
+      printf("=========== feedback_queue_%d =============\n", level);
+      if(!list_empty(queue)){
+        for (e = list_begin(queue); e != list_end(queue); e = list_next(e))
+          {
+            t = list_entry (e, struct thread, elem);
+            printf("[%s] pri:%d, age : %d \n",t->name,t->priority,t->age);
+          }
+      }else{
+        printf("feedback_queue_%d is empty!\n", level);
+      }
+    }
+  }
+
+  printf("\n");
+  printf("\033[33m========================= Debug End [MLQ] =========================\033[0m\n");
+  printf("\n");
+}
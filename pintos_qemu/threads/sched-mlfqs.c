@@ -0,0 +1,251 @@
+#include "threads/sched.h"
+#include <debug.h>
+#include <list.h>
+#include "devices/timer.h"
+#include "threads/fixed-point.h"
+#include "threads/interrupt.h"
+#include "threads/smp.h"
+
+/* 4.4BSD scheduler ("-mlfqs" or "-sched=mlfqs").
+
+   Priorities run from PRI_MLFQS_MIN to PRI_MLFQS_MAX, higher
+   first, and are derived from each thread's niceness and recent
+   CPU use instead of being set by thread_set_priority(). */
+
+/* Ready queues, one per priority. */
+static struct list mlfqs_queues[PRI_MLFQS_MAX + 1];
+
+/* System load average.  An estimate of the number of threads
+   ready to run over the past minute. */
+static fixed_t load_avg;
+
+#define TIME_SLICE 4            /* # of timer ticks to give each thread. */
+
+/* Priorities are recomputed every MLFQS_PRI_INTERVAL ticks. */
+#define MLFQS_PRI_INTERVAL 4
+
+static void mlfqs_update_priority (struct thread *, void *aux);
+static void mlfqs_update_recent_cpu (struct thread *, void *aux);
+static void count_ready (struct thread *, void *ready_);
+static int mlfqs_highest_ready (void);
+
+static void
+mlfqs_init (void)
+{
+  int i;
+
+  for (i = 0; i <= PRI_MLFQS_MAX; i++)
+    list_init (&mlfqs_queues[i]);
+  load_avg = 0;
+}
+
+static void
+mlfqs_enqueue (struct thread *t, bool wakeup UNUSED)
+{
+  list_push_back (&mlfqs_queues[t->priority], &t->elem);
+}
+
+static void
+mlfqs_dequeue (struct thread *t)
+{
+  list_remove (&t->elem);
+}
+
+static struct thread *
+mlfqs_pick_next (struct thread *prev UNUSED)
+{
+  int priority = mlfqs_highest_ready ();
+
+  if (priority < 0)
+    return NULL;
+  return list_entry (list_pop_front (&mlfqs_queues[priority]),
+                     struct thread, elem);
+}
+
+/* Per-tick bookkeeping for running thread CUR.  The
+   system-wide recomputations are left to the BSP, so that they
+   happen once per tick however many CPUs there are. */
+static bool
+mlfqs_tick (struct thread *cur, unsigned slice_ticks)
+{
+  int64_t now = timer_ticks ();
+  bool preempt = slice_ticks >= TIME_SLICE;
+  bool bsp = cpu_current ()->id == 0;
+
+  if (!sched_is_idle (cur))
+    cur->recent_cpu = fp_add_int (cur->recent_cpu, 1);
+
+  if (bsp && now % TIMER_FREQ == 0)
+    {
+      /* load_avg = (59/60) * load_avg + (1/60) * ready_threads,
+         where running threads count as ready. */
+      int ready_threads = 0;
+
+      thread_foreach (count_ready, &ready_threads);
+      load_avg = fp_add (fp_div_int (fp_mul_int (load_avg, 59), 60),
+                         fp_div_int (fp_from_int (ready_threads), 60));
+      thread_foreach (mlfqs_update_recent_cpu, NULL);
+    }
+
+  if (now % MLFQS_PRI_INTERVAL == 0)
+    {
+      if (bsp)
+        thread_foreach (mlfqs_update_priority, NULL);
+      if (mlfqs_highest_ready () > cur->priority)
+        preempt = true;
+    }
+  return preempt;
+}
+
+static void
+mlfqs_yield (struct thread *cur)
+{
+  list_push_back (&mlfqs_queues[cur->priority], &cur->elem);
+}
+
+const struct sched_class sched_mlfqs =
+  {
+    "mlfqs",
+    mlfqs_init,
+    mlfqs_enqueue,
+    mlfqs_dequeue,
+    mlfqs_pick_next,
+    mlfqs_tick,
+    mlfqs_yield,
+    NULL,
+  };
+
+/* Sets up new thread T: it inherits the niceness and recent CPU
+   use of PARENT, its creator, if not null, and the priority it
+   was created with is ignored. */
+void
+mlfqs_init_thread (struct thread *t, struct thread *parent)
+{
+  if (parent != NULL)
+    {
+      t->nice = parent->nice;
+      t->recent_cpu = parent->recent_cpu;
+    }
+  mlfqs_update_priority (t, NULL);
+}
+
+/* Adds one to *READY_ if T is ready to run or running, other
+   than an idle thread. */
+static void
+count_ready (struct thread *t, void *ready_)
+{
+  int *ready = ready_;
+
+  if (t->status == THREAD_READY
+      || (t->status == THREAD_RUNNING && !sched_is_idle (t)))
+    (*ready)++;
+}
+
+/* Decays T's recent_cpu by the load average:
+   recent_cpu = (2*load_avg)/(2*load_avg + 1) * recent_cpu + nice. */
+static void
+mlfqs_update_recent_cpu (struct thread *t, void *aux UNUSED)
+{
+  fixed_t twice_load = fp_mul_int (load_avg, 2);
+
+  if (sched_is_idle (t))
+    return;
+  t->recent_cpu = fp_add_int (fp_mul (fp_div (twice_load,
+                                              fp_add_int (twice_load, 1)),
+                                      t->recent_cpu),
+                              t->nice);
+}
+
+/* Recomputes T's priority as
+   PRI_MLFQS_MAX - recent_cpu/4 - nice*2, and moves T to its new
+   ready queue if it is ready in one.  A ready real-time thread
+   waits in the EDF lists instead, so it stays where it is. */
+static void
+mlfqs_update_priority (struct thread *t, void *aux UNUSED)
+{
+  int priority;
+
+  if (sched_is_idle (t))
+    return;
+  priority = PRI_MLFQS_MAX - fp_to_int (fp_div_int (t->recent_cpu, 4))
+             - t->nice * 2;
+  if (priority < PRI_MLFQS_MIN)
+    priority = PRI_MLFQS_MIN;
+  else if (priority > PRI_MLFQS_MAX)
+    priority = PRI_MLFQS_MAX;
+
+  if (priority != t->priority && t->status == THREAD_READY
+      && t->dl_period == 0)
+    {
+      sched_charge_wait (t);
+      list_remove (&t->elem);
+      list_push_back (&mlfqs_queues[priority], &t->elem);
+    }
+  t->priority = priority;
+}
+
+/* Returns the priority of the highest-priority ready thread, or
+   -1 if no thread is ready. */
+static int
+mlfqs_highest_ready (void)
+{
+  int priority;
+
+  for (priority = PRI_MLFQS_MAX; priority >= PRI_MLFQS_MIN; priority--)
+    if (!list_empty (&mlfqs_queues[priority]))
+      return priority;
+  return -1;
+}
+
+/* Sets the current thread's nice value to NICE, recomputes its
+   priority, and yields if it no longer has the highest
+   priority. */
+void
+thread_set_nice (int nice)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (NICE_MIN <= nice && nice <= NICE_MAX);
+
+  old_level = intr_disable ();
+  cur->nice = nice;
+  if (thread_mlfqs)
+    {
+      mlfqs_update_priority (cur, NULL);
+      if (mlfqs_highest_ready () > cur->priority)
+        {
+          intr_set_level (old_level);
+          thread_yield ();
+          return;
+        }
+    }
+  intr_set_level (old_level);
+}
+
+/* Returns the current thread's nice value. */
+int
+thread_get_nice (void)
+{
+  return thread_current ()->nice;
+}
+
+/* Returns 100 times the system load average. */
+int
+thread_get_load_avg (void)
+{
+  enum intr_level old_level = intr_disable ();
+  int load = fp_round (fp_mul_int (load_avg, 100));
+  intr_set_level (old_level);
+  return load;
+}
+
+/* Returns 100 times the current thread's recent_cpu value. */
+int
+thread_get_recent_cpu (void)
+{
+  enum intr_level old_level = intr_disable ();
+  int recent = fp_round (fp_mul_int (thread_current ()->recent_cpu, 100));
+  intr_set_level (old_level);
+  return recent;
+}
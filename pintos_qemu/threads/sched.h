@@ -0,0 +1,78 @@
+#ifndef THREADS_SCHED_H
+#define THREADS_SCHED_H
+
+#include <stdbool.h>
+#include "threads/thread.h"
+
+/* A scheduling class: the policy that decides which ready thread
+   runs next.
+
+   thread.c owns thread states and statistics and calls into the
+   selected class, with interrupts off, whenever a thread enters
+   or leaves the ready state.  The class owns the run queue and
+   whatever per-thread fields its policy needs.  The running
+   thread and the idle thread are never on the run queue. */
+struct sched_class
+  {
+    const char *name;                   /* Name for "-sched=NAME". */
+
+    /* Initializes the run queue.  Called once from
+       thread_init(). */
+    void (*init) (void);
+
+    /* Adds T, which is being made ready, to the run queue.
+       WAKEUP is true if T is coming from thread_unblock(), false
+       if it is only being requeued, e.g. after a change of
+       priority. */
+    void (*enqueue) (struct thread *t, bool wakeup);
+
+    /* Removes ready thread T from the run queue. */
+    void (*dequeue) (struct thread *t);
+
+    /* Removes and returns the thread to run next, or returns a
+       null pointer if the run queue is empty.  PREV is the thread
+       giving up the CPU, which is no longer THREAD_RUNNING, if it
+       belongs to this class, or a null pointer. */
+    struct thread *(*pick_next) (struct thread *prev);
+
+    /* Called by the timer interrupt for running thread CUR,
+       which has run for SLICE_TICKS ticks, counting this one,
+       since it was switched in.  Returns true if CUR should be
+       preempted. */
+    bool (*tick) (struct thread *cur, unsigned slice_ticks);
+
+    /* Puts running thread CUR, which is giving up the CPU but
+       stays ready, back on the run queue. */
+    void (*yield) (struct thread *cur);
+
+    /* Prints the run queue, for debugging.  May be null. */
+    void (*dump) (void);
+  };
+
+/* Available scheduling classes. */
+extern const struct sched_class sched_mfq;      /* sched-mfq.c */
+extern const struct sched_class sched_mlfqs;    /* sched-mlfqs.c */
+extern const struct sched_class sched_fair;     /* sched-fair.c */
+
+/* Real-time class, which runs ahead of the selected class.  Its
+   tick is called at every timer tick, whatever the class of the
+   running thread. */
+extern const struct sched_class sched_edf;      /* sched-edf.c */
+
+/* The selected scheduling class. */
+extern const struct sched_class *scheduler;
+
+bool sched_select (const char *name);
+
+/* Services of thread.c for the scheduling classes. */
+bool sched_is_idle (const struct thread *);
+void sched_charge_wait (struct thread *);
+extern bool debug;
+
+/* 4.4BSD class hook for init_thread(). */
+void mlfqs_init_thread (struct thread *, struct thread *parent);
+
+/* Real-time class hook for thread_exit(). */
+void edf_leave (struct thread *);
+
+#endif /* threads/sched.h */
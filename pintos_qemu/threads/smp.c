@@ -0,0 +1,269 @@
+#include "threads/smp.h"
+#include <debug.h>
+#include <stdio.h>
+#include <string.h>
+#include "devices/lapic.h"
+#include "devices/timer.h"
+#include "threads/init.h"
+#include "threads/interrupt.h"
+#include "threads/loader.h"
+#include "threads/profile.h"
+#include "threads/pte.h"
+#include "threads/spinlock.h"
+#include "threads/thread.h"
+#include "threads/vaddr.h"
+
+/* Symmetric multiprocessing ("-smp=N").
+
+   The bootstrap processor (BSP), which runs main(), starts N - 1
+   application processors (APs) through their local APICs.  Each
+   AP runs an idle thread of its own and from then on schedules
+   threads just like the BSP: all CPUs share the thread list and
+   the scheduling class, which may keep a run queue per CPU and
+   move threads between them (see sched-mfq.c).
+
+   The rest of the kernel was written for one CPU, on which
+   turning interrupts off is enough for mutual exclusion.  Rather
+   than revisit all of it, while more than one CPU runs, a CPU
+   holds the kernel lock exactly when it has interrupts off:
+   intr_disable() acquires the lock and intr_enable() releases
+   it, and the interrupt entry and exit paths do the same for
+   interrupts that arrive with interrupts on.  Threads running
+   with interrupts on, which is most of the time for CPU-bound
+   work, run in parallel.
+
+   So SMP here gives correctness on several CPUs, not kernel
+   throughput.  All scheduling, synchronization, and interrupt
+   handling is serialized by the one kernel lock, and only the
+   feedback queue scheduler has a run queue per CPU; the mlfqs,
+   fair, and real-time classes keep one shared queue.  Only
+   threads that mostly compute with interrupts on can be
+   expected to go faster with more CPUs, and how much faster has
+   not been measured.
+
+   Device interrupts still all go to the BSP through the PICs.
+   The APs get only a local APIC timer tick, to drive preemption,
+   and reschedule IPIs, which wake them from idle.
+
+   We do not parse the MP or ACPI tables to find the APs: they
+   are assumed to have local APIC IDs 1...N-1, as under QEMU and
+   Bochs.  User processes are not supported, because the APs have
+   no TSS. */
+
+/* CPUs, the BSP first. */
+struct cpu cpus[CPU_MAX];
+int cpu_cnt = 1;
+
+/* True once more than one CPU may run, from when smp_init()
+   starts the first AP. */
+bool smp_active;
+
+/* The kernel lock. */
+static struct spinlock kernel_lock;
+
+/* Set by the BSP once every AP has started. */
+static volatile bool smp_go;
+
+/* AP startup code in ap-start.S, and its parameters. */
+extern const char ap_start[], ap_start_end[];
+extern uint32_t ap_cr3, ap_esp, ap_entry, ap_arg;
+
+static void ap_main (struct cpu *) NO_RETURN;
+static void set_ap_param (uint32_t *param, uint32_t value);
+static intr_handler_func lapic_timer_interrupt;
+static intr_handler_func resched_interrupt;
+
+/* Returns the running CPU. */
+struct cpu *
+cpu_current (void)
+{
+  if (cpu_cnt == 1)
+    return &cpus[0];
+  return running_thread ()->cpu;
+}
+
+/* Starts CNT - 1 application processors, for CNT CPUs in all.
+   Does nothing if CNT is 1, or if there is no local APIC.
+   Must be called from main() after timer_calibrate(), with
+   interrupts on. */
+void
+smp_init (int cnt)
+{
+  uint32_t *pd = init_page_dir;
+  enum intr_level old_level;
+  int i;
+
+  ASSERT (intr_get_level () == INTR_ON);
+
+  if (cnt <= 1)
+    return;
+  if (cnt > CPU_MAX)
+    {
+      printf ("smp: at most %d CPUs are supported.\n", CPU_MAX);
+      cnt = CPU_MAX;
+    }
+  if (!lapic_init ())
+    {
+      printf ("smp: no local APIC, running on one CPU.\n");
+      return;
+    }
+
+  lapic_init_cpu (true);
+  cpus[0].apic_id = lapic_id ();
+  cpus[0].started = true;
+  lapic_timer_calibrate ();
+  intr_register_ext (LAPIC_TIMER_VEC, lapic_timer_interrupt,
+                     "Local APIC timer");
+  intr_register_ext (LAPIC_RESCHED_VEC, resched_interrupt,
+                     "Reschedule IPI");
+
+  /* Copy the startup code below 1 MB, and map the bottom 4 MB of
+     physical memory at virtual address 0 for it to run at. */
+  memcpy (ptov (AP_START_PADDR), ap_start, ap_start_end - ap_start);
+  pd[0] = pd[pd_no (PHYS_BASE)];
+  asm volatile ("movl %0, %%cr3" : : "r" (vtop (pd)) : "memory");
+
+  /* From here on, interrupts off means holding the kernel
+     lock. */
+  spinlock_init (&kernel_lock, "kernel");
+  old_level = intr_disable ();
+  smp_active = true;
+  kernel_lock_acquire ();
+  intr_set_level (old_level);
+
+  for (i = 1; i < cnt; i++)
+    {
+      struct cpu *c = &cpus[i];
+      struct thread *idle;
+      int ms;
+
+      c->id = i;
+      c->apic_id = i;
+      idle = thread_create_idle (c);
+      if (idle == NULL)
+        PANIC ("smp: out of memory");
+
+      set_ap_param (&ap_cr3, vtop (pd));
+      set_ap_param (&ap_esp, (uint32_t) idle + PGSIZE);
+      set_ap_param (&ap_entry, (uint32_t) ap_main);
+      set_ap_param (&ap_arg, (uint32_t) c);
+
+      /* The AP looks itself up in cpus[] as soon as it runs. */
+      old_level = intr_disable ();
+      cpu_cnt = i + 1;
+      intr_set_level (old_level);
+
+      if (!lapic_start_ap (c->apic_id, AP_START_PADDR))
+        PANIC ("smp: could not send start-up IPI to CPU %d", i);
+      for (ms = 0; !c->started && ms < 100; ms++)
+        timer_mdelay (1);
+      if (!c->started)
+        PANIC ("smp: CPU %d did not start", i);
+    }
+
+  /* Every AP is running kernel code now: remove the low
+     mapping, and let them go. */
+  pd[0] = 0;
+  asm volatile ("movl %0, %%cr3" : : "r" (vtop (pd)) : "memory");
+  smp_go = true;
+
+  printf ("smp: %d CPUs online.\n", cpu_cnt);
+}
+
+/* Stores VALUE into the copy of AP startup parameter PARAM. */
+static void
+set_ap_param (uint32_t *param, uint32_t value)
+{
+  uint8_t *copy = ptov (AP_START_PADDR);
+  *(uint32_t *) (copy + ((char *) param - ap_start)) = value;
+}
+
+/* C entry point of application processor C, called by ap-start.S
+   with interrupts off on the stack of C's idle thread. */
+static void
+ap_main (struct cpu *c)
+{
+  kernel_lock_acquire ();
+  intr_init_ap ();
+  lapic_init_cpu (false);
+  c->started = true;
+
+  /* Wait, with interrupts still off, for the others to start.
+     Nothing else can run on this CPU yet, so it need not hold the
+     kernel lock meanwhile. */
+  kernel_lock_release ();
+  while (!smp_go)
+    asm volatile ("pause");
+  asm volatile ("movl %0, %%cr3" : : "r" (vtop (init_page_dir)) : "memory");
+  kernel_lock_acquire ();
+
+  lapic_timer_start ();
+  thread_run_idle ();
+}
+
+/* Wakes an idle CPU other than the running one, if there is
+   one, to run a thread that has just become ready.  The woken
+   CPU finds work to do when its idle thread reschedules.
+   Interrupts must be off. */
+void
+smp_kick_idle (void)
+{
+  struct cpu *self;
+  int i;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (!smp_active)
+    return;
+  self = cpu_current ();
+  for (i = 0; i < cpu_cnt; i++)
+    {
+      struct cpu *c = &cpus[i];
+      if (c != self && c->started && c->idle_thread != NULL
+          && c->idle_thread->status == THREAD_RUNNING)
+        {
+          lapic_send_ipi (c->apic_id, LAPIC_RESCHED_VEC);
+          return;
+        }
+    }
+}
+
+/* Local APIC timer interrupt handler, for the APs; the BSP's
+   ticks come from the PIT. */
+static void
+lapic_timer_interrupt (struct intr_frame *args)
+{
+  profile_sample (args);
+  thread_tick ();
+}
+
+/* Reschedule IPI handler.  Waking up from `hlt' is all the
+   target needs. */
+static void
+resched_interrupt (struct intr_frame *args UNUSED)
+{
+}
+
+/* Acquires the kernel lock for the running CPU, if more than one
+   CPU may run.  Interrupts must be off. */
+void
+kernel_lock_acquire (void)
+{
+  if (smp_active)
+    spinlock_acquire (&kernel_lock);
+}
+
+/* Releases the kernel lock, if more than one CPU may run. */
+void
+kernel_lock_release (void)
+{
+  if (smp_active)
+    spinlock_release (&kernel_lock);
+}
+
+/* Returns true if the running CPU holds the kernel lock. */
+bool
+kernel_lock_held (void)
+{
+  return smp_active && spinlock_held_by_current_cpu (&kernel_lock);
+}
@@ -0,0 +1,49 @@
+#ifndef THREADS_SMP_H
+#define THREADS_SMP_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct thread;
+
+/* Most CPUs supported. */
+#define CPU_MAX 8
+
+/* Per-CPU state.  Each CPU touches only its own, except for the
+   scheduler's reads of other CPUs' state under the kernel
+   lock. */
+struct cpu
+  {
+    int id;                         /* Index in cpus[], 0 for the BSP. */
+    uint8_t apic_id;                /* Local APIC ID. */
+    struct thread *idle_thread;     /* Runs when nothing else is ready. */
+    unsigned thread_ticks;          /* # of timer ticks since last yield. */
+    bool in_external_intr;          /* Processing an external interrupt? */
+    bool yield_on_return;           /* Yield on interrupt return? */
+    volatile bool started;          /* Finished bring-up? */
+
+    /* Statistics. */
+    long long idle_ticks;           /* # of timer ticks spent idle. */
+    long long busy_ticks;           /* # of timer ticks running threads. */
+    long long steals;               /* # of threads taken from other CPUs. */
+  };
+
+extern struct cpu cpus[CPU_MAX];
+extern int cpu_cnt;
+extern bool smp_active;
+
+struct cpu *cpu_current (void);
+
+void smp_init (int cpu_cnt);
+void smp_kick_idle (void);
+
+/* The kernel lock.  While more than one CPU runs, a CPU holds
+   the kernel lock exactly when its interrupts are off, so that
+   everything that was protected by turning interrupts off stays
+   protected.  intr_disable() and intr_enable() take and release
+   it. */
+void kernel_lock_acquire (void);
+void kernel_lock_release (void);
+bool kernel_lock_held (void);
+
+#endif /* threads/smp.h */
@@ -0,0 +1,79 @@
+#include "threads/spinlock.h"
+#include <debug.h>
+#include <stddef.h>
+#include "threads/interrupt.h"
+#include "threads/smp.h"
+#include "threads/synch.h"
+
+/* Atomically stores NEW in *P and returns the old value.  XCHG
+   with a memory operand is always locked; see [IA32-v2b]
+   "XCHG". */
+static inline uint32_t
+xchg (volatile uint32_t *p, uint32_t new)
+{
+  asm volatile ("xchgl %0, %1" : "+r" (new), "+m" (*p) : : "memory");
+  return new;
+}
+
+/* Initializes LOCK, named NAME for debugging, as not held. */
+void
+spinlock_init (struct spinlock *lock, const char *name)
+{
+  ASSERT (lock != NULL);
+
+  lock->locked = 0;
+  lock->cpu = NULL;
+  lock->name = name;
+}
+
+/* Acquires LOCK, spinning until it is available.  Interrupts
+   must be off, and the current CPU must not already hold
+   LOCK. */
+void
+spinlock_acquire (struct spinlock *lock)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (!spinlock_held_by_current_cpu (lock));
+
+  while (xchg (&lock->locked, 1) != 0)
+    {
+      /* Spin reading, not writing, until the lock looks free,
+         so that waiting CPUs do not bounce its cache line. */
+      while (lock->locked)
+        asm volatile ("pause");
+    }
+  lock->cpu = cpu_current ();
+}
+
+/* Tries to acquire LOCK without spinning.  Returns true if
+   successful, false if LOCK was held.  Interrupts must be
+   off. */
+bool
+spinlock_try_acquire (struct spinlock *lock)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (xchg (&lock->locked, 1) != 0)
+    return false;
+  lock->cpu = cpu_current ();
+  return true;
+}
+
+/* Releases LOCK, which the current CPU must hold. */
+void
+spinlock_release (struct spinlock *lock)
+{
+  ASSERT (spinlock_held_by_current_cpu (lock));
+
+  lock->cpu = NULL;
+  barrier ();
+  lock->locked = 0;
+}
+
+/* Returns true if the current CPU holds LOCK, false
+   otherwise. */
+bool
+spinlock_held_by_current_cpu (const struct spinlock *lock)
+{
+  return lock->locked && lock->cpu == cpu_current ();
+}
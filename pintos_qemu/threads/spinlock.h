@@ -0,0 +1,28 @@
+#ifndef THREADS_SPINLOCK_H
+#define THREADS_SPINLOCK_H
+
+#include <stdbool.h>
+#include <stdint.h>
+
+struct cpu;
+
+/* A spinlock, for mutual exclusion between CPUs.
+
+   A CPU waiting for a spinlock busy-waits instead of sleeping,
+   so spinlocks must be held only briefly, and with interrupts
+   off, so that an interrupt handler on the same CPU cannot spin
+   on a lock that its CPU already holds. */
+struct spinlock
+  {
+    volatile uint32_t locked;   /* Nonzero while held. */
+    struct cpu *cpu;            /* CPU holding the lock (for debugging). */
+    const char *name;           /* Name (for debugging). */
+  };
+
+void spinlock_init (struct spinlock *, const char *name);
+void spinlock_acquire (struct spinlock *);
+bool spinlock_try_acquire (struct spinlock *);
+void spinlock_release (struct spinlock *);
+bool spinlock_held_by_current_cpu (const struct spinlock *);
+
+#endif /* threads/spinlock.h */
@@ -31,6 +31,21 @@
 #include <string.h>
 #include "threads/interrupt.h"
 #include "threads/thread.h"
+#ifdef LOCKSTAT
+#include "devices/timer.h"
+#include "threads/malloc.h"
+#endif
+
+#ifdef LOCKSTAT
+/* Most locks lock_print_stats() reports on. */
+#define LOCKSTAT_TOP 16
+
+/* All named locks. */
+static struct list named_locks = LIST_INITIALIZER (named_locks);
+
+static void lockstat_acquired (struct lock *, int64_t start, bool contended);
+static void lockstat_released (struct lock *);
+#endif
 
 /* Initializes semaphore SEMA to VALUE.  A semaphore is a
    nonnegative integer along with two atomic operators for
@@ -102,7 +117,8 @@ sema_try_down (struct semaphore *sema)
 }
 
 /* Up or "V" operation on a semaphore.  Increments SEMA's value
-   and wakes up one thread of those waiting for SEMA, if any.
+   and wakes up the highest-priority thread of those waiting for
+   SEMA, if any.
 
    This function may be called from an interrupt handler. */
 void
@@ -114,8 +130,12 @@ sema_up (struct semaphore *sema)
 
   old_level = intr_disable ();
   if (!list_empty (&sema->waiters)) 
-    thread_unblock (list_entry (list_pop_front (&sema->waiters),
-                                struct thread, elem));
+    {
+      struct list_elem *e = list_min (&sema->waiters,
+                                      thread_higher_priority, NULL);
+      list_remove (e);
+      thread_unblock (list_entry (e, struct thread, elem));
+    }
   sema->value++;
   intr_set_level (old_level);
 }
@@ -179,12 +199,42 @@ lock_init (struct lock *lock)
 
   lock->holder = NULL;
   sema_init (&lock->semaphore, 1);
+#ifdef LOCKSTAT
+  memset (&lock->stats, 0, sizeof lock->stats);
+#endif
+}
+
+/* Initializes LOCK, like lock_init(), and gives it NAME.  If
+   the kernel is built with LOCKSTAT, statistics are kept for
+   named locks and reported by lock_print_stats(), so LOCK must
+   never be freed. */
+void
+lock_init_named (struct lock *lock, const char *name)
+{
+  ASSERT (name != NULL);
+
+  lock_init (lock);
+#ifdef LOCKSTAT
+  {
+    enum intr_level old_level;
+
+    lock->stats.name = name;
+    old_level = intr_disable ();
+    list_push_back (&named_locks, &lock->stats.elem);
+    intr_set_level (old_level);
+  }
+#endif
 }
 
 /* Acquires LOCK, sleeping until it becomes available if
    necessary.  The lock must not already be held by the current
    thread.
 
+   While waiting, the current thread donates its priority to the
+   holder (and to whatever that holder is waiting on in turn),
+   so a low-level holder cannot keep a high-level waiter behind
+   the whole feedback queue.
+
    This function may sleep, so it must not be called within an
    interrupt handler.  This function may be called with
    interrupts disabled, but interrupts will be turned back on if
@@ -192,12 +242,37 @@ lock_init (struct lock *lock)
 void
 lock_acquire (struct lock *lock)
 {
+  struct thread *cur;
+  enum intr_level old_level;
+#ifdef LOCKSTAT
+  int64_t start = lock->stats.name != NULL ? timer_nanos () : 0;
+  bool contended;
+#endif
+
   ASSERT (lock != NULL);
   ASSERT (!intr_context ());
   ASSERT (!lock_held_by_current_thread (lock));
 
+  cur = thread_current ();
+  old_level = intr_disable ();
+#ifdef LOCKSTAT
+  contended = lock->holder != NULL;
+#endif
+  if (lock->holder != NULL && !thread_mlfqs)
+    {
+      cur->waiting_on = lock;
+      list_push_back (&lock->holder->donors, &cur->donor_elem);
+      thread_donate_priority (cur);
+    }
   sema_down (&lock->semaphore);
-  lock->holder = thread_current ();
+  cur->waiting_on = NULL;
+  lock->holder = cur;
+  if (!thread_mlfqs)
+    thread_adopt_donors (lock);
+#ifdef LOCKSTAT
+  lockstat_acquired (lock, start, contended);
+#endif
+  intr_set_level (old_level);
 }
 
 /* Tries to acquires LOCK and returns true if successful or false
@@ -216,7 +291,14 @@ lock_try_acquire (struct lock *lock)
 
   success = sema_try_down (&lock->semaphore);
   if (success)
-    lock->holder = thread_current ();
+    {
+      lock->holder = thread_current ();
+#ifdef LOCKSTAT
+      enum intr_level old_level = intr_disable ();
+      lockstat_acquired (lock, 0, false);
+      intr_set_level (old_level);
+#endif
+    }
   return success;
 }
 
@@ -224,15 +306,29 @@ lock_try_acquire (struct lock *lock)
 
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to release a lock within an interrupt
-   handler. */
+   handler.
+
+   Gives up any priority donated through LOCK. */
 void
 lock_release (struct lock *lock) 
 {
+  enum intr_level old_level;
+
   ASSERT (lock != NULL);
   ASSERT (lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
+#ifdef LOCKSTAT
+  lockstat_released (lock);
+#endif
+  if (!thread_mlfqs)
+    {
+      thread_remove_donors (lock);
+      thread_refresh_priority (thread_current ());
+    }
   lock->holder = NULL;
   sema_up (&lock->semaphore);
+  intr_set_level (old_level);
 }
 
 /* Returns true if the current thread holds LOCK, false
@@ -246,13 +342,125 @@ lock_held_by_current_thread (const struct lock *lock)
   return lock->holder == thread_current ();
 }
 
+#ifdef LOCKSTAT
+/* Records that LOCK, if named, was just acquired after waiting
+   since START, or without waiting if START is 0, and whether it
+   was CONTENDED.  Interrupts must be off. */
+static void
+lockstat_acquired (struct lock *lock, int64_t start, bool contended)
+{
+  struct lock_stats *s = &lock->stats;
+  int64_t now;
+
+  if (s->name == NULL)
+    return;
+  now = timer_nanos ();
+  s->acquired++;
+  if (contended)
+    s->contended++;
+  if (start != 0)
+    {
+      s->wait_total += now - start;
+      if (now - start > s->wait_max)
+        s->wait_max = now - start;
+    }
+  s->acquired_at = now;
+}
+
+/* Records that LOCK, if named, is being released.  Interrupts
+   must be off. */
+static void
+lockstat_released (struct lock *lock)
+{
+  struct lock_stats *s = &lock->stats;
+  int64_t held;
+
+  if (s->name == NULL)
+    return;
+  held = timer_nanos () - s->acquired_at;
+  s->hold_total += held;
+  if (held > s->hold_max)
+    s->hold_max = held;
+}
+
+/* Returns true if the lock with lock_stats A_ has waited longer
+   in total than the one with B_. */
+static bool
+lockstat_more_wait (const struct list_elem *a_, const struct list_elem *b_,
+                    void *aux UNUSED)
+{
+  const struct lock_stats *a = list_entry (a_, struct lock_stats, elem);
+  const struct lock_stats *b = list_entry (b_, struct lock_stats, elem);
+
+  return a->wait_total > b->wait_total;
+}
+#endif
+
+/* Prints statistics for the named locks that have been waited
+   for longest in total, most first. */
+void
+lock_print_stats (void)
+{
+#ifdef LOCKSTAT
+  struct lock_stats *top;
+  enum intr_level old_level;
+  struct list_elem *e;
+  int cnt, i;
+
+  /* Take a snapshot, since printing takes locks of its own.  It
+     is too big for the stack. */
+  top = malloc (LOCKSTAT_TOP * sizeof *top);
+  if (top == NULL)
+    {
+      printf ("lockstat: out of memory\n");
+      return;
+    }
+  old_level = intr_disable ();
+  list_sort (&named_locks, lockstat_more_wait, NULL);
+  cnt = 0;
+  for (e = list_begin (&named_locks);
+       e != list_end (&named_locks) && cnt < LOCKSTAT_TOP; e = list_next (e))
+    top[cnt++] = *list_entry (e, struct lock_stats, elem);
+  intr_set_level (old_level);
+
+  printf ("%-16s %10s %10s %12s %10s %12s %10s\n", "lock", "acquired",
+          "contended", "wait us", "max us", "hold us", "max us");
+  for (i = 0; i < cnt; i++)
+    {
+      struct lock_stats *s = &top[i];
+      printf ("%-16s %10lld %10lld %12lld %10lld %12lld %10lld\n",
+              s->name, s->acquired, s->contended,
+              s->wait_total / 1000, s->wait_max / 1000,
+              s->hold_total / 1000, s->hold_max / 1000);
+    }
+  free (top);
+#else
+  printf ("Lock statistics are off; rebuild with \"make LOCKSTAT=1\".\n");
+#endif
+}
+
 /* One semaphore in a list. */
 struct semaphore_elem 
   {
     struct list_elem elem;              /* List element. */
     struct semaphore semaphore;         /* This semaphore. */
+    struct thread *thread;              /* Thread waiting on it. */
   };
 
+static void cond_requeue (struct semaphore_elem *, struct lock *);
+
+/* Returns true if the thread waiting on semaphore_elem A_ should
+   be signaled before the one waiting on B_. */
+static bool
+waiter_higher_priority (const struct list_elem *a_,
+                        const struct list_elem *b_, void *aux UNUSED)
+{
+  const struct semaphore_elem *a = list_entry (a_, struct semaphore_elem, elem);
+  const struct semaphore_elem *b = list_entry (b_, struct semaphore_elem, elem);
+
+  return thread_higher_priority (&a->thread->elem, &b->thread->elem, NULL);
+}
+
 /* Initializes condition variable COND.  A condition variable
    allows one piece of code to signal a condition and cooperating
    code to receive the signal and act upon it. */
@@ -295,6 +503,7 @@ cond_wait (struct condition *cond, struct lock *lock)
   ASSERT (lock_held_by_current_thread (lock));
   
   sema_init (&waiter.semaphore, 0);
+  waiter.thread = thread_current ();
   list_push_back (&cond->waiters, &waiter.elem);
   lock_release (lock);
   sema_down (&waiter.semaphore);
@@ -302,7 +511,8 @@ cond_wait (struct condition *cond, struct lock *lock)
 }
 
 /* If any threads are waiting on COND (protected by LOCK), then
-   this function signals one of them to wake up from its wait.
+   this function signals the highest-priority one of them to
+   wake up from its wait.
    LOCK must be held before calling this function.
 
    An interrupt handler cannot acquire a lock, so it does not
@@ -317,22 +527,303 @@ cond_signal (struct condition *cond, struct lock *lock UNUSED)
   ASSERT (lock_held_by_current_thread (lock));
 
   if (!list_empty (&cond->waiters)) 
-    sema_up (&list_entry (list_pop_front (&cond->waiters),
-                          struct semaphore_elem, elem)->semaphore);
+    {
+      struct list_elem *e = list_min (&cond->waiters,
+                                      waiter_higher_priority, NULL);
+      list_remove (e);
+      sema_up (&list_entry (e, struct semaphore_elem, elem)->semaphore);
+    }
 }
 
 /* Wakes up all threads, if any, waiting on COND (protected by
    LOCK).  LOCK must be held before calling this function.
 
+   Only the highest-priority waiter is actually woken.  Each of
+   the others could do nothing but go right back to sleep on
+   LOCK, which we hold, so instead we move it straight onto LOCK's
+   wait list ("wait morphing"), from which lock_release() will
+   wake it once it can make progress.  A broadcast to N waiters
+   thus costs about one wakeup at a time instead of N at once.
+
    An interrupt handler cannot acquire a lock, so it does not
    make sense to try to signal a condition variable within an
    interrupt handler. */
 void
 cond_broadcast (struct condition *cond, struct lock *lock) 
 {
+  enum intr_level old_level;
+
   ASSERT (cond != NULL);
   ASSERT (lock != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (lock_held_by_current_thread (lock));
 
+  old_level = intr_disable ();
+  cond_signal (cond, lock);
   while (!list_empty (&cond->waiters))
-    cond_signal (cond, lock);
+    {
+      struct semaphore_elem *w = list_entry (list_pop_front (&cond->waiters),
+                                             struct semaphore_elem, elem);
+      cond_requeue (w, lock);
+    }
+  intr_set_level (old_level);
+}
+
+/* Moves the thread waiting on W in cond_wait() onto the wait list
+   of LOCK, which the current thread holds, as if it had already
+   woken up and called lock_acquire().  Its semaphore is upped
+   without waking it, so that when lock_release() does wake it,
+   it goes straight on to acquire LOCK.  Interrupts must be
+   off. */
+static void
+cond_requeue (struct semaphore_elem *w, struct lock *lock)
+{
+  struct thread *t = w->thread;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* A waiter that has released LOCK but not yet gone to sleep
+     can only be signaled normally. */
+  if (list_empty (&w->semaphore.waiters))
+    {
+      sema_up (&w->semaphore);
+      return;
+    }
+
+  list_remove (&t->elem);
+  w->semaphore.value++;
+  list_push_back (&lock->semaphore.waiters, &t->elem);
+  if (!thread_mlfqs)
+    {
+      t->waiting_on = lock;
+      list_push_back (&lock->holder->donors, &t->donor_elem);
+      thread_donate_priority (t);
+    }
+}
+
+static void rwlock_hand_off (struct rwlock *);
+
+/* Initializes RW.  A reader-writer lock may be held by any number
+   of readers at once, or by a single writer.
+
+   Writers are preferred: once a writer is waiting, new readers
+   wait too, so a stream of readers cannot starve writers.  When
+   the lock comes free, it is handed directly to the next writer,
+   if any, or otherwise to every waiting reader at once.  Waiting
+   writers get the lock in order of priority if BY_PRIORITY,
+   otherwise in the order they arrived.
+
+   Unlike a lock, a reader-writer lock does not donate priority
+   to its holders. */
+void
+rwlock_init (struct rwlock *rw, bool by_priority)
+{
+  ASSERT (rw != NULL);
+
+  rw->readers = 0;
+  rw->writer = NULL;
+  list_init (&rw->read_waiters);
+  list_init (&rw->write_waiters);
+  rw->by_priority = by_priority;
+}
+
+/* Acquires RW for reading, sleeping while a writer holds it or
+   waits for it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_for_write (rw));
+
+  old_level = intr_disable ();
+  if (rw->writer == NULL && list_empty (&rw->write_waiters))
+    rw->readers++;
+  else
+    {
+      /* rwlock_hand_off() counts us as a reader before it wakes
+         us. */
+      list_push_back (&rw->read_waiters, &thread_current ()->elem);
+      thread_block ();
+    }
+  intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread must hold for reading. */
+void
+rwlock_release_read (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (rw->readers > 0);
+
+  old_level = intr_disable ();
+  if (--rw->readers == 0)
+    rwlock_hand_off (rw);
+  intr_set_level (old_level);
+}
+
+/* Acquires RW for writing, sleeping while anyone else holds it.
+
+   This function may sleep, so it must not be called within an
+   interrupt handler. */
+void
+rwlock_acquire_write (struct rwlock *rw)
+{
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (!intr_context ());
+  ASSERT (!rwlock_held_for_write (rw));
+
+  old_level = intr_disable ();
+  if (rw->writer == NULL && rw->readers == 0)
+    rw->writer = cur;
+  else
+    {
+      list_push_back (&rw->write_waiters, &cur->elem);
+      thread_block ();
+      ASSERT (rw->writer == cur);
+    }
+  intr_set_level (old_level);
+}
+
+/* Releases RW, which the current thread must hold for writing. */
+void
+rwlock_release_write (struct rwlock *rw)
+{
+  enum intr_level old_level;
+
+  ASSERT (rw != NULL);
+  ASSERT (rwlock_held_for_write (rw));
+
+  old_level = intr_disable ();
+  rw->writer = NULL;
+  rwlock_hand_off (rw);
+  intr_set_level (old_level);
+}
+
+/* Returns true if the current thread holds RW for writing.
+   There is no way to tell whether it holds RW for reading. */
+bool
+rwlock_held_for_write (const struct rwlock *rw)
+{
+  ASSERT (rw != NULL);
+
+  return rw->writer == thread_current ();
+}
+
+/* Passes RW, which has just come free, to the next writer, or to
+   every waiting reader if no writer waits. */
+static void
+rwlock_hand_off (struct rwlock *rw)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (rw->writer == NULL && rw->readers == 0);
+
+  if (!list_empty (&rw->write_waiters))
+    {
+      struct list_elem *e;
+
+      if (rw->by_priority)
+        e = list_min (&rw->write_waiters, thread_higher_priority, NULL);
+      else
+        e = list_front (&rw->write_waiters);
+      list_remove (e);
+      rw->writer = list_entry (e, struct thread, elem);
+      thread_unblock (rw->writer);
+    }
+  else
+    while (!list_empty (&rw->read_waiters))
+      {
+        struct list_elem *e = list_pop_front (&rw->read_waiters);
+        rw->readers++;
+        thread_unblock (list_entry (e, struct thread, elem));
+      }
+}
+
+/* Initializes SL.
+
+   A reader of the data SL protects takes no lock.  It notes the
+   sequence number, reads the data, and tries again if a write
+   was under way or happened meanwhile:
+
+     do
+       {
+         seq = seqlock_read_begin (&sl);
+         copy = data;
+       }
+     while (seqlock_read_retry (&sl, seq));
+
+   A writer wraps its update in seqlock_write_begin() and
+   seqlock_write_end().  Reads therefore never block writers, or
+   turn interrupts off, which makes a sequence lock a good fit
+   for a value like a 64-bit tick count that an interrupt handler
+   updates and everyone reads.
+
+   A reader that could interrupt a writer on the same CPU would
+   spin forever, so writers must run with interrupts off. */
+void
+seqlock_init (struct seqlock *sl)
+{
+  ASSERT (sl != NULL);
+
+  sl->seq = 0;
+}
+
+/* Begins a read of the data protected by SL, waiting for any
+   write under way to finish.  Returns the value to pass to
+   seqlock_read_retry(). */
+unsigned
+seqlock_read_begin (const struct seqlock *sl)
+{
+  unsigned seq;
+
+  for (;;)
+    {
+      seq = *(const volatile unsigned *) &sl->seq;
+      if ((seq & 1) == 0)
+        break;
+      asm volatile ("pause");
+    }
+  barrier ();
+  return seq;
+}
+
+/* Returns true if the data protected by SL may have changed since
+   seqlock_read_begin() returned START, in which case the reader
+   must read it again. */
+bool
+seqlock_read_retry (const struct seqlock *sl, unsigned start)
+{
+  barrier ();
+  return *(const volatile unsigned *) &sl->seq != start;
+}
+
+/* Begins a write of the data protected by SL. */
+void
+seqlock_write_begin (struct seqlock *sl)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT ((sl->seq & 1) == 0);
+
+  sl->seq++;
+  barrier ();
+}
+
+/* Ends a write of the data protected by SL. */
+void
+seqlock_write_end (struct seqlock *sl)
+{
+  ASSERT ((sl->seq & 1) == 1);
+
+  barrier ();
+  sl->seq++;
 }
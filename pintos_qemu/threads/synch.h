@@ -17,18 +17,43 @@ bool sema_try_down (struct semaphore *);
 void sema_up (struct semaphore *);
 void sema_self_test (void);
 
+#ifdef LOCKSTAT
+#include <stdint.h>
+
+/* Statistics for a named lock, kept when the kernel is built
+   with LOCKSTAT defined ("make LOCKSTAT=1").  Times are in
+   nanoseconds. */
+struct lock_stats
+  {
+    const char *name;           /* Name, or null if not tracked. */
+    struct list_elem elem;      /* Element in list of named locks. */
+    long long acquired;         /* # of acquisitions. */
+    long long contended;        /* # of those that had to wait. */
+    int64_t wait_total;         /* Time spent waiting to acquire. */
+    int64_t wait_max;           /* Longest wait. */
+    int64_t hold_total;         /* Time held. */
+    int64_t hold_max;           /* Longest hold. */
+    int64_t acquired_at;        /* When last acquired. */
+  };
+#endif
+
 /* Lock. */
 struct lock 
   {
     struct thread *holder;      /* Thread holding lock (for debugging). */
     struct semaphore semaphore; /* Binary semaphore controlling access. */
+#ifdef LOCKSTAT
+    struct lock_stats stats;    /* Contention statistics. */
+#endif
   };
 
 void lock_init (struct lock *);
+void lock_init_named (struct lock *, const char *name);
 void lock_acquire (struct lock *);
 bool lock_try_acquire (struct lock *);
 void lock_release (struct lock *);
 bool lock_held_by_current_thread (const struct lock *);
+void lock_print_stats (void);
 
 /* Condition variable. */
 struct condition 
@@ -41,6 +66,37 @@ void cond_wait (struct condition *, struct lock *);
 void cond_signal (struct condition *, struct lock *);
 void cond_broadcast (struct condition *, struct lock *);
 
+/* Reader-writer lock. */
+struct rwlock
+  {
+    int readers;                /* # of threads holding it to read. */
+    struct thread *writer;      /* Thread holding it to write, or null. */
+    struct list read_waiters;   /* Threads waiting to read. */
+    struct list write_waiters;  /* Threads waiting to write. */
+    bool by_priority;           /* Wake writers by priority, not FIFO? */
+  };
+
+void rwlock_init (struct rwlock *, bool by_priority);
+void rwlock_acquire_read (struct rwlock *);
+void rwlock_release_read (struct rwlock *);
+void rwlock_acquire_write (struct rwlock *);
+void rwlock_release_write (struct rwlock *);
+bool rwlock_held_for_write (const struct rwlock *);
+
+/* Sequence lock, for small values that are read far more often
+   than written.  Writers must exclude each other by other means,
+   such as running with interrupts off. */
+struct seqlock
+  {
+    unsigned seq;               /* Odd while a write is under way. */
+  };
+
+void seqlock_init (struct seqlock *);
+unsigned seqlock_read_begin (const struct seqlock *);
+bool seqlock_read_retry (const struct seqlock *, unsigned start);
+void seqlock_write_begin (struct seqlock *);
+void seqlock_write_end (struct seqlock *);
+
 /* Optimization barrier.
 
    The compiler will not reorder operations across an
@@ -4,10 +4,13 @@
 #include <random.h>
 #include <stdio.h>
 #include <string.h>
+#include "devices/timer.h"
 #include "threads/flags.h"
 #include "threads/interrupt.h"
 #include "threads/intr-stubs.h"
 #include "threads/palloc.h"
+#include "threads/sched.h"
+#include "threads/smp.h"
 #include "threads/switch.h"
 #include "threads/synch.h"
 #include "threads/vaddr.h"
@@ -20,15 +23,6 @@
    of thread.h for details. */
 #define THREAD_MAGIC 0xcd6abf4b
 
-/* List of processes in THREAD_READY state, that is, processes
-   that are ready to run but not actually running. */
-static struct list ready_list;
-static struct list feedback_queue_0;
-static struct list feedback_queue_1;
-static struct list feedback_queue_2;
-static struct list feedback_queue_3;
-static int current_queue;
-
 /* List of all processes.  Processes are added to this list
    when they are first scheduled and removed when they exit. */
 static struct list all_list;
@@ -37,9 +31,6 @@ static struct list all_list;
 static struct list sleep_list;
 static int64_t next_tick_to_wakeup = INT64_MAX;
 
-/* Idle thread. */
-static struct thread *idle_thread;
-
 /* Initial thread, the thread running init.c:main(). */
 static struct thread *initial_thread;
 
@@ -59,18 +50,35 @@ static long long idle_ticks;    /* # of timer ticks spent idle. */
 static long long kernel_ticks;  /* # of timer ticks in kernel threads. */
 static long long user_ticks;    /* # of timer ticks in user programs. */
 
-/* Scheduling. */
-#define TIME_SLICE 4            /* # of timer ticks to give each thread. */
-static unsigned thread_ticks;   /* # of timer ticks since last yield. */
-
-#define TIME_SLICE_0 4
-#define TIME_SLICE_1 5
-#define TIME_SLICE_2 6
-#define TIME_SLICE_3 7
+/* Recycled thread pages.  The pages of exited threads are kept
+   here, up to THREAD_CACHE_SIZE of them, instead of going back
+   to palloc, so that thread_create() can reuse one without
+   zeroing 4 kB and taking the pool lock.  Only the `struct
+   thread' and the frames at the top of the stack are rewritten
+   on reuse.  Accessed with interrupts off. */
+#define THREAD_CACHE_SIZE 16
+static struct thread *thread_cache[THREAD_CACHE_SIZE];
+static size_t thread_cache_cnt;
+static long long thread_cache_hits;   /* # of creations served from cache. */
+static long long thread_cache_misses; /* # of creations from palloc. */
+
+/* Scheduling class in use.  Selected by kernel command-line
+   option "-sched=NAME"; see sched_select(). */
+const struct sched_class *scheduler = &sched_mfq;
+
+/* Scheduling classes that "-sched" can select. */
+static const struct sched_class *const sched_classes[] =
+  {
+    &sched_mfq,
+    &sched_mlfqs,
+    &sched_fair,
+  };
 
-/* If false (default), use round-robin scheduler.
-   If true, use multi-level feedback queue scheduler.
-   Controlled by kernel command-line option "-o mlfqs". */
+/* If false (default), priorities are feedback queue levels.  If
+   true, the 4.4BSD scheduler is in use and derives priorities
+   from niceness and recent CPU use.
+   Controlled by kernel command-line option "-o mlfqs", which is
+   the same as "-sched=mlfqs". */
 bool thread_mlfqs;
 
 /* debug */
@@ -79,7 +87,7 @@ bool debug = false;
 static void kernel_thread (thread_func *, void *aux);
 
 static void idle (void *aux UNUSED);
-static struct thread *running_thread (void);
+static void idle_loop (void) NO_RETURN;
 static struct thread *next_thread_to_run (void);
 static void init_thread (struct thread *, const char *name, int priority);
 static bool is_thread (struct thread *) UNUSED;
@@ -87,6 +95,14 @@ static void *alloc_frame (struct thread *, size_t size);
 static void schedule (void);
 void thread_schedule_tail (struct thread *prev);
 static tid_t allocate_tid (void);
+static struct thread *thread_page_get (void);
+static void thread_page_put (struct thread *);
+
+static const struct sched_class *class_of (const struct thread *);
+static void set_effective_priority (struct thread *, int priority);
+static int stats_level (const struct thread *);
+static void stats_charge_wait (struct thread *, int64_t now);
+static void print_schedstat (struct thread *, void *aux);
 
 /* Initializes the threading system by transforming the code
    that's currently running into a thread.  This can't work in
@@ -106,24 +122,22 @@ thread_init (void)
 {
   ASSERT (intr_get_level () == INTR_OFF);
 
-  lock_init (&tid_lock);
-  list_init (&ready_list);
+  lock_init_named (&tid_lock, "tid");
   list_init (&all_list);
   list_init (&sleep_list);
 
-  list_init(&feedback_queue_0);
-  list_init(&feedback_queue_1);
-  list_init(&feedback_queue_2);
-  list_init(&feedback_queue_3);
+  if (thread_mlfqs)
+    scheduler = &sched_mlfqs;
+  thread_mlfqs = scheduler == &sched_mlfqs;
+  scheduler->init ();
+  sched_edf.init ();
   
   /* Set up a thread structure for the running thread. */
   initial_thread = running_thread ();
   init_thread (initial_thread, "main", PRI_DEFAULT);
   initial_thread->status = THREAD_RUNNING;
   initial_thread->tid = allocate_tid ();
-
-
-  current_queue = 0;
+  initial_thread->cpu = &cpus[0];
 }
 
 /* Starts preemptive thread scheduling by enabling interrupts.
@@ -149,11 +163,13 @@ void
 thread_tick (void) 
 {
   struct thread *t = thread_current ();
+  struct cpu *cpu = cpu_current ();
+  bool edf_preempt, class_preempt;
 
   if(debug) printf("[thread_tick] current_thread : %s, ticks:%d \n",t->name,kernel_ticks);
   
   /* Update statistics. */
-  if (t == idle_thread)
+  if (t == cpu->idle_thread)
     idle_ticks++;
 #ifdef USERPROG
   else if (t->pagedir != NULL)
@@ -161,127 +177,155 @@ thread_tick (void)
 #endif
   else
     kernel_ticks++;
-  
-  /* Enforce preemption. */
-  // if (++thread_ticks >= TIME_SLICE)
-  // intr_yield_on_return ();
-
-  switch(current_queue){
-    case 0:
-      if(++thread_ticks >= TIME_SLICE_0)
-//        debug_queue();
-        intr_yield_on_return();
-      break;
-    case 1:
-      if(++thread_ticks >= TIME_SLICE_1)
-//        debug_queue();
-        intr_yield_on_return();
-      break;
-    case 2:
-      if(++thread_ticks >= TIME_SLICE_2)
-//        debug_queue();
-        intr_yield_on_return();
-      break;
-    case 3:
-      if(++thread_ticks >= TIME_SLICE_3)
-//        debug_queue();
-        intr_yield_on_return();
-      break;
-  }
-
-  /* increase age of low priority queue */
-  aging();  
+  if (t != cpu->idle_thread)
+    {
+      t->stats.run_ticks[stats_level (t)]++;
+      cpu->busy_ticks++;
+    }
+  else
+    cpu->idle_ticks++;
+
+  /* Enforce preemption.  Both classes tick every time, to keep
+     their accounting going, but the selected class only preempts
+     threads of its own. */
+  cpu->thread_ticks++;
+  edf_preempt = sched_edf.tick (t, cpu->thread_ticks);
+  class_preempt = scheduler->tick (t, cpu->thread_ticks);
+  if (edf_preempt || (class_preempt && class_of (t) == scheduler))
+    intr_yield_on_return ();
 }
 
+/* Prints thread statistics. */
+void
+thread_print_stats (void) 
+{
+  printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
+          idle_ticks, kernel_ticks, user_ticks);
+  printf ("Thread pages: %lld recycled, %lld from palloc\n",
+          thread_cache_hits, thread_cache_misses);
+  if (cpu_cnt > 1)
+    {
+      int i;
 
-/* increase age of thread which has 
-low priority then current thread */
-void aging(void){
-  struct list_elem *e;
-  struct thread *t;
-  switch(current_queue){
-    case 0:
-      for (e = list_begin(&feedback_queue_1); e != list_end(&feedback_queue_1);)
-      {
-        t = list_entry (e, struct thread, elem);
-        t->age = t->age + 1;
-        if (t->age >= 20){
-          if(debug) printf("\033[34m[%s] thread age reaches 20. move fq1->fq0\n\033[0m",t->name);
-//          printf("[aging] list_remove[&feedback_queue_1]\n");
-//          printf("e : %p, e->next : %p, e->prev : %p\n",e,e->next,e->prev);
-          t->age = 0;
-          t->priority = 0;
-          list_pop_front(&feedback_queue_1);
-          list_push_back(&feedback_queue_0,&t->elem);
-          e = list_begin(&feedback_queue_1);
-          if(list_empty(&feedback_queue_1)){
-            break;  
-          }
-        }else{
-          e = list_next(e);
-        }
-      }
-    case 1:
-      for (e = list_begin(&feedback_queue_2); e != list_end(&feedback_queue_2);)
-      {
-        t = list_entry (e, struct thread, elem);
-        t->age = t->age + 1;
-        if (t->age >= 20){
-          if(debug) printf("\033[34m[%s] thread age reaches 20. move fq2->fq1\n\033[0m",t->name);
-//          printf("[aging] list_remove[&feedback_queue_2]\n");
-//          printf("e : %p, e->next : %p, e->prev : %p\n",e,e->next,e->prev);
-          t->age = 0;
-          t->priority = 1;
-          list_pop_front(&feedback_queue_2);
-          list_push_back(&feedback_queue_1,&t->elem);
-          e = list_begin(&feedback_queue_2);
-          if(list_empty(&feedback_queue_2)){
-            break;
-          }
-        }else{
-          e = list_next(e);
-        }
-      }
+      for (i = 0; i < cpu_cnt; i++)
+        printf ("CPU %d: %lld idle ticks, %lld busy ticks, %lld steals\n",
+                i, cpus[i].idle_ticks, cpus[i].busy_ticks, cpus[i].steals);
+    }
+}
 
-    case 2:
-      for (e = list_begin(&feedback_queue_3); e != list_end(&feedback_queue_3);)
-      {
-        t = list_entry (e, struct thread, elem);
-        t->age = t->age + 1;
-//        printf("[%s] age: %d  e: %p\n",t->name,t->age,e);
-        if (t->age >= 20){
-          if(debug) printf("\033[34m[%s] thread age reaches 20. move fq3->fq2\n\033[0m",t->name);
-//          printf("[aging] list_remove[&feedback_queue_3]\n");
-//          printf("e : %p, e->next : %p, e->prev : %p\n",e,e->next,e->prev);
-          t->age = 0;
-          t->priority = 2;
-          list_pop_front(&feedback_queue_3);
-//          printf("e : %p, e->next : %p, e->prev : %p\n",e,e->next,e->prev);
-          list_push_back(&feedback_queue_2,&t->elem);
-//          printf("e : %p, e->next : %p, e->prev : %p\n",e,e->next,e->prev);
-          e = list_begin(&feedback_queue_3);
-//          printf("e : %p, e->next : %p, e->prev : %p\n",e,e->next,e->prev);
-          if(list_empty(&feedback_queue_3)){
-            break;
-          }
-        }else{
-          e = list_next(e);
-        }
-      }
-    default:
-      break;
-  }
+/* Prints every thread's scheduler statistics, one line each. */
+void
+thread_print_schedstats (void) 
+{
+  enum intr_level old_level;
+  int64_t now;
 
-//  printf("[aging] finish\n");
+  printf ("%4s %-16s %3s %10s %10s %6s %6s %5s %5s %5s  "
+          "%9s %9s %9s %9s  %6s %6s %6s %6s\n",
+          "tid", "name", "lvl", "run_ms", "wait_ms", "vol", "invol",
+          "promo", "demo", "boost", "wait0_ms", "wait1_ms", "wait2_ms", "wait3_ms",
+          "tick0", "tick1", "tick2", "tick3");
+  old_level = intr_disable ();
+  now = timer_nanos ();
+  thread_foreach (print_schedstat, &now);
+  intr_set_level (old_level);
 }
 
+/* Prints T's line of thread_print_schedstats(), as of the time
+   pointed to by NOW_. */
+static void
+print_schedstat (struct thread *t, void *now_)
+{
+  const struct sched_stats *st = &t->stats;
+  int64_t now = *(int64_t *) now_;
+  int64_t run_ns = st->run_ns;
+  int64_t wait_ns[MFQ_LEVELS];
+  int64_t total_wait_ns = 0;
+  int i;
+
+  for (i = 0; i < MFQ_LEVELS; i++)
+    wait_ns[i] = st->wait_ns[i];
+  if (t->status == THREAD_RUNNING)
+    run_ns += now - st->run_since;
+  else if (t->status == THREAD_READY)
+    wait_ns[stats_level (t)] += now - st->ready_since;
+  for (i = 0; i < MFQ_LEVELS; i++)
+    total_wait_ns += wait_ns[i];
+
+  printf ("%4d %-16s %3d %10lld %10lld %6u %6u %5u %5u %5u  "
+          "%9lld %9lld %9lld %9lld  %6u %6u %6u %6u\n",
+          t->tid, t->name, stats_level (t),
+          run_ns / 1000000, total_wait_ns / 1000000,
+          st->voluntary, st->involuntary, st->promotions, st->demotions,
+          st->boosts,
+          wait_ns[0] / 1000000, wait_ns[1] / 1000000,
+          wait_ns[2] / 1000000, wait_ns[3] / 1000000,
+          st->run_ticks[0], st->run_ticks[1],
+          st->run_ticks[2], st->run_ticks[3]);
+  if (t->dl_period > 0)
+    printf ("%4s %-16s edf: runtime %lld us, period %lld us, "
+            "%u deadline misses\n", "", "", t->dl_runtime / 1000,
+            t->dl_period / 1000, t->dl_misses);
+}
 
-/* Prints thread statistics. */
+/* Returns the level under which T's statistics are kept. */
+static int
+stats_level (const struct thread *t)
+{
+  if (thread_mlfqs)
+    return (PRI_MLFQS_MAX - t->priority) * MFQ_LEVELS / (PRI_MLFQS_MAX + 1);
+  return t->priority < MFQ_LEVELS ? t->priority : MFQ_LEVELS - 1;
+}
+
+/* Charges the time ready thread T has waited at its current
+   level until now.  Called by scheduling classes that move a
+   ready thread between levels themselves. */
 void
-thread_print_stats (void) 
+sched_charge_wait (struct thread *t)
 {
-  printf ("Thread: %lld idle ticks, %lld kernel ticks, %lld user ticks\n",
-          idle_ticks, kernel_ticks, user_ticks);
+  stats_charge_wait (t, timer_nanos ());
+}
+
+/* Returns true if T is the idle thread of some CPU. */
+bool
+sched_is_idle (const struct thread *t)
+{
+  return t->cpu != NULL && t == t->cpu->idle_thread;
+}
+
+/* Returns the scheduling class of T: the real-time class if T
+   has a reservation, otherwise the selected class. */
+static const struct sched_class *
+class_of (const struct thread *t)
+{
+  return t->dl_period > 0 ? &sched_edf : scheduler;
+}
+
+/* Selects the scheduling class named NAME for thread_init() to
+   use.  Returns false if there is no such class. */
+bool
+sched_select (const char *name)
+{
+  size_t i;
+
+  for (i = 0; i < sizeof sched_classes / sizeof *sched_classes; i++)
+    if (!strcmp (name, sched_classes[i]->name))
+      {
+        scheduler = sched_classes[i];
+        thread_mlfqs = scheduler == &sched_mlfqs;
+        return true;
+      }
+  return false;
+}
+
+/* Charges the time ready thread T has waited at its current
+   level since it was last made ready or charged, and restarts
+   the wait from NOW.  Called when T leaves its ready queue. */
+static void
+stats_charge_wait (struct thread *t, int64_t now)
+{
+  t->stats.wait_ns[stats_level (t)] += now - t->stats.ready_since;
+  t->stats.ready_since = now;
 }
 
 /* Creates a new kernel thread named NAME with the given initial
@@ -296,9 +340,9 @@ thread_print_stats (void)
    scheduled.  Use a semaphore or some other form of
    synchronization if you need to ensure ordering.
 
-   The code provided sets the new thread's `priority' member to
-   PRIORITY, but no actual priority scheduling is implemented.
-   Priority scheduling is the goal of Problem 1-3. */
+   PRIORITY is the feedback queue level the new thread starts
+   in.  Under -mlfqs it is ignored, since the 4.4BSD scheduler
+   computes priorities itself. */
 tid_t
 thread_create (const char *name, int priority,
                thread_func *function, void *aux) 
@@ -313,7 +357,7 @@ thread_create (const char *name, int priority,
   ASSERT (function != NULL);
 
   /* Allocate thread. */
-  t = palloc_get_page (PAL_ZERO);
+  t = thread_page_get ();
   if (t == NULL)
     return TID_ERROR;
   /* Initialize thread. */
@@ -357,6 +401,7 @@ thread_block (void)
   }
 
   thread_current ()->status = THREAD_BLOCKED;
+  thread_current ()->blocked_at = timer_ticks ();
   schedule ();
 }
 
@@ -372,33 +417,17 @@ void
 thread_unblock (struct thread *t) 
 {
 //  printf("[%s] thread_unblock call\n",thread_name);
-  if(debug) printf("[thread_unblock] thread_name : %s, current_pri : %d, t->pri : %d t-> age : %d\n",t->name,current_queue,t->priority,t->age);
   enum intr_level old_level;
 
   ASSERT (is_thread (t));
 
   old_level = intr_disable ();
   ASSERT (t->status == THREAD_BLOCKED);
-  // list_push_back (&ready_list, &t->elem);
-  switch(t->priority){
-    case 0:
-      list_push_back(&feedback_queue_0,&t->elem);
-      break;
-    case 1:
-      list_push_back(&feedback_queue_1,&t->elem);
-      break;
-    case 2:
-      list_push_back(&feedback_queue_2,&t->elem);
-      break;
-    case 3:
-      list_push_back(&feedback_queue_3,&t->elem);
-      break;
-    default:
-      ASSERT(thread_get_priority()<4);
-      break;    
-  }
+  class_of (t)->enqueue (t, true);
 
   t->status = THREAD_READY;
+  t->stats.ready_since = t->stats.woken_at = timer_nanos ();
+  smp_kick_idle ();
   intr_set_level (old_level);
 }
 
@@ -407,7 +436,7 @@ update_next_tick_to_wakeup (int64_t tick)
 {
   next_tick_to_wakeup = 
     (next_tick_to_wakeup > tick) ? tick : next_tick_to_wakeup;
-  printf("[update_next_tick_to_wakeup] next_tick_to_wakeup = %d thread_name = %s\n",next_tick_to_wakeup,thread_name);
+  if(debug) printf("[update_next_tick_to_wakeup] next_tick_to_wakeup = %d thread_name = %s\n",next_tick_to_wakeup,thread_name);
 }
 
 int64_t
@@ -427,30 +456,12 @@ thread_sleep (int64_t tick)
   old_level = intr_disable ();
   cur = thread_current ();
 
-  ASSERT (cur != idle_thread);
+  ASSERT (!sched_is_idle (cur));
 
   update_next_tick_to_wakeup (cur->wakeup_tick = tick);
   list_push_back (&sleep_list, &cur->elem);
 
-  // if thread blocked then priority increase
-  // switch(thread_get_priority()){
-  //   case 0:
-  //     list_push_back(&feedback_queue_0,&cur->elem);
-  //     break;
-  //   case 1:
-  //     list_push_back(&feedback_queue_0,&cur->elem);
-  //     break;
-  //   case 2:
-  //     list_push_back(&feedback_queue_1,&cur->elem);
-  //     break;
-  //   case 3:
-  //     list_push_back(&feedback_queue_2,&cur->elem);
-  //     break;
-  //   default:
-  //     ASSERT(thread_get_priority()<4);
-  //     break;    
-  // }
-
+  /* The wakeup boost, if any, is applied by thread_unblock(). */
   thread_block ();
 
   intr_set_level (old_level);
@@ -529,6 +540,7 @@ thread_exit (void)
      and schedule another process.  That process will destroy us
      when it calls thread_schedule_tail(). */
   intr_disable ();
+  edf_leave (thread_current ());
   list_remove (&thread_current()->allelem);
   thread_current ()->status = THREAD_DYING;
   schedule ();
@@ -547,27 +559,10 @@ thread_yield (void)
   ASSERT (!intr_context ());
 
   old_level = intr_disable ();
-  if (cur != idle_thread){
-    // list_push_back (&ready_list, &cur->elem);
-    switch(cur->priority){
-      case 0:
-        cur->priority = cur->priority + 1;
-        list_push_back(&feedback_queue_1, &cur->elem);
-        break;
-      case 1:
-        cur->priority = cur->priority + 1;
-        list_push_back(&feedback_queue_2, &cur->elem);
-        break;
-      case 2:
-        cur->priority = cur->priority + 1;
-        list_push_back(&feedback_queue_3, &cur->elem);
-        break;
-      case 3:
-        list_push_back(&feedback_queue_3, &cur->elem);
-        break;
-    }
-  }
+  if (!sched_is_idle (cur))
+    class_of (cur)->yield (cur);
   cur->status = THREAD_READY;
+  cur->stats.ready_since = timer_nanos ();
   schedule ();
   intr_set_level (old_level);
 }
@@ -589,67 +584,240 @@ thread_foreach (thread_action_func *func, void *aux)
     }
 }
 
-/* Sets the current thread's priority to NEW_PRIORITY. */
+/* Sets the current thread's priority to NEW_PRIORITY.  Ignored
+   under the 4.4BSD scheduler, which computes priorities itself. */
 void
 thread_set_priority (int new_priority) 
 {
-  thread_current ()->priority = new_priority;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  if (thread_mlfqs)
+    return;
+
+  old_level = intr_disable ();
+  cur->base_priority = new_priority;
+  thread_refresh_priority (cur);
+  intr_set_level (old_level);
 }
 
-/* Returns the current thread's priority. */
-int
-thread_get_priority (void) 
+/* Restricts the running thread to running on CPU, an index in
+   cpus[], or lets it run on any CPU again if CPU is -1.  Only the
+   feedback queue scheduler, which has a run queue per CPU,
+   honors affinity. */
+void
+thread_set_affinity (int cpu)
 {
-  return thread_current ()->priority;
+  struct thread *cur = thread_current ();
+  enum intr_level old_level;
+
+  ASSERT (cpu >= -1 && cpu < cpu_cnt);
+
+  old_level = intr_disable ();
+  cur->affinity = cpu >= 0 ? &cpus[cpu] : NULL;
+  intr_set_level (old_level);
+
+  /* Move to the new CPU. */
+  if (cur->affinity != NULL && cur->affinity != cur->cpu)
+    thread_yield ();
 }
 
-/* Sets the current thread's nice value to NICE. */
+/* list_less_func that orders threads by priority: returns true
+   if the thread owning A_ should run before the one owning B_.
+   Real-time threads come first, earliest deadline first.  Then,
+   under the feedback queues a lower level runs first; under the
+   4.4BSD scheduler a higher priority does.  With list_min(),
+   picks the thread to wake first, FIFO among equals. */
+bool
+thread_higher_priority (const struct list_elem *a_,
+                        const struct list_elem *b_, void *aux UNUSED)
+{
+  const struct thread *a = list_entry (a_, struct thread, elem);
+  const struct thread *b = list_entry (b_, struct thread, elem);
+
+  if (a->dl_period > 0 || b->dl_period > 0)
+    return b->dl_period == 0 || (a->dl_period > 0
+                                 && a->dl_deadline < b->dl_deadline);
+  if (thread_mlfqs)
+    return a->priority > b->priority;
+  return a->priority < b->priority;
+}
+
+/* Donates DONOR's priority along the chain of lock holders it
+   is waiting behind, up to DONATION_DEPTH_MAX locks deep.  Each
+   holder is boosted to DONOR's feedback queue level until it
+   releases the lock.  Interrupts must be off. */
 void
-thread_set_nice (int nice UNUSED) 
+thread_donate_priority (struct thread *donor)
 {
-  /* Not yet implemented. */
+  struct thread *t = donor;
+  int depth;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  if (thread_mlfqs)
+    return;
+
+  for (depth = 0; depth < DONATION_DEPTH_MAX; depth++)
+    {
+      struct thread *holder;
+
+      if (t->waiting_on == NULL)
+        break;
+      holder = t->waiting_on->holder;
+      if (holder == NULL || holder->priority <= t->priority)
+        break;
+      set_effective_priority (holder, t->priority);
+      t = holder;
+    }
 }
 
-/* Returns the current thread's nice value. */
-int
-thread_get_nice (void) 
+/* Drops the donations that the running thread received from
+   threads waiting on LOCK, which it is about to release.
+   Interrupts must be off. */
+void
+thread_remove_donors (struct lock *lock)
+{
+  struct thread *cur = thread_current ();
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&cur->donors); e != list_end (&cur->donors); )
+    {
+      struct thread *donor = list_entry (e, struct thread, donor_elem);
+      if (donor->waiting_on == lock)
+        e = list_remove (e);
+      else
+        e = list_next (e);
+    }
+}
+
+/* Makes the threads still waiting on LOCK, which the running
+   thread has just acquired, donate to it instead of to the
+   previous holder, which dropped them in lock_release().
+   Interrupts must be off. */
+void
+thread_adopt_donors (struct lock *lock)
 {
-  /* Not yet implemented. */
-  return 0;
+  struct thread *cur = thread_current ();
+  struct list *waiters = &lock->semaphore.waiters;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (waiters); e != list_end (waiters); e = list_next (e))
+    {
+      struct thread *waiter = list_entry (e, struct thread, elem);
+      if (waiter->waiting_on == lock)
+        list_push_back (&cur->donors, &waiter->donor_elem);
+    }
+  thread_refresh_priority (cur);
 }
 
-/* Returns 100 times the system load average. */
-int
-thread_get_load_avg (void) 
+/* Recomputes T's effective priority as the best of its base
+   priority and its donors' priorities.  Interrupts must be
+   off. */
+void
+thread_refresh_priority (struct thread *t)
 {
-  /* Not yet implemented. */
-  return 0;
+  int priority = t->base_priority;
+  struct list_elem *e;
+
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  for (e = list_begin (&t->donors); e != list_end (&t->donors);
+       e = list_next (e))
+    {
+      struct thread *donor = list_entry (e, struct thread, donor_elem);
+      if (donor->priority < priority)
+        priority = donor->priority;
+    }
+  set_effective_priority (t, priority);
 }
 
-/* Returns 100 times the current thread's recent_cpu value. */
+/* Sets T's effective priority to PRIORITY, requeuing T if it is
+   ready to run. */
+static void
+set_effective_priority (struct thread *t, int priority)
+{
+  if (t->priority == priority)
+    return;
+  if (t->status == THREAD_READY)
+    {
+      stats_charge_wait (t, timer_nanos ());
+      class_of (t)->dequeue (t);
+      t->priority = priority;
+      class_of (t)->enqueue (t, false);
+    }
+  else
+    t->priority = priority;
+}
+
+/* Returns the current thread's priority. */
 int
-thread_get_recent_cpu (void) 
+thread_get_priority (void) 
 {
-  /* Not yet implemented. */
-  return 0;
+  return thread_current ()->priority;
 }
-
+
 /* Idle thread.  Executes when no other thread is ready to run.
 
    The idle thread is initially put on the ready list by
    thread_start().  It will be scheduled once initially, at which
-   point it initializes idle_thread, "up"s the semaphore passed
-   to it to enable thread_start() to continue, and immediately
-   blocks.  After that, the idle thread never appears in the
-   ready list.  It is returned by next_thread_to_run() as a
-   special case when the ready list is empty. */
+   point it initializes the CPU's idle_thread, "up"s the
+   semaphore passed to it to enable thread_start() to continue,
+   and immediately blocks.  After that, the idle thread never
+   appears in the ready list.  It is returned by
+   next_thread_to_run() as a special case when the ready list is
+   empty. */
 static void
 idle (void *idle_started_ UNUSED) 
 {
   struct semaphore *idle_started = idle_started_;
-  idle_thread = thread_current ();
+  cpu_current ()->idle_thread = thread_current ();
   sema_up (idle_started);
+  idle_loop ();
+}
 
+/* Makes a page into the idle thread of application processor
+   CPU, which starts up on the page's stack and then calls
+   thread_run_idle().  Returns the thread, or a null pointer if
+   memory is exhausted. */
+struct thread *
+thread_create_idle (struct cpu *cpu)
+{
+  struct thread *t = palloc_get_page (PAL_ZERO);
+  char name[16];
+
+  if (t == NULL)
+    return NULL;
+  snprintf (name, sizeof name, "idle%d", cpu->id);
+  init_thread (t, name, PRI_MIN);
+  t->tid = allocate_tid ();
+  t->status = THREAD_RUNNING;
+  t->stats.run_since = timer_nanos ();
+  t->cpu = cpu;
+  cpu->idle_thread = t;
+  return t;
+}
+
+/* Runs the idle loop in the running thread, the idle thread of
+   an application processor.  Interrupts must be off. */
+void
+thread_run_idle (void)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+  ASSERT (thread_current () == cpu_current ()->idle_thread);
+
+  idle_loop ();
+}
+
+/* Blocks the idle thread, and halts until the next interrupt
+   whenever it runs, forever. */
+static void
+idle_loop (void)
+{
   for (;;) 
     {
       /* Let someone else run. */
@@ -667,7 +835,10 @@ idle (void *idle_started_ UNUSED)
          time.
 
          See [IA32-v2a] "HLT", [IA32-v2b] "STI", and [IA32-v3a]
-         7.11.1 "HLT Instruction". */
+         7.11.1 "HLT Instruction".
+
+         Interrupts coming on means dropping the kernel lock. */
+      kernel_lock_release ();
       asm volatile ("sti; hlt" : : : "memory");
     }
 }
@@ -683,7 +854,8 @@ kernel_thread (thread_func *function, void *aux)
   thread_exit ();       /* If function() returns, kill the thread. */
 }
 
-/* Returns the running thread. */
+/* Returns the running thread, without checking it, which is
+   safe even while the thread is being set up. */
 struct thread *
 running_thread (void) 
 {
@@ -709,8 +881,7 @@ is_thread (struct thread *t)
 static void
 init_thread (struct thread *t, const char *name, int priority)
 {
-  printf("[init_thread] pri: %d\n",priority);
-  printf("[init_thread] name : %s, pri : %d\n",name,priority);
+  if(debug) printf("[init_thread] name : %s, pri : %d\n",name,priority);
   enum intr_level old_level;
 
   ASSERT (t != NULL);
@@ -721,14 +892,62 @@ init_thread (struct thread *t, const char *name, int priority)
   t->status = THREAD_BLOCKED;
   strlcpy (t->name, name, sizeof t->name);
   t->stack = (uint8_t *) t + PGSIZE;
-  t->priority = priority;
+  t->priority = t->base_priority = priority;
+  t->blocked_at = -1;
+  list_init (&t->donors);
   t->magic = THREAD_MAGIC;
 
+  if (thread_mlfqs)
+    {
+      struct thread *parent = running_thread ();
+      mlfqs_init_thread (t, parent != t && is_thread (parent) ? parent : NULL);
+    }
+
   old_level = intr_disable ();
   list_push_back (&all_list, &t->allelem);
   intr_set_level (old_level);
 }
 
+/* Returns a page for a new thread, recycled from an exited
+   thread if possible, or a null pointer if memory is exhausted.
+   The page is not zeroed: init_thread() initializes the `struct
+   thread' and the stack needs no initialization. */
+static struct thread *
+thread_page_get (void)
+{
+  struct thread *t = NULL;
+  enum intr_level old_level;
+
+  old_level = intr_disable ();
+  if (thread_cache_cnt > 0)
+    {
+      t = thread_cache[--thread_cache_cnt];
+      thread_cache_hits++;
+    }
+  else
+    thread_cache_misses++;
+  intr_set_level (old_level);
+
+  if (t == NULL)
+    t = palloc_get_page (0);
+  return t;
+}
+
+/* Releases the page of exited thread T, keeping it for reuse
+   unless the cache is full.  Interrupts must be off. */
+static void
+thread_page_put (struct thread *t)
+{
+  ASSERT (intr_get_level () == INTR_OFF);
+
+  /* Stale pointers to T must not pass is_thread(). */
+  t->magic = 0;
+  if (thread_cache_cnt < THREAD_CACHE_SIZE)
+    thread_cache[thread_cache_cnt++] = t;
+  else
+    palloc_free_page (t);
+}
+
 /* Allocates a SIZE-byte frame at the top of thread T's stack and
    returns a pointer to the frame's base. */
 static void *
@@ -742,55 +961,22 @@ alloc_frame (struct thread *t, size_t size)
   return t->stack;
 }
 
-int next_queue_to_search(void){
-  switch (0)
-  {
-  case 0:
-    if(!list_empty(&feedback_queue_0))
-      return 0;
-  case 1:
-    if(!list_empty(&feedback_queue_1))
-      return 1;
-  case 2:
-    if(!list_empty(&feedback_queue_2))
-      return 2;
-  case 3:
-    if(!list_empty(&feedback_queue_3))
-      return 3;
-  default:
-    break;
-  }
-  return -1;
-
-}
-
 /* Chooses and returns the next thread to be scheduled.  Should
    return a thread from the run queue, unless the run queue is
    empty.  (If the running thread can continue running, then it
    will be in the run queue.)  If the run queue is empty, return
-   idle_thread. */
+   the CPU's idle thread. */
 static struct thread *
 next_thread_to_run (void) 
 {
-  int next_queue = next_queue_to_search();
-  switch (next_queue)
-  {
-  case -1:
-    return idle_thread;
-  case 0:
-    return list_entry (list_pop_front (&feedback_queue_0), struct thread, elem);
-  case 1:
-    return list_entry (list_pop_front (&feedback_queue_1), struct thread, elem);
-  case 2:
-    return list_entry (list_pop_front (&feedback_queue_2), struct thread, elem);
-  case 3:
-    return list_entry (list_pop_front (&feedback_queue_3), struct thread, elem);
-  }
-
-  // if (list_empty (&ready_list))
-  //   return idle_thread;
-  // else
-  //   return list_entry (list_pop_front (&ready_list), struct thread, elem);
+  struct thread *prev = running_thread ();
+  const struct sched_class *class = class_of (prev);
+  struct thread *next;
+
+  next = sched_edf.pick_next (class == &sched_edf ? prev : NULL);
+  if (next == NULL)
+    next = scheduler->pick_next (class == scheduler ? prev : NULL);
+  return next != NULL ? next : cpu_current ()->idle_thread;
 }
 
 /* Completes a thread switch by activating the new thread's page
@@ -813,15 +999,30 @@ void
 thread_schedule_tail (struct thread *prev)
 {
   struct thread *cur = running_thread ();
+  int64_t now = timer_nanos ();
   
   ASSERT (intr_get_level () == INTR_OFF);
 
+  /* Account for the switch.  If there was none (PREV is null),
+     CUR simply keeps running, unless it is the idle thread
+     rescheduling itself. */
+  if (prev != NULL && prev->status != THREAD_DYING)
+    {
+      prev->stats.run_ns += now - prev->stats.run_since;
+      if (prev->status == THREAD_BLOCKED)
+        prev->stats.voluntary++;
+      else
+        prev->stats.involuntary++;
+    }
+  if (cur->status == THREAD_READY)
+    stats_charge_wait (cur, now);
+  if (prev != NULL)
+    cur->stats.run_since = now;
+
   /* Mark us as running. */
   cur->status = THREAD_RUNNING;
-  current_queue = cur->priority;
-  cur->age = 0;
   /* Start new time slice. */
-  thread_ticks = 0;
+  cpu_current ()->thread_ticks = 0;
 
 #ifdef USERPROG
   /* Activate the new address space. */
@@ -836,9 +1037,14 @@ thread_schedule_tail (struct thread *prev)
   if (prev != NULL && prev->status == THREAD_DYING && prev != initial_thread) 
     {
       ASSERT (prev != cur);
-      palloc_free_page (prev);
+      thread_page_put (prev);
+    }
+  if (debug)
+    {
+      sched_edf.dump ();
+      if (scheduler->dump != NULL)
+        scheduler->dump ();
     }
-  if(debug) debug_queue();
 }
 
 /* Schedules a new process.  At entry, interrupts must be off and
@@ -863,6 +1069,7 @@ schedule (void)
   ASSERT (cur->status != THREAD_RUNNING);
   ASSERT (is_thread (next));
 
+  next->cpu = cur->cpu;
   if (cur != next)
     prev = switch_threads (cur, next);
   thread_schedule_tail (prev);
@@ -886,67 +1093,6 @@ allocate_tid (void)
    Used by switch.S, which can't figure it out on its own. */
 uint32_t thread_stack_ofs = offsetof (struct thread, stack);
 
-void debug_queue(void){
-  struct list_elem *e;
-  struct thread *t;
-  printf("\n");
-  printf("\033[33m========================= Debug Info [MLQ] =========================\033[0m\n");
-  printf("\033[36mCurrent Working Thread: [%s] pri:%d \033[0m\n",thread_current()->name,thread_current()->priority);
-  printf("\033[31mcurrent ticks: %d \033[0m\n\n",kernel_ticks);
-  printf("=========== feedback_queue_0 =============\n");
-  if(!list_empty(&feedback_queue_0)){
-    for (e = list_begin(&feedback_queue_0); e != list_end(&feedback_queue_0);
-            e = list_next(e))
-        {
-          t = list_entry (e, struct thread, elem);
-          // printf("[%s] pri:%d, age : %d, e: %p, e->next : %p\n",t->name,t->priority,t->age,e,e->next);
-          printf("[%s] pri:%d, age : %d \n",t->name,t->priority,t->age);
-        }
-  }else{
-    printf("feedback_queue_0 is empty!\n");
-  }
-  printf("=========== feedback_queue_1 =============\n");
-  if(!list_empty(&feedback_queue_1)){
-    for (e = list_begin(&feedback_queue_1); e != list_end(&feedback_queue_1);
-            e = list_next(e))
-        {
-          t = list_entry (e, struct thread, elem);
-          // printf("[%s] pri:%d, age : %d, e: %p, e->next : %p\n",t->name,t->priority,t->age,e,e->next);
-          printf("[%s] pri:%d, age : %d \n",t->name,t->priority,t->age);
-        }
-  }else{
-    printf("feedback_queue_1 is empty!\n");
-  }
-  printf("=========== feedback_queue_2 =============\n");
-  if(!list_empty(&feedback_queue_2)){
-    for (e = list_begin(&feedback_queue_2); e != list_end(&feedback_queue_2);
-            e = list_next(e))
-        {
-          t = list_entry (e, struct thread, elem);
-        //  printf("[%s] pri:%d, age : %d, e: %p, e->next : %p\n",t->name,t->priority,t->age,e,e->next);
-          printf("[%s] pri:%d, age : %d \n",t->name,t->priority,t->age);
-        }
-  }else{
-    printf("feedback_queue_2 is empty!\n");
-  }
-  printf("=========== feedback_queue_3 =============\n");
-  if(!list_empty(&feedback_queue_3)){
-    for (e = list_begin(&feedback_queue_3); e != list_end(&feedback_queue_3);
-            e = list_next(e))
-        {
-          t = list_entry (e, struct thread, elem);
-        //  printf("[%s] pri:%d, age : %d, e: %p, e->next : %p\n",t->name,t->priority,t->age,e,e->next);
-          printf("[%s] pri:%d, age : %d \n",t->name,t->priority,t->age);
-        }
-  }else{
-    printf("feedback_queue_3 is empty!\n");
-  }
-
-  printf("\n");
-  printf("\033[33m========================= Debug End [MLQ] =========================\033[0m\n");
-  printf("\n");
-}
-
 void debug_on(void){
   debug = true;
 }
\ No newline at end of file
@@ -3,6 +3,7 @@
 
 #include <debug.h>
 #include <list.h>
+#include <rbtree.h>
 #include <stdint.h>
 
 /* States in a thread's life cycle. */
@@ -24,6 +25,44 @@ typedef int tid_t;
 #define PRI_DEFAULT 3                  /* Default priority. */
 #define PRI_MAX 4                      /* Highest priority. */
 
+/* Priorities under the 4.4BSD scheduler ("-mlfqs").  Unlike the
+   feedback queue levels above, a larger value runs first. */
+#define PRI_MLFQS_MIN 0                 /* Lowest priority. */
+#define PRI_MLFQS_MAX 63                /* Highest priority. */
+
+/* Thread niceness, for the 4.4BSD scheduler. */
+#define NICE_MIN -20                    /* Least nice (most CPU). */
+#define NICE_DEFAULT 0                  /* Default niceness. */
+#define NICE_MAX 20                     /* Nicest (least CPU). */
+
+/* Number of feedback queue levels. */
+#define MFQ_LEVELS 4
+
+/* Maximum depth of a chain of nested priority donations. */
+#define DONATION_DEPTH_MAX 8
+
+struct lock;
+struct cpu;
+
+/* Per-thread scheduler statistics, printed by the "schedstat"
+   action.  Times are in nanoseconds from timer_nanos().  Under
+   -mlfqs, "level" means the quarter of the priority range the
+   thread is in, best first. */
+struct sched_stats
+  {
+    int64_t ready_since;                /* When last made ready or requeued. */
+    int64_t run_since;                  /* When last switched in. */
+    int64_t woken_at;                   /* When last unblocked. */
+    int64_t run_ns;                     /* Total time running. */
+    int64_t wait_ns[MFQ_LEVELS];        /* Time ready but waiting, per level. */
+    unsigned run_ticks[MFQ_LEVELS];     /* Timer ticks run, per level. */
+    unsigned voluntary;                 /* Switches away by blocking. */
+    unsigned involuntary;               /* Switches away while still ready. */
+    unsigned promotions;                /* Moves up a level by aging. */
+    unsigned demotions;                 /* Moves down a level on yield. */
+    unsigned boosts;                    /* Moves up a level on wakeup. */
+  };
+
 /* A kernel thread or user process.
 
    Each thread structure is stored in its own 4 kB page.  The
@@ -87,9 +126,37 @@ struct thread
     enum thread_status status;          /* Thread state. */
     char name[16];                      /* Name (for debugging purposes). */
     uint8_t *stack;                     /* Saved stack pointer. */
-    int priority;                       /* Priority. */
+    int priority;                       /* Priority, including donations. */
     struct list_elem allelem;           /* List element for all threads list. */
     int age;
+
+    /* For the 4.4BSD scheduler (thread_mlfqs). */
+    int nice;                           /* Niceness. */
+    int recent_cpu;                     /* Recent CPU use, fixed-point. */
+
+    /* For the fair scheduler (sched-fair.c). */
+    int64_t vruntime;                   /* Weighted run time, in ns. */
+    int64_t exec_start;                 /* When run time was last charged,
+                                           also for the real-time class. */
+    struct rb_node run_node;            /* Element in the run queue tree. */
+
+    /* For the real-time class (sched-edf.c).  Times in ns. */
+    int64_t dl_runtime;                 /* Budget per period, or 0. */
+    int64_t dl_period;                  /* Period, or 0 if not real-time. */
+    int64_t dl_deadline;                /* End of current period. */
+    int64_t dl_budget;                  /* Budget left in current period. */
+    bool dl_throttled;                  /* Out of budget until deadline? */
+    unsigned dl_misses;                 /* Deadlines missed. */
+
+    /* Priority donation, owned by thread.c and synch.c. */
+    int base_priority;                  /* Priority without donations. */
+    struct lock *waiting_on;            /* Lock being waited for, if any. */
+    struct list donors;                 /* Threads donating to this one. */
+    struct list_elem donor_elem;        /* Element in holder's `donors'. */
+
+    /* Owned by thread.c. */
+    struct sched_stats stats;           /* Scheduler statistics. */
+
     /* Shared between thread.c and synch.c. */
     struct list_elem elem;              /* List element. */
 
@@ -101,21 +168,37 @@ struct thread
     /* For timer_sleep() */
     int64_t wakeup_tick;
 
+    /* Owned by thread.c. */
+    int64_t blocked_at;                 /* Tick when last blocked, or -1. */
+    struct cpu *cpu;                    /* CPU running it, or that last ran
+                                           it, or whose run queue holds it. */
+    struct cpu *affinity;               /* CPU it must run on, or null. */
+
     /* Owned by thread.c. */
     unsigned magic;                     /* Detects stack overflow. */
   };
 
-/* If false (default), use round-robin scheduler.
-   If true, use multi-level feedback queue scheduler.
-   Controlled by kernel command-line option "-o mlfqs". */
+/* If false (default), priorities are feedback queue levels.  If
+   true, the 4.4BSD scheduler is in use and derives priorities
+   from niceness and recent CPU use.
+   Controlled by kernel command-line options "-o mlfqs" and
+   "-sched=mlfqs". */
 extern bool thread_mlfqs;
 
+/* Wakeup boost policy of the feedback queues.
+   Controlled by kernel command-line options "-boost=N" and
+   "-boost=long". */
+extern int thread_boost_levels;
+extern bool thread_boost_long_sleep;
+
 void thread_init (void);
 void thread_start (void);
+struct thread *thread_create_idle (struct cpu *);
+void thread_run_idle (void) NO_RETURN;
 
 void thread_tick (void);
-void aging(void);
 void thread_print_stats (void);
+void thread_print_schedstats (void);
 
 typedef void thread_func (void *aux);
 tid_t thread_create (const char *name, int priority, thread_func *, void *);
@@ -128,10 +211,10 @@ void thread_sleep (int64_t);
 void thread_wakeup (int64_t);
 
 struct thread *thread_current (void);
+struct thread *running_thread (void);
 tid_t thread_tid (void);
 const char *thread_name (void);
 
-int next_queue_to_search(void);
 void thread_exit (void) NO_RETURN;
 void thread_yield (void);
 
@@ -141,12 +224,19 @@ void thread_foreach (thread_action_func *, void *);
 
 int thread_get_priority (void);
 void thread_set_priority (int);
+bool thread_higher_priority (const struct list_elem *,
+                             const struct list_elem *, void *aux);
+void thread_donate_priority (struct thread *);
+void thread_remove_donors (struct lock *);
+void thread_adopt_donors (struct lock *);
+void thread_refresh_priority (struct thread *);
+
+bool thread_set_deadline (int64_t runtime, int64_t period);
+void thread_set_affinity (int cpu);
 
 int thread_get_nice (void);
 void thread_set_nice (int);
 int thread_get_recent_cpu (void);
 int thread_get_load_avg (void);
 
-void debug_queue(void);
-
 #endif /* threads/thread.h */
\ No newline at end of file
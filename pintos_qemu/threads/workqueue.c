@@ -0,0 +1,286 @@
+#include "threads/workqueue.h"
+#include <debug.h>
+#include <stdio.h>
+#include "threads/interrupt.h"
+#include "threads/thread.h"
+
+/* Workqueues.
+
+   A workqueue runs deferred function calls, "work items", in a
+   pool of kernel worker threads, so that code that cannot block,
+   such as an interrupt handler, can hand off the rest of its
+   work, and so that many small tasks do not each need a thread
+   of their own, with its page, tid, and trips through the
+   scheduler.
+
+   The queue is bounded.  workqueue_push() blocks while it is
+   full, and workqueue_try_push(), which interrupt handlers must
+   use, fails instead.  A worker that wakes up takes every queued
+   item, up to WQ_BATCH, at once, and runs them one after
+   another, so that a burst of items costs one wakeup rather than
+   one each.
+
+   A per-CPU workqueue has a separate queue and set of workers
+   for each CPU.  Its workers have affinity for their CPU, and
+   items pushed on a CPU run there unless pushed elsewhere with
+   workqueue_push_on(). */
+
+/* The system workqueue. */
+struct workqueue system_wq;
+
+#define WQ_SYSTEM_WORKERS 2     /* Worker threads. */
+#define WQ_SYSTEM_CAPACITY 256  /* Most queued items. */
+
+/* A thread waiting in workqueue_flush(). */
+struct flusher
+  {
+    struct list_elem elem;      /* Element in workqueue's `flushers'. */
+    struct semaphore done;      /* Upped when the workqueue drains. */
+  };
+
+static void worker (void *pool_);
+static struct workqueue_pool *pool_of (struct workqueue *, int cpu);
+static bool push (struct workqueue_pool *, struct work *, bool wait);
+
+/* Initializes W to call FUNC (AUX). */
+void
+work_init (struct work *w, work_func *func, void *aux)
+{
+  ASSERT (w != NULL);
+  ASSERT (func != NULL);
+
+  w->func = func;
+  w->aux = aux;
+  w->pending = false;
+}
+
+/* Initializes WQ, named NAME, and starts WORKERS worker threads
+   for it at PRIORITY, or that many per CPU if PER_CPU.  At most
+   CAPACITY items may wait in the queue, or in each CPU's queue.
+   Returns false if a worker thread could not be created. */
+bool
+workqueue_init (struct workqueue *wq, const char *name, int priority,
+                int workers, size_t capacity, bool per_cpu)
+{
+  int i, j;
+
+  ASSERT (wq != NULL);
+  ASSERT (workers > 0);
+  ASSERT (capacity > 0);
+
+  wq->name = name;
+  wq->per_cpu = per_cpu;
+  wq->pool_cnt = per_cpu ? cpu_cnt : 1;
+  wq->in_flight = 0;
+  list_init (&wq->flushers);
+  wq->done = wq->batches = wq->overflows = 0;
+  wq->max_depth = 0;
+
+  for (i = 0; i < wq->pool_cnt; i++)
+    {
+      struct workqueue_pool *pool = &wq->pools[i];
+
+      pool->wq = wq;
+      pool->cpu = i;
+      list_init (&pool->items);
+      pool->depth = 0;
+      sema_init (&pool->queued, 0);
+      sema_init (&pool->space, capacity);
+      for (j = 0; j < workers; j++)
+        {
+          char tname[16];
+
+          snprintf (tname, sizeof tname, "%s/%d", name, i * workers + j);
+          if (thread_create (tname, priority, worker, pool) == TID_ERROR)
+            return false;
+        }
+    }
+  return true;
+}
+
+/* Initializes the system workqueue.  Must be called after
+   smp_init(). */
+void
+workqueue_init_system (void)
+{
+  if (!workqueue_init (&system_wq, "events", PRI_MIN, WQ_SYSTEM_WORKERS,
+                       WQ_SYSTEM_CAPACITY, false))
+    PANIC ("could not start system workqueue");
+}
+
+/* Queues W on WQ, on the running CPU's queue if WQ is per-CPU,
+   waiting for room if the queue is full.  Returns false, doing
+   nothing, if W is already queued.  Must not be called from an
+   interrupt handler. */
+bool
+workqueue_push (struct workqueue *wq, struct work *w)
+{
+  ASSERT (!intr_context ());
+
+  return push (pool_of (wq, cpu_current ()->id), w, true);
+}
+
+/* Queues W on WQ to run on CPU, an index in cpus[], if WQ is
+   per-CPU, waiting for room if the queue is full.  Returns false,
+   doing nothing, if W is already queued.  Must not be called
+   from an interrupt handler. */
+bool
+workqueue_push_on (struct workqueue *wq, int cpu, struct work *w)
+{
+  ASSERT (!intr_context ());
+  ASSERT (cpu >= 0 && cpu < cpu_cnt);
+
+  return push (pool_of (wq, cpu), w, true);
+}
+
+/* Queues W on WQ, on the running CPU's queue if WQ is per-CPU.
+   Returns false, doing nothing, if W is already queued or the
+   queue is full.
+
+   This function may be called from an interrupt handler. */
+bool
+workqueue_try_push (struct workqueue *wq, struct work *w)
+{
+  return push (pool_of (wq, cpu_current ()->id), w, false);
+}
+
+/* Waits until WQ has no work queued or running. */
+void
+workqueue_flush (struct workqueue *wq)
+{
+  struct flusher f;
+  enum intr_level old_level;
+
+  ASSERT (!intr_context ());
+
+  old_level = intr_disable ();
+  if (wq->in_flight > 0)
+    {
+      sema_init (&f.done, 0);
+      list_push_back (&wq->flushers, &f.elem);
+      intr_set_level (old_level);
+      sema_down (&f.done);
+    }
+  else
+    intr_set_level (old_level);
+}
+
+/* Prints WQ's statistics. */
+void
+workqueue_print_stats (const struct workqueue *wq)
+{
+  printf ("Workqueue %s: %lld items in %lld batches, %lld overflows, "
+          "max depth %d\n", wq->name, wq->done, wq->batches,
+          wq->overflows, wq->max_depth);
+}
+
+/* Returns WQ's pool for CPU. */
+static struct workqueue_pool *
+pool_of (struct workqueue *wq, int cpu)
+{
+  return &wq->pools[wq->per_cpu && cpu < wq->pool_cnt ? cpu : 0];
+}
+
+/* Queues W on POOL, first waiting for room if WAIT or failing if
+   there is none otherwise.  Returns true if W was queued. */
+static bool
+push (struct workqueue_pool *pool, struct work *w, bool wait)
+{
+  struct workqueue *wq = pool->wq;
+  enum intr_level old_level;
+
+  ASSERT (w != NULL);
+
+  if (w->pending)
+    return false;
+  if (wait)
+    sema_down (&pool->space);
+  else if (!sema_try_down (&pool->space))
+    {
+      old_level = intr_disable ();
+      wq->overflows++;
+      intr_set_level (old_level);
+      return false;
+    }
+
+  old_level = intr_disable ();
+  if (w->pending)
+    {
+      /* Queued by someone else while we waited for room. */
+      intr_set_level (old_level);
+      sema_up (&pool->space);
+      return false;
+    }
+  w->pending = true;
+  list_push_back (&pool->items, &w->elem);
+  if (++pool->depth > wq->max_depth)
+    wq->max_depth = pool->depth;
+  wq->in_flight++;
+  sema_up (&pool->queued);
+  intr_set_level (old_level);
+  return true;
+}
+
+/* Worker thread for POOL_: takes batches of work items and runs
+   them, forever. */
+static void
+worker (void *pool_)
+{
+  struct workqueue_pool *pool = pool_;
+  struct workqueue *wq = pool->wq;
+
+  if (wq->per_cpu)
+    thread_set_affinity (pool->cpu);
+
+  for (;;)
+    {
+      struct work *batch[WQ_BATCH];
+      enum intr_level old_level;
+      int cnt, i;
+
+      /* Wait for one item, then claim the rest that are queued,
+         up to WQ_BATCH. */
+      sema_down (&pool->queued);
+      old_level = intr_disable ();
+      cnt = 0;
+      do
+        {
+          struct work *w = list_entry (list_pop_front (&pool->items),
+                                       struct work, elem);
+          pool->depth--;
+          batch[cnt++] = w;
+          sema_up (&pool->space);
+        }
+      while (cnt < WQ_BATCH && sema_try_down (&pool->queued));
+      wq->batches++;
+      intr_set_level (old_level);
+
+      /* An item stays pending until it starts, so queuing it
+         again before then is a no-op.  Once it is running it may
+         be queued again, or freed, so we must not touch it
+         afterward. */
+      for (i = 0; i < cnt; i++)
+        {
+          struct work *w = batch[i];
+          work_func *func = w->func;
+          void *aux = w->aux;
+
+          old_level = intr_disable ();
+          w->pending = false;
+          intr_set_level (old_level);
+          func (aux);
+        }
+
+      old_level = intr_disable ();
+      wq->done += cnt;
+      wq->in_flight -= cnt;
+      if (wq->in_flight == 0)
+        while (!list_empty (&wq->flushers))
+          {
+            struct flusher *f = list_entry (list_pop_front (&wq->flushers),
+                                            struct flusher, elem);
+            sema_up (&f->done);
+          }
+      intr_set_level (old_level);
+    }
+}
@@ -0,0 +1,71 @@
+#ifndef THREADS_WORKQUEUE_H
+#define THREADS_WORKQUEUE_H
+
+#include <list.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include "threads/smp.h"
+#include "threads/synch.h"
+
+/* Most work items a worker takes off its queue at once. */
+#define WQ_BATCH 8
+
+/* Function for a work item to run, given its auxiliary data. */
+typedef void work_func (void *aux);
+
+/* A deferred call of FUNC (AUX), to be run by a workqueue's
+   worker thread.  Owned by the caller, which must keep it alive
+   until it has run. */
+struct work
+  {
+    struct list_elem elem;      /* Element in a workqueue. */
+    work_func *func;            /* Function to call. */
+    void *aux;                  /* Its argument. */
+    bool pending;               /* Queued but not yet started? */
+  };
+
+/* The part of a workqueue served by one group of workers: the
+   whole queue, or one CPU's share of a per-CPU queue. */
+struct workqueue_pool
+  {
+    struct workqueue *wq;       /* Workqueue it belongs to. */
+    int cpu;                    /* CPU of its workers, if per-CPU. */
+    struct list items;          /* Queued work items. */
+    int depth;                  /* # of items in `items'. */
+    struct semaphore queued;    /* # of items not yet claimed. */
+    struct semaphore space;     /* # of items that may still be queued. */
+  };
+
+/* A queue of work items with a pool of worker threads. */
+struct workqueue
+  {
+    const char *name;           /* Name, for worker threads and stats. */
+    bool per_cpu;               /* One pool per CPU? */
+    int pool_cnt;               /* # of pools in use. */
+    struct workqueue_pool pools[CPU_MAX];
+    int in_flight;              /* # of items queued or running. */
+    struct list flushers;       /* Threads in workqueue_flush(). */
+
+    /* Statistics. */
+    long long done;             /* # of items run. */
+    long long batches;          /* # of times a worker took items. */
+    long long overflows;        /* # of failed workqueue_try_push(). */
+    int max_depth;              /* Most items ever queued in a pool. */
+  };
+
+/* Workqueue for deferred work from interrupt handlers and other
+   small tasks that should not each need a thread. */
+extern struct workqueue system_wq;
+
+void work_init (struct work *, work_func *, void *aux);
+
+bool workqueue_init (struct workqueue *, const char *name, int priority,
+                     int workers, size_t capacity, bool per_cpu);
+void workqueue_init_system (void);
+bool workqueue_push (struct workqueue *, struct work *);
+bool workqueue_push_on (struct workqueue *, int cpu, struct work *);
+bool workqueue_try_push (struct workqueue *, struct work *);
+void workqueue_flush (struct workqueue *);
+void workqueue_print_stats (const struct workqueue *);
+
+#endif /* threads/workqueue.h */